@@ -0,0 +1,586 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "async_logger.h"
+
+using namespace std::chrono;
+
+/**
+ * @brief A single producer single consumer ring of the records of one thread.
+ *  A record never wraps, a padding record fills the end of the ring instead.
+ *
+ */
+class LogRing
+{
+public:
+    LogRing() : buf_(new char[LOG_RING_SIZE]), head_(0), tail_(0), dropped_(0)
+    {
+        std::ostringstream out;
+        out << std::this_thread::get_id();
+        thread_id_ = out.str();
+    }
+    ~LogRing() { delete[] buf_; }
+
+    /**
+     * @brief Copy a record into the ring, should be called by the owner thread only.
+     *
+     * @param head
+     * @return bool false if the ring is full and the record is dropped.
+     */
+    bool Push(const LogRecordHead *head)
+    {
+        uint64_t size = head->size;
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto offset = tail % LOG_RING_SIZE;
+        auto padding = offset + size > LOG_RING_SIZE ? LOG_RING_SIZE - offset : 0;
+        if (tail + padding + size - head_.load(std::memory_order_acquire) > LOG_RING_SIZE)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (padding > 0)
+        {
+            // only the size and the level of the padding are written, it may be 8 bytes only.
+            uint32_t padding_size = padding;
+            uint8_t padding_level = LOG_LEVEL_PADDING;
+            memcpy(buf_ + offset, &padding_size, sizeof(padding_size));
+            memcpy(buf_ + offset + offsetof(LogRecordHead, level), &padding_level, sizeof(padding_level));
+            tail += padding;
+            offset = 0;
+        }
+        memcpy(buf_ + offset, head, size);
+        tail_.store(tail + size, std::memory_order_release);
+        return true;
+    }
+    /**
+     * @brief Get the oldest record, should be called by the consumer thread only.
+     *
+     * @return const LogRecordHead* NULL if the ring is empty.
+     */
+    const LogRecordHead *Peek()
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        while (head != tail_.load(std::memory_order_acquire))
+        {
+            auto record = reinterpret_cast<const LogRecordHead *>(buf_ + head % LOG_RING_SIZE);
+            if (record->level != LOG_LEVEL_PADDING)
+                return record;
+            head += record->size;
+            head_.store(head, std::memory_order_release);
+        }
+        return NULL;
+    }
+    /**
+     * @brief Release the record returned by Peek.
+     *
+     */
+    void Pop()
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto record = reinterpret_cast<const LogRecordHead *>(buf_ + head % LOG_RING_SIZE);
+        head_.store(head + record->size, std::memory_order_release);
+    }
+
+    uint64_t GetDroppedCount() const { return dropped_.load(std::memory_order_relaxed); }
+    const std::string &GetThreadId() const { return thread_id_; }
+
+private:
+    char *buf_;
+    // the read position, owned by the consumer.
+    std::atomic<uint64_t> head_;
+    // the write position, owned by the producer.
+    std::atomic<uint64_t> tail_;
+    std::atomic<uint64_t> dropped_;
+    std::string thread_id_;
+};
+
+namespace
+{
+
+struct LogArg
+{
+    LogArgType type;
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+    std::string s;
+};
+
+void AppendFormat(std::string &out, const char *fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int result = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (result < 0)
+        return;
+    if (result < (int)sizeof(buf))
+    {
+        out.append(buf, result);
+        return;
+    }
+    std::vector<char> large(result + 1);
+    va_start(args, fmt);
+    vsnprintf(large.data(), large.size(), fmt, args);
+    va_end(args);
+    out.append(large.data(), result);
+}
+
+int64_t GetInt(const LogArg &arg)
+{
+    switch (arg.type)
+    {
+    case LOG_ARG_INT:
+        return arg.i;
+    case LOG_ARG_DOUBLE:
+        return (int64_t)arg.d;
+    case LOG_ARG_STRING:
+        return 0;
+    default:
+        return (int64_t)arg.u;
+    }
+}
+
+double GetDouble(const LogArg &arg)
+{
+    switch (arg.type)
+    {
+    case LOG_ARG_INT:
+        return (double)arg.i;
+    case LOG_ARG_DOUBLE:
+        return arg.d;
+    case LOG_ARG_STRING:
+        return 0;
+    default:
+        return (double)arg.u;
+    }
+}
+
+/**
+ * @brief Format the printf style format with the recorded args, the length modifiers
+ *  are ignored since every integer is recorded as 64 bits.
+ *
+ */
+void FormatMessage(const char *fmt, const std::vector<LogArg> &args, std::string &out)
+{
+    size_t index = 0;
+    const char *p = fmt;
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            auto next = strchr(p, '%');
+            if (!next)
+                next = p + strlen(p);
+            out.append(p, next - p);
+            p = next;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out.push_back('%');
+            p += 2;
+            continue;
+        }
+        auto start = p++;
+        std::string spec = "%";
+        while (*p && strchr("-+ #0", *p))
+            spec.push_back(*p++);
+        if (*p == '*')
+        {
+            spec += std::to_string(index < args.size() ? GetInt(args[index++]) : 0);
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            spec.push_back(*p++);
+        if (*p == '.')
+        {
+            spec.push_back(*p++);
+            if (*p == '*')
+            {
+                spec += std::to_string(index < args.size() ? GetInt(args[index++]) : 0);
+                p++;
+            }
+            while (*p >= '0' && *p <= '9')
+                spec.push_back(*p++);
+        }
+        bool is_long = false;
+        while (*p && strchr("hlLqjzt", *p))
+            is_long |= *p++ != 'h';
+        if (!*p)
+        {
+            out.append(start);
+            break;
+        }
+        auto conversion = *p++;
+        if (index >= args.size())
+        {
+            out.append(start, p - start);
+            continue;
+        }
+        auto &arg = args[index++];
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+            spec += "lld";
+            AppendFormat(out, spec.c_str(), (long long)GetInt(arg));
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec += "ll";
+            spec.push_back(conversion);
+            // a negative int is printed in 32 bits as printf does.
+            AppendFormat(out, spec.c_str(), (unsigned long long)(is_long || arg.type != LOG_ARG_INT ? GetInt(arg) : (uint32_t)GetInt(arg)));
+            break;
+        case 'c':
+            spec.push_back(conversion);
+            AppendFormat(out, spec.c_str(), (int)GetInt(arg));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec.push_back(conversion);
+            AppendFormat(out, spec.c_str(), GetDouble(arg));
+            break;
+        case 's':
+            spec.push_back(conversion);
+            AppendFormat(out, spec.c_str(), arg.type == LOG_ARG_STRING ? arg.s.c_str() : "(?)");
+            break;
+        case 'p':
+            spec.push_back(conversion);
+            AppendFormat(out, spec.c_str(), (void *)(uintptr_t)GetInt(arg));
+            break;
+        default:
+            out.append(start, p - start);
+            break;
+        }
+    }
+}
+
+} // namespace
+
+/**
+ * @brief The state shared by the producers and the background thread.
+ *
+ */
+class AsyncLoggerImpl
+{
+public:
+    AsyncLoggerImpl() : is_running_(true), is_stopping_(false), is_waiting_(false), dropped_retired_(0), dropped_reported_(0), last_second_(-1)
+    {
+        thread_ = std::thread(&AsyncLoggerImpl::Run, this);
+        std::atexit(AsyncLogger::Shutdown);
+    }
+
+    std::shared_ptr<LogRing> Register()
+    {
+        auto ring = std::make_shared<LogRing>();
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    void Write(const LogRecordHead *head, const std::string &thread_id)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        std::string out;
+        Format(head, thread_id, out);
+        auto &stream = head->level >= 4 ? std::cerr : std::clog;
+        stream.write(out.data(), out.size());
+        stream.flush();
+    }
+
+    void Stop()
+    {
+        if (!is_running_.exchange(false))
+            return;
+        is_stopping_ = true;
+        {
+            std::lock_guard<std::mutex> lock(wait_mutex_);
+            wait_cv_.notify_one();
+        }
+        thread_.join();
+    }
+
+    /**
+     * @brief Wake the background thread up if it waits for the records.
+     *
+     */
+    void Notify()
+    {
+        // the load is cheaper than the exchange for every record while the thread is busy.
+        if (!is_waiting_.load(std::memory_order_relaxed) || !is_waiting_.exchange(false))
+            return;
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        wait_cv_.notify_one();
+    }
+
+    uint64_t GetDroppedCount()
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        uint64_t count = dropped_retired_;
+        for (auto &ring : rings_)
+            count += ring->GetDroppedCount();
+        return count;
+    }
+
+    bool IsRunning() const { return is_running_.load(std::memory_order_relaxed); }
+
+private:
+    void Run()
+    {
+        while (true)
+        {
+            bool is_stopping = is_stopping_;
+            bool is_drained = Drain() == 0;
+            // the rings are not referenced by Drain any more.
+            Retire();
+            if (is_stopping)
+                break;
+            if (is_drained)
+            {
+                // a record racing with is_waiting_ is printed after the timeout at most.
+                std::unique_lock<std::mutex> lock(wait_mutex_);
+                is_waiting_ = true;
+                wait_cv_.wait_for(lock, milliseconds(LOG_IDLE_WAIT), [this] { return !is_waiting_ || is_stopping_; });
+                is_waiting_ = false;
+            }
+        }
+    }
+
+    /**
+     * @brief Print the records of all the rings in time order.
+     *
+     * @return int the records count.
+     */
+    int Drain()
+    {
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings = rings_;
+        }
+        int count = 0;
+        std::string out;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            while (true)
+            {
+                LogRing *oldest = NULL;
+                const LogRecordHead *oldest_head = NULL;
+                for (auto &ring : rings)
+                {
+                    auto head = ring->Peek();
+                    if (head && (!oldest_head || head->time < oldest_head->time))
+                    {
+                        oldest = ring.get();
+                        oldest_head = head;
+                    }
+                }
+                if (!oldest)
+                    break;
+                Format(oldest_head, oldest->GetThreadId(), out);
+                oldest->Pop();
+                count++;
+            }
+            ReportDropped(rings, out);
+            if (!out.empty())
+            {
+                std::clog.write(out.data(), out.size());
+                std::clog.flush();
+            }
+        }
+        return count;
+    }
+
+    void ReportDropped(const std::vector<std::shared_ptr<LogRing>> &rings, std::string &out)
+    {
+        uint64_t dropped = dropped_retired_;
+        for (auto &ring : rings)
+            dropped += ring->GetDroppedCount();
+        if (dropped == dropped_reported_)
+            return;
+        UpdateTime(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+        AppendFormat(out, "[WAR][%s][logger] dropped %llu log records, %llu in total.\n",
+                     time_.c_str(), (unsigned long long)(dropped - dropped_reported_), (unsigned long long)dropped);
+        dropped_reported_ = dropped;
+    }
+
+    /**
+     * @brief Remove the drained rings whose threads have exited.
+     *
+     */
+    void Retire()
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        for (auto it = rings_.begin(); it != rings_.end();)
+        {
+            if (it->use_count() == 1 && !(*it)->Peek())
+            {
+                dropped_retired_ += (*it)->GetDroppedCount();
+                it = rings_.erase(it);
+            }
+            else
+                it++;
+        }
+    }
+
+    void Format(const LogRecordHead *head, const std::string &thread_id, std::string &out)
+    {
+        std::vector<LogArg> args(head->argc);
+        auto p = reinterpret_cast<const char *>(head) + sizeof(LogRecordHead);
+        for (auto &arg : args)
+        {
+            arg.type = (LogArgType)*p++;
+            switch (arg.type)
+            {
+            case LOG_ARG_STRING:
+            {
+                uint16_t length;
+                memcpy(&length, p, sizeof(length));
+                p += sizeof(length);
+                arg.s.assign(p, length);
+                p += length;
+                break;
+            }
+            default:
+                memcpy(&arg.u, p, sizeof(arg.u));
+                p += sizeof(arg.u);
+                break;
+            }
+        }
+
+        switch (head->level)
+        {
+        case 0:
+            out += "[VER]";
+            break;
+        case 1:
+            out += "[DBG]";
+            break;
+        case 3:
+            out += "[WAR]";
+            break;
+        case 4:
+            out += "[ERR]";
+            break;
+        default:
+            out += "[INF]";
+        }
+        UpdateTime(head->time);
+        out += "[";
+        out += time_;
+        out += "][";
+        out += thread_id;
+        out += "]";
+        out += head->tag;
+        FormatMessage(head->fmt, args, out);
+        out += "\n";
+    }
+
+    /**
+     * @brief Update time_ to the time of the record, the seconds part is cached.
+     *
+     */
+    void UpdateTime(int64_t time)
+    {
+        auto ns = nanoseconds(time);
+        auto second = duration_cast<seconds>(ns).count();
+        if (second != last_second_)
+        {
+            time_t tm = second;
+            struct tm local;
+#ifdef WIN32
+            localtime_s(&local, &tm);
+#else
+            localtime_r(&tm, &local);
+#endif
+            char buf[64] = {0};
+            // %T is not supported by mingw-w64.
+            strftime(buf, sizeof(buf), "%m/%d %H:%M:%S", &local);
+            second_ = buf;
+            last_second_ = second;
+        }
+        char ms[8];
+        snprintf(ms, sizeof(ms), ".%03d", (int)(duration_cast<milliseconds>(ns).count() % 1000));
+        time_ = second_ + ms;
+    }
+
+    std::atomic<bool> is_running_;
+    std::atomic<bool> is_stopping_;
+    // the background thread waits for the producers when the rings are drained.
+    std::atomic<bool> is_waiting_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+    std::thread thread_;
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    uint64_t dropped_retired_;
+    uint64_t dropped_reported_;
+    // guards the output and the cached time.
+    std::mutex write_mutex_;
+    int64_t last_second_;
+    std::string second_;
+    std::string time_;
+};
+
+static AsyncLoggerImpl &GetImpl()
+{
+    // never deleted, so the logs in the static destructors are still printed.
+    static AsyncLoggerImpl *impl = new AsyncLoggerImpl();
+    return *impl;
+}
+
+int64_t AsyncLogger::Now()
+{
+    return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+void AsyncLogger::Push(LogRecordHead *head)
+{
+    thread_local std::shared_ptr<LogRing> ring;
+    auto &impl = GetImpl();
+    if (!ring)
+        ring = impl.Register();
+    // the errors are printed at once in case of a crash.
+    if (head->level >= 4 || !impl.IsRunning())
+    {
+        impl.Write(head, ring->GetThreadId());
+        return;
+    }
+    if (ring->Push(head))
+        impl.Notify();
+}
+
+uint64_t AsyncLogger::GetDroppedCount()
+{
+    return GetImpl().GetDroppedCount();
+}
+
+void AsyncLogger::Shutdown()
+{
+    GetImpl().Stop();
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+// the bytes of the log ring of every thread, the records are dropped if it is full.
+#define LOG_RING_SIZE (256 * 1024)
+// the max bytes of one record, the long strings are truncated to fit.
+#define LOG_RECORD_MAX_SIZE 4096
+// the milliseconds the background thread waits at most when no record is pushed.
+#define LOG_IDLE_WAIT 100
+// the level of the padding record at the end of a ring.
+#define LOG_LEVEL_PADDING 0xff
+
+enum LogArgType : uint8_t
+{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER
+};
+
+/**
+ * @brief The head of a binary log record, the typed args follow it.
+ *  The tag and the format are string literals, so only their addresses are kept.
+ *
+ */
+struct LogRecordHead
+{
+    // the bytes of the record including the head, 8 bytes aligned.
+    uint32_t size;
+    uint8_t level;
+    uint8_t argc;
+    // system_clock in nanoseconds.
+    int64_t time;
+    const char *tag;
+    const char *fmt;
+};
+
+/**
+ * @brief Serialize the printf args into a record without formatting them.
+ *
+ */
+class LogEncoder
+{
+public:
+    LogEncoder(char *buf, size_t capacity) : buf_(buf), capacity_(capacity), size_(sizeof(LogRecordHead)), argc_(0) {}
+
+    void Encode() {}
+    template <typename T, typename... Args>
+    void Encode(const T &arg, const Args &... args)
+    {
+        Put(arg);
+        Encode(args...);
+    }
+
+    size_t GetSize() const { return size_; }
+    uint8_t GetArgc() const { return argc_; }
+
+private:
+    template <typename T>
+    typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value) || std::is_enum<T>::value>::type
+    Put(const T &arg) { PutValue(LOG_ARG_INT, (int64_t)arg); }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+    Put(const T &arg) { PutValue(LOG_ARG_UINT, (uint64_t)arg); }
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    Put(const T &arg) { PutValue(LOG_ARG_DOUBLE, (double)arg); }
+    template <typename T>
+    typename std::enable_if<std::is_pointer<T>::value && !std::is_same<typename std::decay<typename std::remove_pointer<T>::type>::type, char>::value>::type
+    Put(const T &arg) { PutValue(LOG_ARG_POINTER, (uint64_t)(uintptr_t)arg); }
+    void Put(const char *arg) { PutString(arg ? arg : "(null)"); }
+    void Put(char *arg) { PutString(arg ? arg : "(null)"); }
+    template <size_t N>
+    void Put(const char (&arg)[N]) { PutString(arg); }
+    template <size_t N>
+    void Put(char (&arg)[N]) { PutString(arg); }
+
+    template <typename T>
+    void PutValue(LogArgType type, T value)
+    {
+        if (size_ + 1 + sizeof(T) > capacity_)
+            return;
+        buf_[size_++] = type;
+        memcpy(buf_ + size_, &value, sizeof(T));
+        size_ += sizeof(T);
+        argc_++;
+    }
+    void PutString(const char *arg)
+    {
+        if (size_ + 1 + sizeof(uint16_t) > capacity_)
+            return;
+        size_t length = strlen(arg);
+        length = std::min(length, capacity_ - size_ - 1 - sizeof(uint16_t));
+        uint16_t len = (uint16_t)length;
+        buf_[size_++] = LOG_ARG_STRING;
+        memcpy(buf_ + size_, &len, sizeof(len));
+        size_ += sizeof(len);
+        memcpy(buf_ + size_, arg, len);
+        size_ += len;
+        argc_++;
+    }
+
+    char *buf_;
+    size_t capacity_;
+    size_t size_;
+    uint8_t argc_;
+};
+
+class LogRing;
+
+/**
+ * @brief Every thread writes the binary records into its own lock-free ring, and a
+ *  background thread formats and prints them in time order. The errors are printed
+ *  at once so they survive a crash.
+ *
+ */
+class AsyncLogger
+{
+public:
+    template <typename... Args>
+    static void Log(int level, const char *tag, const char *fmt, const Args &... args)
+    {
+        char buf[LOG_RECORD_MAX_SIZE];
+        LogEncoder encoder(buf, sizeof(buf));
+        encoder.Encode(args...);
+        auto head = reinterpret_cast<LogRecordHead *>(buf);
+        head->size = (encoder.GetSize() + 7) & ~7;
+        head->level = level;
+        head->argc = encoder.GetArgc();
+        head->time = Now();
+        head->tag = tag;
+        head->fmt = fmt;
+        Push(head);
+    }
+
+    /**
+     * @brief Get the records count dropped because the ring of their thread was full.
+     *
+     * @return uint64_t
+     */
+    static uint64_t GetDroppedCount();
+    /**
+     * @brief Print all the pushed records and stop the background thread, the later
+     *  records are printed at once.
+     *
+     */
+    static void Shutdown();
+
+private:
+    static int64_t Now();
+    static void Push(LogRecordHead *head);
+};
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif // __linux__
+
+#include "buffer_pool.h"
+
+BufferPool::BufferPool(size_t buffer_size, bool is_hugepage)
+    : buffer_size_(buffer_size), count_(0), is_hugepage_(is_hugepage) {}
+
+BufferPool::~BufferPool()
+{
+    if (free_.size() != count_)
+    {
+        // the borrowed buffers outlive the pool, leak the slabs rather than free them.
+        LOGEP("buffer pool destroyed with %ld borrowed buffers.", (long)(count_ - free_.size()));
+        return;
+    }
+    for (auto &slab : slabs_)
+    {
+#ifdef __linux__
+        munmap(slab.first, slab.second);
+#else
+        free(slab.first);
+#endif // __linux__
+    }
+}
+
+BufferPool::Buffer BufferPool::Get()
+{
+    if (free_.empty() && Grow() < 0)
+        return Buffer();
+    auto data = free_.back();
+    free_.pop_back();
+    return Buffer(this, data);
+}
+
+int BufferPool::Grow()
+{
+    // a slab holds one buffer at least, the large buffers take a slab each.
+    size_t size = std::max<size_t>(BUFFER_SLAB_SIZE, buffer_size_);
+    size = (size + BUFFER_SLAB_SIZE - 1) / BUFFER_SLAB_SIZE * BUFFER_SLAB_SIZE;
+    char *slab = NULL;
+#ifdef __linux__
+    void *addr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (is_hugepage_)
+    {
+        // it needs the reserved huge pages (vm.nr_hugepages).
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr == MAP_FAILED)
+        {
+            LOGWP("mmap huge pages error: %s, fallback to transparent huge pages.", strerror(errno));
+            is_hugepage_ = false;
+        }
+    }
+#endif // MAP_HUGETLB
+    if (addr == MAP_FAILED)
+    {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+        {
+            LOGEP("mmap buffer slab error: %s", strerror(errno));
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(addr, size, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+    }
+    slab = (char *)addr;
+#else
+    slab = (char *)malloc(size);
+    ASSERT_RETURN(slab, -1, "malloc buffer slab error.");
+#endif // __linux__
+    slabs_.push_back({slab, size});
+    auto count = size / buffer_size_;
+    for (size_t i = 0; i < count; i++)
+        free_.push_back(slab + i * buffer_size_);
+    count_ += count;
+    LOGDP("buffer pool grows: size=%ld, count=%ld, hugepage=%d", (long)size, (long)count_, is_hugepage_);
+    return 0;
+}
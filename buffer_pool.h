@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "sock.h"
+
+// the memory allocated at a time, it is one huge page on x86-64.
+#define BUFFER_SLAB_SIZE (2 * 1024 * 1024)
+
+/**
+ * @brief A pool of fixed size packet buffers carved from large slabs, it is owned by one
+ *  event loop and not thread safe. The buffers are recycled, so the receive paths do not
+ *  allocate once the pool is warm.
+ *
+ */
+class BufferPool
+{
+public:
+    /**
+     * @brief A buffer borrowed from the pool, it goes back to the pool when destroyed.
+     *  It must not outlive the pool.
+     *
+     */
+    class Buffer
+    {
+    public:
+        Buffer() : pool_(NULL), data_(NULL) {}
+        Buffer(Buffer &&other) : pool_(other.pool_), data_(other.data_) { other.data_ = NULL; }
+        Buffer &operator=(Buffer &&other)
+        {
+            if (this != &other)
+            {
+                Release();
+                pool_ = other.pool_;
+                data_ = other.data_;
+                other.data_ = NULL;
+            }
+            return *this;
+        }
+        ~Buffer() { Release(); }
+
+        char *data() const { return data_; }
+        size_t size() const { return pool_ ? pool_->GetBufferSize() : 0; }
+        explicit operator bool() const { return data_ != NULL; }
+
+    private:
+        Buffer(BufferPool *pool, char *data) : pool_(pool), data_(data) {}
+        void Release()
+        {
+            if (data_)
+                pool_->Put(data_);
+            data_ = NULL;
+        }
+
+        BufferPool *pool_;
+        char *data_;
+
+        friend class BufferPool;
+        DISALLOW_COPY_AND_ASSIGN(Buffer);
+    };
+
+    /**
+     * @brief Construct a new Buffer Pool object, no memory is allocated until the first Get.
+     *
+     * @param buffer_size
+     * @param is_hugepage back the slabs by huge pages if possible, fallback to the normal pages.
+     */
+    BufferPool(size_t buffer_size = MAX_UDP_LENGTH, bool is_hugepage = false);
+    ~BufferPool();
+
+    /**
+     * @brief Borrow a buffer, the pool grows by a slab if there is no free one.
+     *
+     * @return Buffer an empty buffer if out of memory.
+     */
+    Buffer Get();
+
+    size_t GetBufferSize() const { return buffer_size_; }
+    /**
+     * @brief Get the buffers count carved from the slabs.
+     *
+     * @return size_t
+     */
+    size_t GetCount() const { return count_; }
+    size_t GetFreeCount() const { return free_.size(); }
+    bool IsHugepage() const { return is_hugepage_; }
+
+private:
+    void Put(char *data) { free_.push_back(data); }
+    int Grow();
+
+    size_t buffer_size_;
+    size_t count_;
+    bool is_hugepage_;
+    std::vector<char *> free_;
+    /**
+     * @brief The slabs and their sizes.
+     *
+     */
+    std::vector<std::pair<char *, size_t>> slabs_;
+
+    DISALLOW_COPY_AND_ASSIGN(BufferPool);
+};
@@ -12,5 +12,6 @@ REGISER_COMMAND(send,SendCommand);
 REGISER_PRIVATE_COMMAND(ack,AckCommand);
 REGISER_PRIVATE_COMMAND(stop,StopCommand);
 REGISER_PRIVATE_COMMAND(result,ResultCommand);
+REGISER_PRIVATE_COMMAND(report,ReportCommand);
 
 
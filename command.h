@@ -3,13 +3,18 @@
 #include <map>
 #include <vector>
 #include <memory>
+#include <atomic>
 #include <sstream>
 #include <functional>
+#include <algorithm>
 #include <unistd.h>
 #include <math.h>
+#include <string.h>
 
 #include "command_receiver.h"
 #include "command_sender.h"
+#include "latency_histogram.h"
+#include "quantile_sketch.h"
 #include "netsnoop.h"
 
 #define MAX_CMD_LENGTH 1024
@@ -23,6 +28,7 @@
 class CommandFactory;
 class Command;
 class NetStat;
+class ControlChannel;
 
 extern std::map<std::string, int> g_cmd_map;
 
@@ -131,6 +137,55 @@ struct NetStat
      */
     long long jitter_std;
 
+    /**
+     * @brief The interarrival jitter of RFC 3550 in microseconds, the smoothed delay
+     *  difference of the consecutive packets, the average and the max of the peers
+     * 
+     */
+    int jitter_rfc3550_us;
+    int max_jitter_rfc3550_us;
+
+    /**
+     * @brief The delay percentiles in microseconds, p999 is 99.9% and p9999 is 99.99%
+     * 
+     */
+    int delay_p50_us;
+    int delay_p90_us;
+    int delay_p99_us;
+    int delay_p999_us;
+    int delay_p9999_us;
+    /**
+     * @brief The delays of all the packets, merged across the peers if they all have it.
+     * 
+     */
+    std::shared_ptr<LatencyHistogram> delay_histogram;
+    /**
+     * @brief The packet delay variation (RFC 5481) percentiles in microseconds, the delay
+     *  above the min delay
+     * 
+     */
+    int pdv_p50_us;
+    int pdv_p99_us;
+    int pdv_p999_us;
+    /**
+     * @brief The inter-packet delay variation (RFC 5481) percentiles in microseconds, the delay
+     *  of a packet minus the one of the packet before it in sequence, p1 is the negative tail
+     * 
+     */
+    int ipdv_p1_us;
+    int ipdv_p50_us;
+    int ipdv_p99_us;
+    std::shared_ptr<LatencyHistogram> ipdv_histogram;
+
+    /**
+     * @brief The packets inter-arrival time percentiles in microseconds
+     * 
+     */
+    int arrival_p50_us;
+    int arrival_p99_us;
+    int arrival_p999_us;
+    std::shared_ptr<QuantileSketch> arrival_sketch;
+
     /**
      * @brief Packet loss percent
      * 
@@ -181,6 +236,14 @@ struct NetStat
     long long recv_speed;
     long long min_recv_speed;
     long long max_recv_speed;
+    /**
+     * @brief The percentiles of the recv speed of every second, p1 is the worst seconds
+     * 
+     */
+    long long recv_speed_p1;
+    long long recv_speed_p50;
+    long long recv_speed_p99;
+    std::shared_ptr<QuantileSketch> recv_speed_sketch;
 
     /**
      * @brief send/recv packets per second
@@ -189,6 +252,36 @@ struct NetStat
     long long send_pps;
     long long recv_pps;
 
+    /**
+     * @brief The average/max packets count sent by one syscall
+     * 
+     */
+    double send_batch;
+    int max_send_batch;
+
+    /**
+     * @brief The packets sent by MSG_ZEROCOPY, the ones copied by kernel anyway
+     *  and the average completion delay in microseconds
+     * 
+     */
+    long long zerocopy_packets;
+    long long zerocopy_copied;
+    int zerocopy_delay_us;
+
+    /**
+     * @brief The average/max error between the packets departure and their schedule
+     *  in microseconds, only for the paced sending
+     * 
+     */
+    double pacing_error_us;
+    int max_pacing_error_us;
+    /**
+     * @brief The peers count whose kernel pacing is measured as honoured by the tx timestamps,
+     *  only for 'pacing rate|txtime'
+     * 
+     */
+    int pacing_offload;
+
     /*******************************************************************/
     /********** The below properties are arithmetic property. **********/
     /**
@@ -229,6 +322,9 @@ struct NetStat
         W(max_recv_speed);
         W(min_send_speed);
         W(min_recv_speed);
+        W(recv_speed_p1);
+        W(recv_speed_p50);
+        W(recv_speed_p99);
         W(send_packets);
         W(recv_packets);
         W(illegal_packets);
@@ -237,6 +333,14 @@ struct NetStat
         W(timeout_packets);
         W(send_pps);
         W(recv_pps);
+        W(send_batch);
+        W(max_send_batch);
+        W(zerocopy_packets);
+        W(zerocopy_copied);
+        W(zerocopy_delay_us);
+        W(pacing_error_us);
+        W(max_pacing_error_us);
+        W(pacing_offload);
         W(send_bytes);
         W(recv_bytes);
         W(send_time);
@@ -250,6 +354,22 @@ struct NetStat
         W(max_delay);
         W(jitter);
         W(jitter_std);
+        W(jitter_rfc3550_us);
+        W(max_jitter_rfc3550_us);
+        W(delay_p50_us);
+        W(delay_p90_us);
+        W(delay_p99_us);
+        W(delay_p999_us);
+        W(delay_p9999_us);
+        W(pdv_p50_us);
+        W(pdv_p99_us);
+        W(pdv_p999_us);
+        W(ipdv_p1_us);
+        W(ipdv_p50_us);
+        W(ipdv_p99_us);
+        W(arrival_p50_us);
+        W(arrival_p99_us);
+        W(arrival_p999_us);
         W(peers_count);
         W(peers_failed);
 #undef W
@@ -271,6 +391,9 @@ struct NetStat
         RLL(max_recv_speed);
         RLL(min_send_speed);
         RLL(min_recv_speed);
+        RLL(recv_speed_p1);
+        RLL(recv_speed_p50);
+        RLL(recv_speed_p99);
         RLL(send_packets);
         RLL(recv_packets);
         RLL(illegal_packets);
@@ -279,6 +402,14 @@ struct NetStat
         RLL(timeout_packets);
         RLL(send_pps);
         RLL(recv_pps);
+        RF(send_batch);
+        RI(max_send_batch);
+        RLL(zerocopy_packets);
+        RLL(zerocopy_copied);
+        RI(zerocopy_delay_us);
+        RF(pacing_error_us);
+        RI(max_pacing_error_us);
+        RI(pacing_offload);
         RLL(send_bytes);
         RLL(recv_bytes);
         RI(send_time);
@@ -292,6 +423,22 @@ struct NetStat
         RI(max_delay);
         RI(jitter);
         RLL(jitter_std);
+        RI(jitter_rfc3550_us);
+        RI(max_jitter_rfc3550_us);
+        RI(delay_p50_us);
+        RI(delay_p90_us);
+        RI(delay_p99_us);
+        RI(delay_p999_us);
+        RI(delay_p9999_us);
+        RI(pdv_p50_us);
+        RI(pdv_p99_us);
+        RI(pdv_p999_us);
+        RI(ipdv_p1_us);
+        RI(ipdv_p50_us);
+        RI(ipdv_p99_us);
+        RI(arrival_p50_us);
+        RI(arrival_p99_us);
+        RI(arrival_p999_us);
         RI(peers_count);
         RI(peers_failed);
 #undef RI
@@ -299,6 +446,392 @@ struct NetStat
 #undef RF
     }
 
+    /**
+     * @brief Write the fields as 8 bytes little endian values for the binary control protocol.
+     *  The new fields are appended at the end, so an older peer just ignores them.
+     * 
+     * @param out 
+     */
+    void Serialize(std::string &out) const
+    {
+#define W(p) PutField(out, p)
+        W(loss);
+        W(send_speed);
+        W(recv_speed);
+        W(send_avg_speed);
+        W(recv_avg_speed);
+        W(max_send_speed);
+        W(max_recv_speed);
+        W(min_send_speed);
+        W(min_recv_speed);
+        W(send_packets);
+        W(recv_packets);
+        W(illegal_packets);
+        W(reorder_packets);
+        W(duplicate_packets);
+        W(timeout_packets);
+        W(send_pps);
+        W(recv_pps);
+        W(send_batch);
+        W(max_send_batch);
+        W(zerocopy_packets);
+        W(zerocopy_copied);
+        W(zerocopy_delay_us);
+        W(pacing_error_us);
+        W(max_pacing_error_us);
+        W(pacing_offload);
+        W(send_bytes);
+        W(recv_bytes);
+        W(send_time);
+        W(recv_time);
+        W(max_send_time);
+        W(max_recv_time);
+        W(min_send_time);
+        W(min_recv_time);
+        W(delay);
+        W(min_delay);
+        W(max_delay);
+        W(jitter);
+        W(jitter_std);
+        W(peers_count);
+        W(peers_failed);
+        W(delay_p50_us);
+        W(delay_p90_us);
+        W(delay_p99_us);
+        W(delay_p999_us);
+        W(delay_p9999_us);
+        // the non-empty buckets of the delay histogram follow the fields.
+        PutHistogram(out, delay_histogram);
+        W(arrival_p50_us);
+        W(arrival_p99_us);
+        W(arrival_p999_us);
+        W(recv_speed_p1);
+        W(recv_speed_p50);
+        W(recv_speed_p99);
+        PutSketch(out, arrival_sketch);
+        PutSketch(out, recv_speed_sketch);
+        W(jitter_rfc3550_us);
+        W(max_jitter_rfc3550_us);
+        W(pdv_p50_us);
+        W(pdv_p99_us);
+        W(pdv_p999_us);
+        W(ipdv_p1_us);
+        W(ipdv_p50_us);
+        W(ipdv_p99_us);
+        PutHistogram(out, ipdv_histogram);
+#undef W
+    }
+
+    /**
+     * @brief Read the fields written by Serialize, the fields missing from data are 0.
+     * 
+     * @param data 
+     * @param size 
+     */
+    void Deserialize(const char *data, size_t size)
+    {
+        const char *end = data + size;
+#define R(p) GetField(data, end, p)
+        R(loss);
+        R(send_speed);
+        R(recv_speed);
+        R(send_avg_speed);
+        R(recv_avg_speed);
+        R(max_send_speed);
+        R(max_recv_speed);
+        R(min_send_speed);
+        R(min_recv_speed);
+        R(send_packets);
+        R(recv_packets);
+        R(illegal_packets);
+        R(reorder_packets);
+        R(duplicate_packets);
+        R(timeout_packets);
+        R(send_pps);
+        R(recv_pps);
+        R(send_batch);
+        R(max_send_batch);
+        R(zerocopy_packets);
+        R(zerocopy_copied);
+        R(zerocopy_delay_us);
+        R(pacing_error_us);
+        R(max_pacing_error_us);
+        R(pacing_offload);
+        R(send_bytes);
+        R(recv_bytes);
+        R(send_time);
+        R(recv_time);
+        R(max_send_time);
+        R(max_recv_time);
+        R(min_send_time);
+        R(min_recv_time);
+        R(delay);
+        R(min_delay);
+        R(max_delay);
+        R(jitter);
+        R(jitter_std);
+        R(peers_count);
+        R(peers_failed);
+        R(delay_p50_us);
+        R(delay_p90_us);
+        R(delay_p99_us);
+        R(delay_p999_us);
+        R(delay_p9999_us);
+        delay_histogram = GetHistogram(data, end);
+        R(arrival_p50_us);
+        R(arrival_p99_us);
+        R(arrival_p999_us);
+        R(recv_speed_p1);
+        R(recv_speed_p50);
+        R(recv_speed_p99);
+        arrival_sketch = GetSketch(data, end);
+        recv_speed_sketch = GetSketch(data, end);
+        R(jitter_rfc3550_us);
+        R(max_jitter_rfc3550_us);
+        R(pdv_p50_us);
+        R(pdv_p99_us);
+        R(pdv_p999_us);
+        R(ipdv_p1_us);
+        R(ipdv_p50_us);
+        R(ipdv_p99_us);
+        ipdv_histogram = GetHistogram(data, end);
+#undef R
+    }
+
+    /**
+     * @brief Write the fields of an interim report only, it is sent every report interval.
+     * 
+     * @param out 
+     */
+    void SerializeReport(std::string &out) const
+    {
+#define W(p) PutField(out, p)
+        W(loss);
+        W(recv_speed);
+        W(recv_pps);
+        W(recv_packets);
+        W(reorder_packets);
+        W(duplicate_packets);
+        W(recv_bytes);
+        W(recv_time);
+        W(delay);
+        W(max_delay);
+#undef W
+    }
+
+    void DeserializeReport(const char *data, size_t size)
+    {
+        const char *end = data + size;
+#define R(p) GetField(data, end, p)
+        R(loss);
+        R(recv_speed);
+        R(recv_pps);
+        R(recv_packets);
+        R(reorder_packets);
+        R(duplicate_packets);
+        R(recv_bytes);
+        R(recv_time);
+        R(delay);
+        R(max_delay);
+#undef R
+    }
+
+    /**
+     * @brief Keep the delay histogram and take the percentiles from it.
+     * 
+     * @param histogram in nanoseconds.
+     */
+    void SetDelayHistogram(std::shared_ptr<LatencyHistogram> histogram)
+    {
+        delay_histogram = histogram;
+        if (!histogram || histogram->GetCount() == 0)
+            return;
+        delay_p50_us = histogram->GetPercentile(50) / 1000;
+        delay_p90_us = histogram->GetPercentile(90) / 1000;
+        delay_p99_us = histogram->GetPercentile(99) / 1000;
+        delay_p999_us = histogram->GetPercentile(99.9) / 1000;
+        delay_p9999_us = histogram->GetPercentile(99.99) / 1000;
+        pdv_p50_us = (histogram->GetPercentile(50) - histogram->GetMin()) / 1000;
+        pdv_p99_us = (histogram->GetPercentile(99) - histogram->GetMin()) / 1000;
+        pdv_p999_us = (histogram->GetPercentile(99.9) - histogram->GetMin()) / 1000;
+    }
+
+    /**
+     * @brief Keep the IPDV histogram and take the percentiles from it.
+     * 
+     * @param histogram in nanoseconds.
+     */
+    void SetIpdvHistogram(std::shared_ptr<LatencyHistogram> histogram)
+    {
+        ipdv_histogram = histogram;
+        if (!histogram || histogram->GetCount() == 0)
+            return;
+        ipdv_p1_us = histogram->GetPercentile(1) / 1000;
+        ipdv_p50_us = histogram->GetPercentile(50) / 1000;
+        ipdv_p99_us = histogram->GetPercentile(99) / 1000;
+    }
+
+    /**
+     * @brief Keep the inter-arrival time sketch and take the percentiles from it.
+     * 
+     * @param sketch in nanoseconds.
+     */
+    void SetArrivalSketch(std::shared_ptr<QuantileSketch> sketch)
+    {
+        arrival_sketch = sketch;
+        if (!sketch || sketch->GetCount() == 0)
+            return;
+        arrival_p50_us = sketch->GetPercentile(50) / 1000;
+        arrival_p99_us = sketch->GetPercentile(99) / 1000;
+        arrival_p999_us = sketch->GetPercentile(99.9) / 1000;
+    }
+
+    /**
+     * @brief Keep the recv speed sketch and take the percentiles from it.
+     * 
+     * @param sketch in Byte/s.
+     */
+    void SetRecvSpeedSketch(std::shared_ptr<QuantileSketch> sketch)
+    {
+        recv_speed_sketch = sketch;
+        if (!sketch || sketch->GetCount() == 0)
+            return;
+        recv_speed_p1 = sketch->GetPercentile(1);
+        recv_speed_p50 = sketch->GetPercentile(50);
+        recv_speed_p99 = sketch->GetPercentile(99);
+    }
+
+    // the negative buckets are written as -(index + 1).
+    static void PutHistogram(std::string &out, const std::shared_ptr<LatencyHistogram> &histogram)
+    {
+        auto non_empty = [](uint64_t count) { return count > 0; };
+        long long buckets = 0;
+        if (histogram)
+            buckets = std::count_if(histogram->GetCounts().begin(), histogram->GetCounts().end(), non_empty) +
+                      std::count_if(histogram->GetNegativeCounts().begin(), histogram->GetNegativeCounts().end(), non_empty);
+        PutField(out, buckets);
+        if (buckets == 0)
+            return;
+        PutField(out, (long long)histogram->GetMin());
+        PutField(out, (long long)histogram->GetMax());
+        auto &negative_counts = histogram->GetNegativeCounts();
+        for (size_t i = 0; i < negative_counts.size(); i++)
+        {
+            if (negative_counts[i] == 0)
+                continue;
+            PutField(out, -(long long)i - 1);
+            PutField(out, (long long)negative_counts[i]);
+        }
+        auto &counts = histogram->GetCounts();
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (counts[i] == 0)
+                continue;
+            PutField(out, (long long)i);
+            PutField(out, (long long)counts[i]);
+        }
+    }
+    static std::shared_ptr<LatencyHistogram> GetHistogram(const char *&data, const char *end)
+    {
+        long long buckets, min, max, index, count;
+        GetField(data, end, buckets);
+        if (buckets <= 0 || buckets > 2 * HISTOGRAM_BUCKETS)
+            return NULL;
+        GetField(data, end, min);
+        GetField(data, end, max);
+        auto histogram = std::make_shared<LatencyHistogram>();
+        for (long long i = 0; i < buckets && data < end; i++)
+        {
+            GetField(data, end, index);
+            GetField(data, end, count);
+            if (index < 0)
+                histogram->AddCount(-index - 1, count, true);
+            else
+                histogram->AddCount(index, count);
+        }
+        histogram->SetRange(min, max);
+        return histogram;
+    }
+    // the zero count goes first, it is followed by the non-empty buckets like the histogram.
+    static void PutSketch(std::string &out, const std::shared_ptr<QuantileSketch> &sketch)
+    {
+        long long buckets = 0;
+        // an empty sketch is kept, so it still merges with the other peers'.
+        if (sketch)
+            buckets = std::count_if(sketch->GetCounts().begin(), sketch->GetCounts().end(), [](uint64_t count) { return count > 0; }) + 1;
+        PutField(out, buckets);
+        if (buckets == 0)
+            return;
+        PutField(out, sketch->GetMin());
+        PutField(out, sketch->GetMax());
+        PutField(out, (long long)sketch->GetZeroCount());
+        auto &counts = sketch->GetCounts();
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (counts[i] == 0)
+                continue;
+            PutField(out, (long long)(sketch->GetOffset() + i));
+            PutField(out, (long long)counts[i]);
+        }
+    }
+    static std::shared_ptr<QuantileSketch> GetSketch(const char *&data, const char *end)
+    {
+        long long buckets, index, count;
+        double min, max;
+        GetField(data, end, buckets);
+        if (buckets <= 0 || buckets > SKETCH_MAX_BUCKETS + 1)
+            return NULL;
+        GetField(data, end, min);
+        GetField(data, end, max);
+        GetField(data, end, count);
+        auto sketch = std::make_shared<QuantileSketch>();
+        sketch->AddCount(0, count, true);
+        for (long long i = 1; i < buckets && data < end; i++)
+        {
+            GetField(data, end, index);
+            GetField(data, end, count);
+            sketch->AddCount(index, count);
+        }
+        sketch->SetRange(min, max);
+        return sketch;
+    }
+
+    static void PutField(std::string &out, long long value)
+    {
+        for (int i = 0; i < 8; i++)
+            out.push_back((char)((unsigned long long)value >> (i * 8)));
+    }
+    static void PutField(std::string &out, int value) { PutField(out, (long long)value); }
+    static void PutField(std::string &out, double value)
+    {
+        long long bits;
+        memcpy(&bits, &value, sizeof(bits));
+        PutField(out, bits);
+    }
+    static void GetField(const char *&data, const char *end, long long &value)
+    {
+        value = 0;
+        if (end - data < 8)
+            return;
+        unsigned long long bits = 0;
+        for (int i = 0; i < 8; i++)
+            bits |= (unsigned long long)(unsigned char)data[i] << (i * 8);
+        value = (long long)bits;
+        data += 8;
+    }
+    static void GetField(const char *&data, const char *end, int &value)
+    {
+        long long bits;
+        GetField(data, end, bits);
+        value = (int)bits;
+    }
+    static void GetField(const char *&data, const char *end, double &value)
+    {
+        long long bits;
+        GetField(data, end, bits);
+        memcpy(&value, &bits, sizeof(value));
+    }
+
     // TODO: refactor the code to simplify the logic of 'arithmetic property'.
     NetStat &operator+=(const NetStat &stat)
     {
@@ -315,6 +848,9 @@ struct NetStat
         MAX(max_recv_speed);
         MIN(min_send_speed);
         MIN(min_recv_speed);
+        MIN(recv_speed_p1);
+        MIN(recv_speed_p50);
+        MIN(recv_speed_p99);
         INT(send_packets);
         INT(recv_packets);
         INT(illegal_packets);
@@ -323,6 +859,14 @@ struct NetStat
         INT(timeout_packets);
         INT(send_pps);
         INT(recv_pps);
+        DOU(send_batch);
+        MAX(max_send_batch);
+        INT(zerocopy_packets);
+        INT(zerocopy_copied);
+        INT(zerocopy_delay_us);
+        DOU(pacing_error_us);
+        MAX(max_pacing_error_us);
+        INT(pacing_offload);
         INT(send_bytes);
         INT(recv_bytes);
         INT(delay);
@@ -330,6 +874,22 @@ struct NetStat
         MAX(max_delay);
         INT(jitter);
         INT(jitter_std);
+        INT(jitter_rfc3550_us);
+        MAX(max_jitter_rfc3550_us);
+        MAX(delay_p50_us);
+        MAX(delay_p90_us);
+        MAX(delay_p99_us);
+        MAX(delay_p999_us);
+        MAX(delay_p9999_us);
+        MAX(pdv_p50_us);
+        MAX(pdv_p99_us);
+        MAX(pdv_p999_us);
+        MIN(ipdv_p1_us);
+        MAX(ipdv_p50_us);
+        MAX(ipdv_p99_us);
+        MAX(arrival_p50_us);
+        MAX(arrival_p99_us);
+        MAX(arrival_p999_us);
         INT(send_time);
         INT(recv_time);
         MAX(max_send_time);
@@ -342,6 +902,39 @@ struct NetStat
 #undef DOU
 #undef MAX
 #undef MIN
+        // the percentiles of the merged histogram are exact, the max ones are the worst peer's.
+        if (delay_histogram && stat.delay_histogram)
+        {
+            auto histogram = std::make_shared<LatencyHistogram>(*delay_histogram);
+            histogram->Merge(*stat.delay_histogram);
+            SetDelayHistogram(histogram);
+        }
+        else
+            delay_histogram = NULL;
+        if (ipdv_histogram && stat.ipdv_histogram)
+        {
+            auto histogram = std::make_shared<LatencyHistogram>(*ipdv_histogram);
+            histogram->Merge(*stat.ipdv_histogram);
+            SetIpdvHistogram(histogram);
+        }
+        else
+            ipdv_histogram = NULL;
+        if (arrival_sketch && stat.arrival_sketch)
+        {
+            auto sketch = std::make_shared<QuantileSketch>(*arrival_sketch);
+            sketch->Merge(*stat.arrival_sketch);
+            SetArrivalSketch(sketch);
+        }
+        else
+            arrival_sketch = NULL;
+        if (recv_speed_sketch && stat.recv_speed_sketch)
+        {
+            auto sketch = std::make_shared<QuantileSketch>(*recv_speed_sketch);
+            sketch->Merge(*stat.recv_speed_sketch);
+            SetRecvSpeedSketch(sketch);
+        }
+        else
+            recv_speed_sketch = NULL;
         return *this;
     }
     NetStat &operator/=(int num)
@@ -359,6 +952,9 @@ struct NetStat
         MAX(max_recv_speed);
         MIN(min_send_speed);
         MIN(min_recv_speed);
+        MIN(recv_speed_p1);
+        MIN(recv_speed_p50);
+        MIN(recv_speed_p99);
         INT(send_packets);
         INT(recv_packets);
         INT(illegal_packets);
@@ -367,6 +963,14 @@ struct NetStat
         INT(timeout_packets);
         INT(send_pps);
         INT(recv_pps);
+        DOU(send_batch);
+        MAX(max_send_batch);
+        INT(zerocopy_packets);
+        INT(zerocopy_copied);
+        INT(zerocopy_delay_us);
+        DOU(pacing_error_us);
+        MAX(max_pacing_error_us);
+        INT(pacing_offload);
         INT(send_bytes);
         INT(recv_bytes);
         INT(delay);
@@ -374,6 +978,22 @@ struct NetStat
         MAX(max_delay);
         INT(jitter);
         INT(jitter_std);
+        INT(jitter_rfc3550_us);
+        MAX(max_jitter_rfc3550_us);
+        MAX(delay_p50_us);
+        MAX(delay_p90_us);
+        MAX(delay_p99_us);
+        MAX(delay_p999_us);
+        MAX(delay_p9999_us);
+        MAX(pdv_p50_us);
+        MAX(pdv_p99_us);
+        MAX(pdv_p999_us);
+        MIN(ipdv_p1_us);
+        MAX(ipdv_p50_us);
+        MAX(ipdv_p99_us);
+        MAX(arrival_p50_us);
+        MAX(arrival_p99_us);
+        MAX(arrival_p999_us);
         INT(send_time);
         INT(recv_time);
         MAX(max_send_time);
@@ -398,6 +1018,7 @@ struct CommandChannel
     std::shared_ptr<Context> context_;
     std::shared_ptr<Sock> control_sock_;
     std::shared_ptr<Sock> data_sock_;
+    std::shared_ptr<ControlChannel> control_;
 };
 
 /**
@@ -463,16 +1084,45 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Command);
 };
 
+// the version of DataHead with the 32 bits sequence, the older senders filled its byte with the token.
+#define DATA_HEAD_VERSION 1
+
+/**
+ * @brief The head of every payload packet. The fields of the first version keep their
+ *  offsets, the high bits of the sequence live in its padding.
+ * 
+ */
 struct DataHead
 {
     // time since epoch in nanoseconds
     int64_t timestamp : 64;
-    // sequence number
+    // the low 16 bits of the sequence number
     uint16_t sequence : 16;
     // data length
     uint16_t length : 16;
     // token used for data validation
     char token;
+    // DATA_HEAD_VERSION, or the token if the sender is older
+    uint8_t version;
+    // the high 16 bits of the sequence number
+    uint16_t sequence_high;
+
+    void SetSequence(uint32_t seq)
+    {
+        sequence = seq & 0xffff;
+        sequence_high = seq >> 16;
+        version = DATA_HEAD_VERSION;
+    }
+    /**
+     * @brief Get the sequence number, only the low 16 bits are valid if the sender is older.
+     * 
+     * @return uint32_t 
+     */
+    uint32_t GetSequence() const
+    {
+        return version == DATA_HEAD_VERSION ? sequence | (uint32_t)sequence_high << 16 : sequence;
+    }
+    bool IsVersioned() const { return version == DATA_HEAD_VERSION; }
 };
 
 #define ECHO_DEFAULT_COUNT 5
@@ -568,6 +1218,28 @@ private:
 #define SEND_DEFAULT_TIMEOUT 100 // milliseconds
 #define SEND_DEFAULT_SPEED 0 // KByte/s
 #define SEND_DEFAULT_TIME 3000 // milliseconds
+#define SEND_DEFAULT_BATCH 1
+#define SEND_MAX_BATCH 1024
+#define SEND_DEFAULT_BUDGET 64
+#define SEND_MAX_BUDGET 4096
+#define SEND_DEFAULT_GSO 0
+// UDP_MAX_SEGMENTS in linux
+#define SEND_MAX_GSO 64
+#define SEND_DEFAULT_REPORT 0 // milliseconds
+/**
+ * @brief Who paces the packets of send command.
+ * 
+ */
+enum class PacingMode
+{
+    // the timers of the event loop
+    User,
+    // the kernel by SO_MAX_PACING_RATE
+    Rate,
+    // the kernel by the launch time of every packet (SO_TXTIME)
+    TxTime
+};
+
 /**
  * @brief a main command, server send data only and client recv only.
  * 
@@ -581,6 +1253,13 @@ public:
           size_(SEND_DEFAULT_SIZE),
           wait_(SEND_DEFAULT_WAIT),
           timeout_(SEND_DEFAULT_TIMEOUT),
+          batch_(SEND_DEFAULT_BATCH),
+          gso_(SEND_DEFAULT_GSO),
+          budget_(SEND_DEFAULT_BUDGET),
+          interval_ns_(SEND_DEFAULT_INTERVAL * 1000LL),
+          is_zerocopy_(false),
+          pacing_(PacingMode::User),
+          report_(SEND_DEFAULT_REPORT),
           is_finished(false), Command("send", cmd)
     {
         UpdateToken();
@@ -592,21 +1271,36 @@ public:
         count_ = args["count"].empty() ? SEND_DEFAULT_COUNT : std::stoi(args["count"]);
         interval_ = args["interval"].empty() ? SEND_DEFAULT_INTERVAL : std::stod(args["interval"]) * 1000;
         size_ = args["size"].empty() ? SEND_DEFAULT_SIZE : std::stoi(args["size"]);
+        // every packet carries a DataHead, and the size divides below.
+        ASSERT_RETURN(size_ >= (int)sizeof(DataHead), false, "send size should be at least %d.", (int)sizeof(DataHead));
         wait_ = args["wait"].empty() ? SEND_DEFAULT_WAIT : std::stoi(args["wait"]) * 1000;
         timeout_ = args["timeout"].empty() ? SEND_DEFAULT_TIMEOUT : std::stoi(args["timeout"]);
+        batch_ = args["batch"].empty() ? SEND_DEFAULT_BATCH : std::stoi(args["batch"]);
+        batch_ = std::min(std::max(batch_, 1), SEND_MAX_BATCH);
+        gso_ = args["gso"].empty() ? SEND_DEFAULT_GSO : std::stoi(args["gso"]);
+        // all the segments should fit in one udp datagram.
+        gso_ = std::min(std::max(gso_, 0), std::min(SEND_MAX_GSO, MAX_UDP_PAYLOAD / size_));
+        if (gso_ == 1)
+            gso_ = 0;
+        budget_ = args["budget"].empty() ? SEND_DEFAULT_BUDGET : std::stoi(args["budget"]);
+        budget_ = std::min(std::max(budget_, 1), SEND_MAX_BUDGET);
+        is_zerocopy_ = !args["zerocopy"].empty() && args["zerocopy"] != "false";
+        pacing_ = args["pacing"] == "rate" ? PacingMode::Rate : args["pacing"] == "txtime" ? PacingMode::TxTime : PacingMode::User;
+        report_ = args["report"].empty() ? SEND_DEFAULT_REPORT : std::max(std::stoi(args["report"]), 0);
         if (!args["token"].empty())
             token = args["token"].at(0);
         is_multicast = !args["multicast"].empty();
         if (is_multicast)
             LOGDP("enable multicast.");
-        ASSERT(size_>=sizeof(DataHead));
         
         auto speed = args["speed"].empty() ? SEND_DEFAULT_SPEED : std::stoi(args["speed"]);
         auto time = args["time"].empty() ? SEND_DEFAULT_TIME : std::stoi(args["time"]);
+        interval_ns_ = args["interval"].empty() ? SEND_DEFAULT_INTERVAL * 1000LL : std::stod(args["interval"]) * 1000 * 1000;
         if (speed > 0 && time > 0)
         {
             count_ = ceil((speed * 1024) * (time / 1000.0) / size_);
-            interval_ = 1000000/((1.0*speed*1024)/size_);
+            interval_ns_ = 1000000000 / ((1.0 * speed * 1024) / size_);
+            interval_ = interval_ns_ / 1000;
         }
         else if(interval_ > 0 && time > 0)
         {
@@ -627,7 +1321,7 @@ public:
     std::string ToString() const override
     {
         std::stringstream out;
-        out << name << " count " << count_ << " interval " << interval_/1000.0 << " size " << size_ << " wait " << wait_/1000.0 << " timeout " << timeout_;
+        out << name << " count " << count_ << " interval " << interval_/1000.0 << " size " << size_ << " wait " << wait_/1000.0 << " timeout " << timeout_ << " batch " << batch_ << " gso " << gso_ << " report " << report_;
         return out.str();
     }
 
@@ -638,6 +1332,12 @@ public:
      * @return int 
      */
     int GetInterval() { return interval_; }
+    /**
+     * @brief Get the Interval object in nanoseconds, which is more precise for the high speed
+     * 
+     * @return int64_t 
+     */
+    int64_t GetIntervalNs() { return interval_ns_; }
     int GetSize() { return size_; }
     /**
      * @brief Get the Wait object in microseconds
@@ -651,8 +1351,39 @@ public:
      * @return int 
      */
     int GetTimeout() { return timeout_; }
+    /**
+     * @brief Get the max packets count sent by one syscall
+     * 
+     * @return int 
+     */
+    int GetBatch() { return batch_; }
+    /**
+     * @brief Get the segments count sent by one UDP GSO syscall, 0 if GSO is disabled
+     * 
+     * @return int 
+     */
+    int GetGso() { return gso_; }
+    /**
+     * @brief Get the max packets count sent by one writable event of a peer
+     * 
+     * @return int 
+     */
+    int GetBudget() { return budget_; }
+    /**
+     * @brief Whether to send the payload by MSG_ZEROCOPY
+     * 
+     * @return bool 
+     */
+    bool IsZeroCopy() { return is_zerocopy_; }
+    PacingMode GetPacing() { return pacing_; }
+    /**
+     * @brief Get the interval of the interim reports in milliseconds, 0 if there is no report
+     * 
+     * @return int 
+     */
+    int GetReport() { return report_; }
 
-    bool is_finished;
+    std::atomic<bool> is_finished;
 
 private:
     int count_;
@@ -660,6 +1391,13 @@ private:
     int size_;
     int wait_;
     int timeout_;
+    int batch_;
+    int gso_;
+    int budget_;
+    int64_t interval_ns_;
+    bool is_zerocopy_;
+    PacingMode pacing_;
+    int report_;
 
     DISALLOW_COPY_AND_ASSIGN(SendCommand);
 };
@@ -712,7 +1450,7 @@ public:
         netstat->FromCommandArgs(args);
         return true;
     }
-    std::string Serialize(const NetStat &netstat)
+    std::string Serialize(const NetStat &netstat) const
     {
         return name + " " + netstat.ToString();
     }
@@ -722,6 +1460,34 @@ public:
     DISALLOW_COPY_AND_ASSIGN(ResultCommand);
 };
 
+/**
+ * @brief send the interim result of a report interval to server while the command is running.
+ * 
+ */
+class ReportCommand : public Command
+{
+public:
+    ReportCommand() : ReportCommand("report") {}
+    ReportCommand(std::string cmd) : index(0), Command("report", cmd) {}
+    bool ResolveArgs(CommandArgs args) override
+    {
+        index = atoi(args["index"].c_str());
+        netstat = std::make_shared<NetStat>();
+        netstat->FromCommandArgs(args);
+        return true;
+    }
+    std::string Serialize(const NetStat &netstat) const
+    {
+        return name + " index " + std::to_string(index) + " " + netstat.ToString();
+    }
+
+    // the report interval since the command starts, from 0.
+    int index;
+    std::shared_ptr<NetStat> netstat;
+
+    DISALLOW_COPY_AND_ASSIGN(ReportCommand);
+};
+
 class ModeCommand : public Command
 {
 public:
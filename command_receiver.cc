@@ -4,10 +4,11 @@
 
 #include "command.h"
 #include "command_receiver.h"
+#include "control_channel.h"
 
 CommandReceiver::CommandReceiver(std::shared_ptr<CommandChannel> channel)
     : context_(channel->context_), control_sock_(channel->control_sock_),
-      data_sock_(channel->data_sock_)
+      control_(channel->control_), data_sock_(channel->data_sock_)
 {
 }
 
@@ -17,8 +18,9 @@ int CommandReceiver::RecvPrivateCommand(std::shared_ptr<Command> command)
 }
 
 EchoCommandReceiver::EchoCommandReceiver(std::shared_ptr<CommandChannel> channel)
-    : send_count_(0), recv_count_(0), running_(false), is_stopping_(false),
+    : send_count_(0), recv_count_(0), running_(false), is_stopping_(false), is_gro_(false),
       command_(std::dynamic_pointer_cast<EchoCommand>(channel->command_)), CommandReceiver(channel),
+      ring_(ECHO_RING_SIZE, Packet(std::max<size_t>(command_->GetSize(), sizeof(DataHead)))), pending_(0),
       illegal_packets_(0), token_(command_->token)
 {
 }
@@ -28,6 +30,10 @@ int EchoCommandReceiver::Start()
     LOGDP("EchoCommandReceiver start command.");
     ASSERT_RETURN(!running_, -1, "EchoCommandReceiver start unexpeted.");
     running_ = true;
+    // the datagrams are reflected as they are, so they should not be coalesced.
+    is_gro_ = data_sock_->IsGro();
+    if (is_gro_ && data_sock_->SetGro(false) < 0)
+        return -1;
     //context_->SetReadFd(data_sock_->GetFd());
     return 0;
 }
@@ -45,66 +51,104 @@ int EchoCommandReceiver::Send()
 {
     LOGVP("EchoCommandReceiver send payload.");
     ASSERT_RETURN(running_, -1, "EchoCommandReceiver send unexpeted.");
-    int result = 0;
-    context_->ClrWriteFd(data_sock_->GetFd());
-    ASSERT(data_queue_.size() > 0);
-    while (data_queue_.size() > 0)
+    return Reflect(0);
+}
+int EchoCommandReceiver::Recv()
+{
+    LOGVP("EchoCommandReceiver recv payload.");
+    ASSERT_RETURN(running_, -1, "EchoCommandReceiver recv unexpeted.");
+    int free = ECHO_RING_SIZE - pending_;
+    ASSERT_RETURN(free > 0, 0);
+    int result = data_sock_->RecvBatch(ring_, free);
+    // nothing to read on the non-blocking socket.
+    if (result == ERR_TIMEOUT)
+        return 0;
+    if (result < 0)
+        return result;
+    // move the legal packets to the beginning, the slots are swapped without copy.
+    int fresh = 0;
+    for (int i = 0; i < result; i++)
     {
-        auto buf = data_queue_.front();
-        // use sync method to send extra data.
-        if ((result = data_sock_->Send(&buf[0], buf.length())) < 0)
+        auto &packet = ring_[i];
+        auto head = reinterpret_cast<DataHead*>(&packet.buf[0]);
+        if (packet.length < (ssize_t)sizeof(DataHead) || packet.length > (ssize_t)packet.buf.length() ||
+            token_ != head->token || packet.length != head->length)
         {
-            return -1;
+            illegal_packets_++;
+            LOGWP("recv illegal data(%d): length=%ld, %s", data_sock_->GetFd(), (long)packet.length,
+                  Tools::GetDataSum(packet.buf.data(), std::max<ssize_t>(std::min<ssize_t>(packet.length, packet.buf.length()), 0)).c_str());
+            continue;
         }
-        send_count_++;
-        data_queue_.pop();
+        LOGVP("recv payload data: recv_count %ld seq %u timestamp %ld token %c",recv_count_+1,head->GetSequence(),head->timestamp,head->token);
+        recv_count_++;
+        if (i != fresh)
+            std::swap(ring_[i], ring_[fresh]);
+        fresh++;
     }
-
+    if (fresh > 0 && Reflect(fresh) < 0)
+        return -1;
     return result;
 }
-int EchoCommandReceiver::Recv()
+
+int EchoCommandReceiver::Reflect(int fresh)
 {
-    LOGVP("EchoCommandReceiver recv payload.");
-    ASSERT_RETURN(running_, -1, "EchoCommandReceiver recv unexpeted.");
-    std::string buf(MAX_UDP_LENGTH, 0);
-    int result = data_sock_->Recv(&buf[0], buf.length());
-    buf.resize(std::max(result,0));
-    if (result < sizeof(DataHead))
+    int total = 0;
+    int result;
+    bool is_full = pending_ == ECHO_RING_SIZE;
+    if (pending_ > 0)
     {
-        illegal_packets_++;
-        LOGWP("recv illegal data(%d): length=%d, %s",data_sock_->GetFd(),result,Tools::GetDataSum(buf).c_str());
-        return result;
+        result = data_sock_->SendPackets(ring_, ECHO_RING_SIZE - pending_, pending_);
+        if (result < 0 && result != ERR_WOULD_BLOCK)
+            return -1;
+        // the unsent ones are still at the end, the fresh ones go after them.
+        pending_ -= std::max(result, 0);
+        total += std::max(result, 0);
     }
-    
-    auto head = reinterpret_cast<DataHead*>(&buf[0]);
-    if (token_ != head->token||result!=head->length)
+    if (fresh > 0)
     {
-        illegal_packets_++;
-        LOGWP("recv illegal data(%d): length=%d, seq=%d, token=%c, expect %c",data_sock_->GetFd(),result,head->sequence, head->token, token_);
-        return result;
+        result = 0;
+        if (pending_ == 0 && (result = data_sock_->SendPackets(ring_, 0, fresh)) < 0 && result != ERR_WOULD_BLOCK)
+            return -1;
+        result = std::max(result, 0);
+        total += result;
+        std::rotate(ring_.begin() + result, ring_.begin() + fresh, ring_.end());
+        pending_ += fresh - result;
     }
-
-    data_queue_.push(buf);
-    context_->SetWriteFd(data_sock_->GetFd());
-    // context_->ClrReadFd(data_sock_->GetFd());
-    recv_count_++;
-
-    LOGDP("recv payload data: recv_count %ld seq %d timestamp %ld token %c",recv_count_,head->sequence,head->timestamp,head->token);
-    return result;
+    send_count_ += total;
+    if (pending_ > 0)
+    {
+        LOGDP("echo queued(%d): %d packets", data_sock_->GetFd(), pending_);
+        context_->SetWriteFd(data_sock_->GetFd());
+        // stop reading until some slots are free.
+        if (pending_ == ECHO_RING_SIZE)
+            context_->ClrReadFd(data_sock_->GetFd());
+    }
+    else
+    {
+        context_->ClrWriteFd(data_sock_->GetFd());
+    }
+    if (is_full && pending_ < ECHO_RING_SIZE)
+        context_->SetReadFd(data_sock_->GetFd());
+    return total;
 }
 
 int EchoCommandReceiver::SendPrivateCommand()
 {
     LOGDP("EchoCommandReceiver send stop");
     int result;
-    if (data_queue_.size() > 0)
+    if (pending_ > 0)
     {
-        LOGWP("final send %ld data.", data_queue_.size());
-        //TODO: optimize the logic
-        Send();
+        LOGWP("final send %d data.", pending_);
+        Reflect(0);
+        // the packets which can not be sent now are lost.
+        if (pending_ > 0)
+            LOGWP("drop %d data.", pending_);
     }
     context_->ClrWriteFd(control_sock_->GetFd());
     context_->ClrWriteFd(data_sock_->GetFd());
+    context_->SetReadFd(data_sock_->GetFd());
+    if (is_gro_)
+        data_sock_->SetGro(true);
     running_ = false;
 
     auto command = std::make_shared<ResultCommand>();
@@ -112,11 +156,11 @@ int EchoCommandReceiver::SendPrivateCommand()
     stat->recv_packets = recv_count_;
     stat->send_packets = send_count_;
     stat->illegal_packets = illegal_packets_ + out_of_command_packets_;
-    auto cmd = command->Serialize(*stat);
-    LOGDP("command finish: %s || %s", command_->GetCmd().c_str(),cmd.c_str());
+    command->netstat = stat;
+    LOGDP("command finish: %s || %s", command_->GetCmd().c_str(),stat->ToString().c_str());
     if (OnStopped)
         OnStopped(command_, stat);
-    if ((result = control_sock_->Send(cmd.c_str(), cmd.length())) < 0)
+    if ((result = control_->Send(*command)) < 0)
     {
         return -1;
     }
@@ -125,7 +169,7 @@ int EchoCommandReceiver::SendPrivateCommand()
 
 SendCommandReceiver::SendCommandReceiver(std::shared_ptr<CommandChannel> channel)
     : command_(std::dynamic_pointer_cast<SendCommand>(channel->command_)),
-      buf_(MAX_UDP_LENGTH,'\0'),recv_count_(0), recv_bytes_(0), speed_(0), min_speed_(-1), max_speed_(0),
+      packets_buf_(RECV_BATCH, Packet(data_sock_->IsGro() ? MAX_UDP_LENGTH : std::max<size_t>(command_->GetSize(), sizeof(DataHead)))),recv_count_(0), recv_bytes_(0), speed_(0), min_speed_(-1), max_speed_(0),
       running_(false), is_stopping_(false), latest_recv_bytes_(0), 
       illegal_packets_(0), reorder_packets_(0), duplicate_packets_(0), timeout_packets_(0), sequence_(0),
       token_(command_->token),
@@ -137,6 +181,18 @@ int SendCommandReceiver::Start()
     ASSERT_RETURN(!running_, -1, "SendCommandReceiver start unexpeted.");
     running_ = true;
     //context_->SetReadFd(data_sock_->GetFd());
+    if (command_->GetReport() > 0)
+    {
+        // the text messages can not be told apart if a report is coalesced with the result.
+        if (!control_->IsBinary())
+        {
+            LOGWP("interim report needs the binary control protocol.");
+            return 0;
+        }
+        report_start_ = report_begin_ = steady_clock::now();
+        report_timer_ = std::make_shared<Timer>([this] { Report(); });
+        context_->SetTimer(report_timer_, report_start_ + milliseconds(command_->GetReport()));
+    }
     return 0;
 }
 int SendCommandReceiver::Stop()
@@ -146,6 +202,9 @@ int SendCommandReceiver::Stop()
     //context_->ClrReadFd(data_sock_->GetFd());
     //context_->ClrWriteFd(data_sock_->GetFd());
     //context_->ClrReadFd(control_sock_->GetFd());
+    // the last report covers the rest of the interval.
+    if (report_timer_)
+        FinishReport();
     // allow to send stop command.
     context_->SetWriteFd(control_sock_->GetFd());
     return 0;
@@ -159,27 +218,76 @@ int SendCommandReceiver::Recv()
         start_ = high_resolution_clock::now();
         begin_ = high_resolution_clock::now();
     }
-    int result = data_sock_->Recv(&buf_[0], buf_.length());
-    buf_.resize(std::max(result,0));
+    // drain the socket until it would block, the socket buffer may overflow
+    // if we go back to the event loop for every packet.
+    int result = 0;
+    int total = 0;
+    int64_t total_bytes = 0;
+    while (total < RECV_BUDGET)
+    {
+        int count = std::min(RECV_BATCH, RECV_BUDGET - total);
+        result = data_sock_->RecvBatch(packets_buf_, count);
+        if (result <= 0)
+            break;
+        for (int i = 0; i < result; i++)
+        {
+            auto &packet = packets_buf_[i];
+            // the length is the real one of a truncated datagram, which is larger than the buffer.
+            if (packet.length > (ssize_t)packet.buf.length())
+            {
+                illegal_packets_++;
+                LOGWP("recv illegal data(%d): length=%ld, truncated to %ld", data_sock_->GetFd(), (long)packet.length, (long)packet.buf.length());
+                continue;
+            }
+            // split the datagrams coalesced by gro, the last one may be shorter.
+            ssize_t segment_size = packet.segment_size > 0 ? packet.segment_size : packet.length;
+            ssize_t offset = 0;
+            do
+            {
+                OnPacket(packet.buf.data() + offset, std::min(segment_size, packet.length - offset), packet.timestamp);
+                offset += segment_size;
+            } while (offset < packet.length);
+            total_bytes += packet.length;
+        }
+        total += result;
+        if (result < count)
+            break;
+    }
+    if (total == 0)
+    {
+        LOGWP("recv payload error(%d): %d", data_sock_->GetFd(), result);
+        return result;
+    }
+    return total_bytes;
+}
+
+int SendCommandReceiver::OnPacket(const char *buf, ssize_t length, int64_t timestamp)
+{
+    int result = length;
     if (result < sizeof(DataHead))
     {
         illegal_packets_++;
-        LOGWP("recv illegal data(%d): length=%d, %s",data_sock_->GetFd(),result,Tools::GetDataSum(buf_).c_str());
+        LOGWP("recv illegal data(%d): length=%d, %s",data_sock_->GetFd(),result,Tools::GetDataSum(std::string(buf,std::max(result,0))).c_str());
         return result;
     }
 
-    auto head = reinterpret_cast<DataHead*>(&buf_[0]);
+    auto head = reinterpret_cast<const DataHead*>(buf);
     if (token_ != head->token||result!=head->length)
     {
         illegal_packets_++;
-        LOGWP("recv illegal data(%d): length=%d, seq=%d, token=%c, expect %c",data_sock_->GetFd(),result,head->sequence, head->token, token_);
+        LOGWP("recv illegal data(%d): length=%d, seq=%u, token=%c, expect %c",data_sock_->GetFd(),result,head->GetSequence(), head->token, token_);
         return result;
     }
 
-    if(packets_.test(head->sequence))
+    // extend the sequence to 64 bits around the expected one, so it never wraps.
+    auto delta = head->IsVersioned() ? (int64_t)(int32_t)(head->GetSequence() - (uint32_t)sequence_)
+                                     : (int64_t)(int16_t)(head->sequence - (uint16_t)sequence_);
+    auto sequence = (int64_t)sequence_ + delta;
+    // the ones before the window are too late to tell whether they are duplicate.
+    if(sequence >= 0 && packets_.Set(sequence) == 0)
     {
         duplicate_packets_++;
-        LOGWP("recv duplicate data: seq=%d token %c",head->sequence,head->token);
+        LOGWP("recv duplicate data: seq=%ld token %c",(long)sequence,head->token);
         return result;
     }
 
@@ -189,41 +297,30 @@ int SendCommandReceiver::Recv()
     recv_bytes_ += result;
     recv_count_++;
     latest_recv_bytes_ += result;
-    auto time_delay = end_.time_since_epoch().count() - head->timestamp;
+    // the kernel timestamp excludes the time waiting in the socket and the event loop.
+    auto arrival_time = timestamp ? timestamp : end_.time_since_epoch().count();
+    auto time_delay = arrival_time - head->timestamp;
+    if(recv_count_ > 1)
+        arrival_sketch_.Add(arrival_time - arrival_time_);
+    arrival_time_ = arrival_time;
 
-    LOGDP("recv payload data: recv_count %ld seq %d expect_seq %d timestamp %ld token %c delay %ld",recv_count_,head->sequence,sequence_,head->timestamp,head->token,time_delay);
+    LOGVP("recv payload data: recv_count %ld seq %ld expect_seq %ld timestamp %ld token %c delay %ld",recv_count_,(long)sequence,(long)sequence_,head->timestamp,head->token,time_delay);
     
-    if(head->sequence!=sequence_)
+    if(sequence!=(int64_t)sequence_)
     {
         reorder_packets_++;
-        LOGWP("recv reorder data: seq=%d, expect %d",head->sequence,sequence_);
+        LOGWP("recv reorder data: seq=%ld, expect %ld",(long)sequence,(long)sequence_);
     }
     
-    auto jump_count = int(head->sequence) - sequence_;
-    if((jump_count>0 && jump_count<MAX_SEQ/2) || jump_count<0-MAX_SEQ/2)
-    {
-        // reset the locations which conrespond to the loss packets
-        while (sequence_ != head->sequence)
-        {
-            packets_.reset((sequence_+MAX_SEQ/2)%MAX_SEQ);
-            //LOGVP("reset %ld",(sequence_+MAX_SEQ/2)%MAX_SEQ);
-            sequence_++;
-        }
-    }
-    packets_.set(head->sequence);
-    // cycle reset to reuse sequence
-    packets_.reset((head->sequence+MAX_SEQ/2)%MAX_SEQ);
-    //LOGVP("reset %ld",(head->sequence+MAX_SEQ/2)%MAX_SEQ);
-    
-    sequence_ = head->sequence+1;
-    while (packets_.test(sequence_))
-    {
-        sequence_++;
-    }
+    // a late packet fills a gap behind, the expected one moves forward only.
+    if(sequence>=(int64_t)sequence_)
+        sequence_ = packets_.GetNextMissing(sequence+1);
+    sequence_end_ = std::max<int64_t>(sequence_end_, sequence + 1);
     
     if(recv_count_ == 1)
     {
         head_avg_delay_ = avg_delay_ = max_delay_ = min_delay_ = time_delay;
+        delay_baseline_ = time_delay;
         //LOGDP("time_gap= %ld",time_delay);
     }
 
@@ -244,6 +341,28 @@ int SendCommandReceiver::Recv()
 
     varn_delay_ = varn_delay_ + (time_delay - head_avg_delay_)*(time_delay- head_avg_delay_);
     std_delay_ = std::sqrt(varn_delay_/recv_count_);
+    delay_histogram_.Record(time_delay - delay_baseline_);
+    // J += (|D(i-1,i)| - J)/16, D is the delay difference of the consecutive arrivals.
+    if(recv_count_ > 1)
+        jitter_rfc3550_ += (std::abs(time_delay - last_delay_) - jitter_rfc3550_) / 16;
+    // the IPDV is undefined if the packet before it in sequence is lost or reordered.
+    if(recv_count_ > 1 && sequence == last_sequence_ + 1)
+        ipdv_histogram_.Record(time_delay - last_delay_);
+    last_delay_ = time_delay;
+    last_sequence_ = sequence;
+    report_bytes_ += result;
+    report_count_++;
+    report_delay_ += time_delay - delay_baseline_;
+    report_max_delay_ = report_count_ == 1 ? time_delay : std::max(report_max_delay_, time_delay);
+    if (report_timer_)
+    {
+        report_end_ = steady_clock::now();
+        if (recv_count_ == 1)
+            report_first_ = report_end_;
+        // the last sequence has arrived, the rest of the interval is idle.
+        if (sequence_end_ >= (uint64_t)command_->GetCount())
+            FinishReport();
+    }
     
     auto seconds = duration_cast<duration<double>>(end_ - begin_).count();
     if (seconds >= 1)
@@ -251,6 +370,7 @@ int SendCommandReceiver::Recv()
         int64_t speed = latest_recv_bytes_ / seconds;
         min_speed_ = min_speed_ == -1 ? speed : std::min(min_speed_, speed);
         max_speed_ = std::max(max_speed_, speed);
+        speed_sketch_.Add(speed);
         LOGIP("latest recv speed: recv_speed %ld recv_bytes %ld recv_time %d", speed, latest_recv_bytes_, int(seconds * 1000));
         latest_recv_bytes_ = 0;
         begin_ = high_resolution_clock::now();
@@ -262,6 +382,86 @@ int SendCommandReceiver::Recv()
     return result;
 }
 
+void SendCommandReceiver::Report()
+{
+    auto now = steady_clock::now();
+    // the end of the unpaced data is known by the last sequence only, an idle interval may be a stall.
+    if (recv_count_ > 0 && command_->GetIntervalNs() > 0)
+    {
+        // the paced data should have arrived by then, the later ones are timeout anyway.
+        auto data_end = report_first_ + nanoseconds(command_->GetIntervalNs() * std::max(command_->GetCount() - 1, 0)) +
+                        milliseconds(command_->GetTimeout());
+        if (now >= data_end)
+        {
+            // nothing arrives in the interval after the data, it is not reported.
+            if (report_count_ > 0)
+                FinishReport();
+            else
+                report_timer_ = NULL;
+            return;
+        }
+    }
+    SendReport(now);
+    // the deadlines are absolute, so the intervals do not drift.
+    context_->SetTimer(report_timer_, report_start_ + milliseconds(command_->GetReport() * (report_index_ + 1)));
+}
+
+void SendCommandReceiver::FinishReport()
+{
+    // the interval ends at the latest arrival, so the idle time after the data is not counted.
+    if (report_count_ > 0)
+        SendReport(std::max(report_end_, report_begin_));
+    else
+        SendReport(steady_clock::now());
+    context_->ClrTimer(report_timer_);
+    report_timer_ = NULL;
+}
+
+void SendCommandReceiver::SendReport(steady_clock::time_point end)
+{
+    auto seconds = duration_cast<duration<double>>(end - report_begin_).count();
+    auto command = std::make_shared<ReportCommand>();
+    auto stat = std::make_shared<NetStat>();
+    command->index = report_index_;
+    command->netstat = stat;
+    stat->recv_bytes = report_bytes_;
+    stat->recv_packets = report_count_;
+    stat->recv_time = seconds * 1000;
+    stat->reorder_packets = reorder_packets_ - report_reorder_packets_;
+    stat->duplicate_packets = duplicate_packets_ - report_duplicate_packets_;
+    if (seconds > 0)
+    {
+        stat->recv_speed = report_bytes_ / seconds;
+        stat->recv_pps = report_count_ / seconds;
+    }
+    // the packets sent in the interval are the ones after the latest sequence of the last report.
+    auto expected = (int64_t)(sequence_end_ - report_sequence_end_);
+    if (expected > 0)
+        stat->loss = std::max<int64_t>(expected - report_count_, 0) * 1.0 / expected;
+    // the same baseline as the final delay, the min delay.
+    if (report_count_ > 0)
+    {
+        stat->delay = (report_delay_ / report_count_ + delay_baseline_ - min_delay_) / 1000 / 1000;
+        stat->max_delay = (report_max_delay_ - min_delay_) / 1000 / 1000;
+    }
+    LOGDP("command report: %s || index %d %s", command_->GetCmd().c_str(), report_index_, stat->ToString().c_str());
+    if (control_->Send(*command) < 0)
+        LOGWP("send report error(%d).", control_sock_->GetFd());
+    // the rest is sent when the control socket is writable.
+    else if (control_sock_->GetPendingSize() > 0)
+        context_->SetWriteFd(control_sock_->GetFd());
+
+    report_index_++;
+    report_begin_ = end;
+    report_bytes_ = 0;
+    report_count_ = 0;
+    report_delay_ = 0;
+    report_max_delay_ = 0;
+    report_reorder_packets_ = reorder_packets_;
+    report_duplicate_packets_ = duplicate_packets_;
+    report_sequence_end_ = sequence_end_;
+}
+
 int SendCommandReceiver::SendPrivateCommand()
 {
     LOGDP("SendCommandReceiver send stop");
@@ -283,6 +483,12 @@ int SendCommandReceiver::SendPrivateCommand()
     // use the head_avg_delay as jitter, because min_delay is always zero
     stat->jitter = (head_avg_delay_-min_delay_)/1000/1000;
     stat->jitter_std = std_delay_/1000/1000;
+    // the percentiles are above the min delay too.
+    stat->SetDelayHistogram(delay_histogram_.Shift(delay_baseline_ - min_delay_));
+    stat->SetArrivalSketch(std::make_shared<QuantileSketch>(arrival_sketch_));
+    stat->jitter_rfc3550_us = jitter_rfc3550_ / 1000;
+    stat->SetIpdvHistogram(std::make_shared<LatencyHistogram>(ipdv_histogram_));
+    stat->SetRecvSpeedSketch(std::make_shared<QuantileSketch>(speed_sketch_));
     auto seconds = duration_cast<duration<double>>(stop_ - start_).count();
     if (seconds >= 0.001)
     {
@@ -295,11 +501,11 @@ int SendCommandReceiver::SendPrivateCommand()
     }
 
     auto command = std::make_shared<ResultCommand>();
-    auto cmd = command->Serialize(*stat);
-    LOGDP("command finish: %s || %s", command_->GetCmd().c_str(),cmd.c_str());
+    command->netstat = stat;
+    LOGDP("command finish: %s || %s", command_->GetCmd().c_str(),stat->ToString().c_str());
     if (OnStopped)
         OnStopped(command_, stat);
-    if ((result = control_sock_->Send(cmd.c_str(), cmd.length())) < 0)
+    if ((result = control_->Send(*command)) < 0)
     {
         return -1;
     }
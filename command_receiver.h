@@ -2,15 +2,25 @@
 
 #include <chrono>
 #include <queue>
-#include <bitset>
 
 #include "context2.h"
 #include "sock.h"
+#include "latency_histogram.h"
+#include "quantile_sketch.h"
+#include "sequence_window.h"
 
 using namespace std::chrono;
 
+// the max datagrams received by one syscall
+#define RECV_BATCH 32
+// the max datagrams received by one wakeup, so the control socket is never starved
+#define RECV_BUDGET 256
+// the packet slots of the echo ring, the packets are reflected from them in place
+#define ECHO_RING_SIZE 64
+
 class Command;
 class CommandChannel;
+class ControlChannel;
 class EchoCommand;
 class SendCommand;
 class NetStat;
@@ -43,6 +53,7 @@ protected:
     std::string argv_;
     std::shared_ptr<Context> context_;
     std::shared_ptr<Sock> control_sock_;
+    std::shared_ptr<ControlChannel> control_;
     std::shared_ptr<Sock> data_sock_;
 };
 
@@ -58,12 +69,32 @@ public:
     int SendPrivateCommand() override;
 
 private:
+    /**
+     * @brief Reflect the pending packets, then the fresh packets in [0, fresh).
+     *  The packets which can not be sent are kept at the end of the ring in order.
+     * 
+     * @param fresh 
+     * @return int the sent packets count, -1 if error.
+     */
+    int Reflect(int fresh);
+
     ssize_t recv_count_;
     ssize_t send_count_;
     bool running_;
     bool is_stopping_;
+    bool is_gro_;
     std::shared_ptr<EchoCommand> command_;
-    std::queue<std::string> data_queue_;
+    /**
+     * @brief The preallocated packet slots, the pending packets are at the end
+     *  and the packets are received into the free slots at the beginning.
+     * 
+     */
+    std::vector<Packet> ring_;
+    /**
+     * @brief The packets waiting for the data socket writable.
+     * 
+     */
+    int pending_;
 
     ssize_t illegal_packets_;
     //ssize_t reorder_packets_;
@@ -71,8 +102,6 @@ private:
     //ssize_t duplicate_packets_;
     //ssize_t timeout_packets_;
     char token_;
-    //uint16_t sequence_;
-    //std::bitset<MAX_SEQ> packets_;
 };
 
 class SendCommandReceiver : public CommandReceiver
@@ -86,10 +115,38 @@ public:
     int SendPrivateCommand() override;
 
 private:
-    std::string buf_;
+    /**
+     * @brief Account one received datagram.
+     * 
+     * @param buf 
+     * @param length 
+     * @param timestamp the arrival time stamped by kernel, 0 to use the current time.
+     * @return int 
+     */
+    int OnPacket(const char *buf, ssize_t length, int64_t timestamp);
+    /**
+     * @brief Send the interim report of the latest report interval and schedule the next one,
+     *  or stop the reports if the paced data has ended.
+     * 
+     */
+    void Report();
+    /**
+     * @brief Send the report of the interval up to the latest arrival, or up to now if it has
+     *  no packet, and stop the report timer.
+     * 
+     */
+    void FinishReport();
+    /**
+     * @brief Send the report of the interval from the latest report to end.
+     * 
+     * @param end 
+     */
+    void SendReport(steady_clock::time_point end);
+
     bool running_;
     bool is_stopping_;
     std::shared_ptr<SendCommand> command_;
+    std::vector<Packet> packets_buf_;
 
     high_resolution_clock::time_point start_;
     high_resolution_clock::time_point stop_;
@@ -108,8 +165,9 @@ private:
 
     ssize_t latest_recv_bytes_;
     char token_;
-    uint16_t sequence_;
-    std::bitset<MAX_SEQ> packets_;
+    // the next expected sequence, the first one not received after the latest.
+    uint64_t sequence_;
+    SequenceWindow packets_;
 
     int64_t avg_delay_ = 0;
     int64_t max_delay_ = 0;
@@ -119,4 +177,34 @@ private:
     uint64_t varn_delay_ = 0;
     // std_delay_ is standard deviation
     uint64_t std_delay_ = 0;
+    // the delays relative to the first one, the baseline is known only at the end.
+    LatencyHistogram delay_histogram_;
+    int64_t delay_baseline_ = 0;
+    // the RFC 3550 jitter in nanoseconds, and the delay and sequence of the latest packet.
+    double jitter_rfc3550_ = 0;
+    int64_t last_delay_ = 0;
+    int64_t last_sequence_ = -1;
+    LatencyHistogram ipdv_histogram_;
+    // the time between the arrivals of the packets, and the recv speed of every second.
+    QuantileSketch arrival_sketch_;
+    QuantileSketch speed_sketch_;
+    int64_t arrival_time_ = 0;
+
+    // the interim report of every report interval, it is sent by the binary control protocol only.
+    std::shared_ptr<Timer> report_timer_;
+    steady_clock::time_point report_start_;
+    steady_clock::time_point report_begin_;
+    // the arrivals of the first and the latest packet, the data ends by the count and interval.
+    steady_clock::time_point report_first_;
+    steady_clock::time_point report_end_;
+    int report_index_ = 0;
+    int64_t report_bytes_ = 0;
+    ssize_t report_count_ = 0;
+    int64_t report_delay_ = 0;
+    int64_t report_max_delay_ = 0;
+    ssize_t report_reorder_packets_ = 0;
+    ssize_t report_duplicate_packets_ = 0;
+    // the sequence after the latest one received, and its value at the latest report.
+    uint64_t sequence_end_ = 0;
+    uint64_t report_sequence_end_ = 0;
 };
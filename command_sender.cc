@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "command.h"
+#include "control_channel.h"
 #include "netsnoop.h"
 #include "udp.h"
 #include "tcp.h"
@@ -13,9 +14,9 @@
 #include "command_sender.h"
 
 CommandSender::CommandSender(std::shared_ptr<CommandChannel> channel)
-    : timeout_(-1), control_sock_(channel->control_sock_), data_sock_(channel->data_sock_),
+    : timer_(std::make_shared<Timer>([this] { Timeout(); })), control_sock_(channel->control_sock_), control_(channel->control_), data_sock_(channel->data_sock_),
       context_(channel->context_), command_(channel->command_),
-      is_stopping_(false), is_stopped_(false), is_waiting_result_(false),
+      is_stopping_(false), is_stop_due_(false), is_stopped_(false), is_waiting_result_(false),
       is_starting_(false), is_started_(false),is_waiting_ack_(false)
 {
 }
@@ -61,6 +62,22 @@ int CommandSender::OnStop(std::shared_ptr<NetStat> netstat)
 int CommandSender::SendCommand()
 {
     int result;
+    if (control_sock_->GetPendingSize() > 0)
+    {
+        // drain the queued messages first, a slow peer never blocks the loop.
+        if ((result = control_sock_->Flush()) < 0)
+        {
+            LOGEP("CommandSender flush command error.");
+            return -1;
+        }
+        if (control_sock_->GetPendingSize() > 0)
+            return result;
+        if (!is_starting_ && !is_stop_due_)
+        {
+            context_->ClrWriteFd(control_sock_->GetFd());
+            return result;
+        }
+    }
     // stop control channel write
     context_->ClrWriteFd(control_sock_->GetFd());
     ASSERT_RETURN(!is_stopped_,-1,"CommandSender has already stopped.");
@@ -69,7 +86,7 @@ int CommandSender::SendCommand()
         is_starting_ = false;
         is_waiting_ack_ = true;
         LOGDP("CommandSender send command: %s", command_->GetCmd().c_str());
-        if ((result = control_sock_->Send(command_->GetCmd().c_str(), command_->GetCmd().length())) < 0)
+        if ((result = PostCommand(*command_)) < 0)
         {
             LOGEP("CommandSender send command error.");
             return -1;
@@ -81,16 +98,28 @@ int CommandSender::SendCommand()
         ASSERT(is_started_);
         ASSERT(!is_waiting_result_);
         is_stopping_ = false;
+        is_stop_due_ = false;
         is_waiting_result_ = true;
         LOGDP("CommandSender send stop for: %s", command_->GetCmd().c_str());
         auto stop_command = std::make_shared<StopCommand>();
-        result = control_sock_->Send(stop_command->GetCmd().c_str(), stop_command->GetCmd().length());
+        result = PostCommand(*stop_command);
         if(result <= 0) return -1;
         return result;
     }
     return OnSendCommand();
 }
 
+int CommandSender::PostCommand(const Command &command)
+{
+    int result = control_->Send(command);
+    if (result < 0)
+        return -1;
+    // the rest is sent when the control socket is writable.
+    if (control_sock_->GetPendingSize() > 0)
+        context_->SetWriteFd(control_sock_->GetFd());
+    return result;
+}
+
 int CommandSender::OnSendCommand()
 {
     ASSERT_RETURN(0,-1,"CommandSender has no command to send.");
@@ -99,35 +128,54 @@ int CommandSender::OnSendCommand()
 int CommandSender::RecvCommand()
 {
     int result;
-    char buf[MAX_CMD_LENGTH] = {0};
-    result = control_sock_->Recv(buf, sizeof(buf));
+    result = control_->Recv();
+    // nothing to read on the non-blocking socket.
+    if(result==ERR_TIMEOUT) return 0;
     // client disconnected.
     if(result<=0) return -1;
-    auto command = CommandFactory::New(buf);
-    ASSERT_RETURN(command,-1);
-    if (is_waiting_result_)
+    std::shared_ptr<Command> command;
+    // a read may carry a part of a message or several messages.
+    while ((result = control_->Next(command)) > 0)
     {
-        is_waiting_result_ = false;
-        is_stopped_ = true;
-        auto result_command = std::dynamic_pointer_cast<ResultCommand>(command);
-        ASSERT_RETURN(result_command, -1, "CommandSender expect recv result command: %s", command->GetCmd().c_str());
-        LOGDP("CommandSender recv result: %s",result_command->netstat->ToString().c_str());
-        // should not clear control sock,keep control sock readable for detecting client disconnect
-        //context_->ClrReadFd(control_sock_->GetFd());
-        return OnStop(result_command->netstat);
-    }
+        // the interim reports may come at any time before the result.
+        auto report_command = std::dynamic_pointer_cast<ReportCommand>(command);
+        if (report_command)
+        {
+            if (OnReported)
+                OnReported(report_command->index, report_command->netstat);
+            continue;
+        }
 
-    if(is_waiting_ack_)
-    {
-        is_waiting_ack_ = false;
-        is_started_ = true;
-        auto ack_command = std::dynamic_pointer_cast<AckCommand>(command);
-        ASSERT_RETURN(ack_command, -1, "CommandSender expect recv ack command: %s", command->GetCmd().c_str());
-        return OnStart();
-    }
+        if (is_waiting_result_)
+        {
+            is_waiting_result_ = false;
+            is_stopped_ = true;
+            auto result_command = std::dynamic_pointer_cast<ResultCommand>(command);
+            ASSERT_RETURN(result_command, -1, "CommandSender expect recv result command: %s", command->GetCmd().c_str());
+            LOGDP("CommandSender recv result: %s",result_command->netstat->ToString().c_str());
+            // should not clear control sock,keep control sock readable for detecting client disconnect
+            //context_->ClrReadFd(control_sock_->GetFd());
+            // this sender may be released by OnStop, the client sends nothing after the result.
+            return OnStop(result_command->netstat);
+        }
 
-    LOGDP("CommandSender recv private command.");
-    return OnRecvCommand(command);
+        if(is_waiting_ack_)
+        {
+            is_waiting_ack_ = false;
+            is_started_ = true;
+            auto ack_command = std::dynamic_pointer_cast<AckCommand>(command);
+            ASSERT_RETURN(ack_command, -1, "CommandSender expect recv ack command: %s", command->GetCmd().c_str());
+            if ((result = OnStart()) < 0)
+                return result;
+            continue;
+        }
+
+        LOGDP("CommandSender recv private command.");
+        if ((result = OnRecvCommand(command)) < 0)
+            return result;
+    }
+    ASSERT_RETURN(result == 0, -1, "CommandSender recv illegal command.");
+    return 0;
 }
 
 int CommandSender::OnRecvCommand(std::shared_ptr<Command> command)
@@ -135,20 +183,32 @@ int CommandSender::OnRecvCommand(std::shared_ptr<Command> command)
     ASSERT_RETURN(0,-1,"CommandSender recv unexpected command: %s",command?command->GetCmd().c_str():"NULL");
 }
 
-int CommandSender::Timeout(int timeout)
+void CommandSender::SetTimeout(int timeout)
+{
+    if (timeout > 0)
+        context_->SetTimer(timer_, timeout);
+    else
+        context_->ClrTimer(timer_);
+}
+
+void CommandSender::SetDeadline(std::chrono::steady_clock::time_point deadline)
+{
+    // the deadlines are of the pacing, which should be on time.
+    context_->SetTimer(timer_, deadline, true);
+}
+
+int CommandSender::Timeout()
 {
-    ASSERT(timeout > 0);
-    timeout_ -= timeout;
-    if (timeout_ <= 0)
+    if(is_stopping_)
     {
-        if(is_stopping_)
-        {
-            // allow to send stop command
-            context_->SetWriteFd(control_sock_->GetFd());
-        }
-        else return OnTimeout();
+        // allow to send stop command
+        is_stop_due_ = true;
+        context_->SetWriteFd(control_sock_->GetFd());
+        return 0;
     }
-    return 0;
+    int result = OnTimeout();
+    if(result < 0) LOGWP("CommandSender timeout error: %d", result);
+    return result;
 }
 
 #pragma region EchoCommandSender
@@ -156,7 +216,7 @@ int CommandSender::Timeout(int timeout)
 EchoCommandSender::EchoCommandSender(std::shared_ptr<CommandChannel> channel)
     : command_(std::dynamic_pointer_cast<EchoCommand>(channel->command_)),
       data_buf_(command_->GetSize(), command_->token),
-      delay_(0), max_delay_(0), min_delay_(0),
+      delay_(0), max_delay_(0), min_delay_(0), delay_histogram_(std::make_shared<LatencyHistogram>()), ipdv_histogram_(std::make_shared<LatencyHistogram>()),
       send_packets_(0), recv_packets_(0),illegal_packets_(0),
       CommandSender(channel)
 {
@@ -184,17 +244,24 @@ int EchoCommandSender::SendData()
     auto timestamp = begin_.time_since_epoch().count();
     // write timestamp to data
     head->timestamp = timestamp;
-    head->sequence = send_packets_-1;
+    head->SetSequence(send_packets_-1);
     head->length = data_buf_.length();
     head->token = command_->token;
     int result = data_sock_->Send(data_buf_.c_str(), data_buf_.length());
+    if(result==ERR_WOULD_BLOCK)
+    {
+        // send it again when the socket is writable.
+        send_packets_--;
+        context_->SetWriteFd(data_sock_->GetFd());
+        return 0;
+    }
     if(result<0)
     {
         LOGEP("send payload error(%d).",data_sock_->GetFd());
     }
     else
     {
-        LOGDP("send payload data: send_packets %ld seq %ld timestamp %ld token %c",send_packets_,head->sequence,head->timestamp,head->token);
+        LOGVP("send payload data: send_packets %ld seq %ld timestamp %ld token %c",send_packets_,head->GetSequence(),head->timestamp,head->token);
     }
     return result;
 }
@@ -202,7 +269,11 @@ int EchoCommandSender::SendData()
 int EchoCommandSender::RecvData()
 {
     end_ = high_resolution_clock::now();
-    int result = data_sock_->Recv(&data_buf_[0], data_buf_.length());
+    int64_t timestamp;
+    int result = data_sock_->RecvWithTimestamp(&data_buf_[0], data_buf_.length(), timestamp);
+    // nothing to read on the non-blocking socket.
+    if (result == ERR_TIMEOUT)
+        return 0;
     auto head = (DataHead*)&data_buf_[0];
     if(result<sizeof(DataHead)||head->token!=command_->token||result!=head->length)
     {
@@ -212,7 +283,7 @@ int EchoCommandSender::RecvData()
     }
 
     recv_packets_++;
-    auto delay = end_.time_since_epoch().count() - head->timestamp;
+    auto delay = (timestamp ? timestamp : end_.time_since_epoch().count()) - head->timestamp;
     if(recv_packets_ == 1)
     {
         max_delay_ = min_delay_ = delay;
@@ -228,8 +299,17 @@ int EchoCommandSender::RecvData()
     delay_ = delay_ + (delay - delay_)/recv_packets_;
     varn_delay_ = varn_delay_ + (delay - old_delay)*(delay-delay_);
     std_delay_ = std::sqrt(varn_delay_/recv_packets_);
-
-    LOGDP("recv payload data: recv_packets %ld seq %ld timestamp %ld token %c",recv_packets_,head->sequence,head->timestamp,head->token);
+    delay_histogram_->Record(delay);
+    // J += (|D(i-1,i)| - J)/16 as RFC 3550, on the round trip delays.
+    if(recv_packets_ > 1)
+        jitter_rfc3550_ += (std::abs(delay - last_delay_) - jitter_rfc3550_) / 16;
+    int64_t sequence = head->GetSequence();
+    if(recv_packets_ > 1 && sequence == last_sequence_ + 1)
+        ipdv_histogram_->Record(delay - last_delay_);
+    last_delay_ = delay;
+    last_sequence_ = sequence;
+
+    LOGVP("recv payload data: recv_packets %ld seq %ld timestamp %ld token %c",recv_packets_,head->GetSequence(),head->timestamp,head->token);
     LOGIP("ping delay %.02f",delay/1000.0/1000);
 
     return result;
@@ -262,6 +342,9 @@ int EchoCommandSender::OnStop(std::shared_ptr<NetStat> netstat)
     stat->min_delay = min_delay_/(1000*1000);
     stat->jitter = stat->max_delay - stat->min_delay;
     stat->jitter_std = std_delay_/(1000*1000);
+    stat->SetDelayHistogram(delay_histogram_);
+    stat->jitter_rfc3550_us = jitter_rfc3550_ / 1000;
+    stat->SetIpdvHistogram(ipdv_histogram_);
     stat->send_bytes = send_packets_ * data_buf_.size();
     stat->recv_bytes = recv_packets_ * data_buf_.size();
     stat->send_packets = send_packets_;
@@ -287,12 +370,28 @@ int EchoCommandSender::OnStop(std::shared_ptr<NetStat> netstat)
 SendCommandSender::SendCommandSender(std::shared_ptr<CommandChannel> channel)
     : command_(std::dynamic_pointer_cast<SendCommandClazz>(channel->command_)),
       data_buf_(command_->GetSize(), command_->token),
-      send_packets_(0), send_bytes_(0),is_stoping_(false),
+      send_packets_(0), send_bytes_(0),send_calls_(0),max_send_batch_(0),is_stoping_(false),
+      burst_(command_->GetGso() > 0 ? command_->GetGso() : command_->GetBatch()),
+      budget_(std::max(command_->GetBudget(), burst_)),
+      is_gso_(command_->GetGso() > 0 && !command_->is_multicast),
+      pacing_(PacingMode::User), is_tx_timestamp_(false),
+      is_zerocopy_(false), is_zerocopy_exhausted_(false), zerocopy_packets_(0), zerocopy_copied_(0), zerocopy_completed_(0), zerocopy_delay_(0),
       CommandSender(channel)
 {
     if(data_buf_.size()<sizeof(DataHead)) data_buf_.resize(sizeof(DataHead));
 }
 
+SendCommandSender::~SendCommandSender()
+{
+    if (zerocopy_pending_.empty())
+        return;
+    // the kernel may still read the pages of the pending buffers, even after the socket
+    // is closed, so they are leaked on purpose rather than reused by the allocator.
+    LOGWP("leak %d zerocopy buffers not completed(%d).", (int)zerocopy_pending_.size(), data_sock_->GetFd());
+    for (auto &buffer : zerocopy_pending_)
+        new std::string(std::move(buffer.buf));
+}
+
 int SendCommandSender::OnStart()
 {
     LOGDP("SendCommandSender start payload.");
@@ -300,6 +399,21 @@ int SendCommandSender::OnStart()
     if(!command_->is_multicast)
         context_->SetWriteFd(data_sock_->GetFd());
     //SetTimeout(command_->GetInterval());
+    StartPacingOffload();
+    if (command_->IsZeroCopy() && !command_->is_multicast && pacing_ == PacingMode::User)
+    {
+        // the completions wake the data socket up as readable (EPOLLERR).
+        is_zerocopy_ = data_sock_->IsZeroCopy() || data_sock_->SetZeroCopy(true) >= 0;
+        if (is_zerocopy_)
+        {
+            is_gso_ = false;
+            zerocopy_free_.resize(ZEROCOPY_POOL_SIZE, data_buf_);
+        }
+        else
+        {
+            LOGWP("zerocopy is not available(%d), fallback to copy send.", data_sock_->GetFd());
+        }
+    }
     return 0;
 }
 
@@ -314,40 +428,285 @@ int SendCommandSender::SendData()
         context_->ClrWriteFd(data_sock_->GetFd());
         return Stop();
     }
-    LOGDP("SendCommandSender send payload data.");
-    if(start_.time_since_epoch().count() == 0)
+    LOGVP("SendCommandSender send payload data.");
+    auto interval = command_->GetIntervalNs();
+    if (!pacer_.IsStarted())
     {
         start_ = high_resolution_clock::now();
-        SetTimeout(command_->GetInterval());
+        // the peers share one multicast sequence paced by the multicast socket, the
+        // share of one peer has no schedule to measure against.
+        pacer_.Start(interval, pacing_ != PacingMode::User || command_->is_multicast);
     }
-    if (command_->GetInterval() > 0)
+    if (interval > 0)
         context_->ClrWriteFd(data_sock_->GetFd());
-    
-    DataHead* head = (DataHead*)&data_buf_[0];
-    head->timestamp = high_resolution_clock::now().time_since_epoch().count();
-    head->sequence = send_packets_;
-    head->length = data_buf_.length();
-    head->token = command_->token;
-    int result = data_sock_->Send(data_buf_.c_str(), data_buf_.length());
-    if(result<0)
+
+    // only send the packets which are due, the late ones are caught up by a batch.
+    // the kernel pacing takes a whole burst ahead, and sends it on time.
+    // keep filling the socket until the budget is used up or the socket is full.
+    int64_t ahead = pacing_ != PacingMode::User ? burst_ * interval : 0;
+    int total = 0;
+    bool is_blocked = false;
+    while (total < budget_)
     {
-        LOGEP("send payload error(%d).",data_sock_->GetFd());
+        int count = std::min<long long>(burst_, command_->GetCount() - send_packets_);
+        count = std::min<int64_t>(count, pacer_.GetDueCount(ahead));
+        count = std::min(count, budget_ - total);
+        if (count <= 0)
+            break;
+        int sent = SendBurst(count);
+        if (sent == ERR_WOULD_BLOCK)
+        {
+            is_blocked = true;
+            break;
+        }
+        if (sent < 0)
+        {
+            LOGEP("send payload error(%d).", data_sock_->GetFd());
+            return sent;
+        }
+        if (sent > 0)
+        {
+            pacer_.OnSent(sent);
+            send_packets_ += sent;
+            send_bytes_ += sent * data_buf_.length();
+            send_calls_++;
+            max_send_batch_ = std::max(max_send_batch_, sent);
+            stop_ = high_resolution_clock::now();
+            total += sent;
+        }
+        if (sent < count)
+            break;
     }
-    else if(result>0)
+    if (is_zerocopy_exhausted_)
     {
-        send_packets_++;
-        send_bytes_+=result;
-        stop_ = high_resolution_clock::now();
+        // RecvData resumes the sending when a buffer is released.
+        context_->ClrWriteFd(data_sock_->GetFd());
+        return total * data_buf_.length();
+    }
+    if (interval > 0)
+    {
+        // the late packets are sent as soon as the socket drains.
+        if (is_blocked)
+            context_->SetWriteFd(data_sock_->GetFd());
+        // wake up when a whole burst is due.
+        else
+            SetDeadline(pacer_.GetNextDeadline(std::min<long long>(burst_, command_->GetCount() - send_packets_)) - nanoseconds(ahead));
+    }
+    return total * data_buf_.length();
+}
+
+int SendCommandSender::SendBurst(int count)
+{
+    if (is_zerocopy_)
+        return SendZeroCopy(count);
+    if (is_gso_ && count > 1)
+    {
+        int sent = SendSegments(count);
+        if (sent >= 0 || sent == ERR_WOULD_BLOCK)
+            return sent;
+        LOGWP("udp gso is not available(%d), fallback to batch send.", data_sock_->GetFd());
+        is_gso_ = false;
+    }
+    return SendPackets(count);
+}
+
+int SendCommandSender::SendPackets(int count)
+{
+    if (data_bufs_.size() < count)
+        data_bufs_.resize(count, data_buf_);
+    int64_t launch_time = 0;
+    int64_t launch_delay = 0;
+    if (pacing_ == PacingMode::TxTime)
+    {
+        // steady_clock is CLOCK_MONOTONIC, which is the clock of the launch time.
+        launch_time = duration_cast<nanoseconds>(pacer_.GetNextDeadline().time_since_epoch()).count();
+        launch_delay = launch_time - duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+    for (int i = 0; i < count; i++)
+    {
+        DataHead* head = (DataHead*)&data_bufs_[i][0];
+        head->timestamp = high_resolution_clock::now().time_since_epoch().count();
+        // the kernel holds the datagram until its launch time, which is not the delay of the network,
+        // the late ones are launched at once.
+        if (pacing_ == PacingMode::TxTime)
+            head->timestamp += std::max<int64_t>(launch_delay + i * pacer_.GetInterval(), 0);
+        head->SetSequence(send_packets_ + i);
+        head->length = data_bufs_[i].length();
+        head->token = command_->token;
+    }
+    if (pacing_ == PacingMode::TxTime)
+        return data_sock_->SendBatchAt(data_bufs_, count, launch_time, pacer_.GetInterval());
+    // the batch send never blocks, even for a single datagram.
+    return data_sock_->SendBatch(data_bufs_, count);
+}
+
+int SendCommandSender::SendSegments(int count)
+{
+    auto size = data_buf_.length();
+    if (gso_buf_.length() < count * size)
+    {
+        gso_buf_.clear();
+        for (int i = 0; i < count; i++)
+            gso_buf_ += data_buf_;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        DataHead* head = (DataHead*)&gso_buf_[i * size];
+        head->timestamp = high_resolution_clock::now().time_since_epoch().count();
+        head->SetSequence(send_packets_ + i);
+        head->length = size;
+        head->token = command_->token;
+    }
+    // the same buffer is reused, only send the first count segments.
+    if (gso_buf_.length() == count * size)
+        return data_sock_->SendSegments(gso_buf_, size);
+    return data_sock_->SendSegments(gso_buf_.substr(0, count * size), size);
+}
+
+int SendCommandSender::SendZeroCopy(int count)
+{
+    if (zerocopy_free_.size() < count)
+        RecvZeroCopy();
+    // the buffers can not be touched until the kernel releases them.
+    count = std::min<int>(count, zerocopy_free_.size());
+    if (count == 0)
+    {
+        is_zerocopy_exhausted_ = true;
+        return 0;
+    }
+    if (zerocopy_bufs_.size() < count)
+        zerocopy_bufs_.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        zerocopy_bufs_[i].swap(zerocopy_free_.back());
+        zerocopy_free_.pop_back();
+        DataHead* head = (DataHead*)&zerocopy_bufs_[i][0];
+        head->timestamp = high_resolution_clock::now().time_since_epoch().count();
+        head->SetSequence(send_packets_ + i);
+        head->length = zerocopy_bufs_[i].length();
+        head->token = command_->token;
+    }
+    auto id = data_sock_->GetZeroCopyId();
+    int sent = data_sock_->SendZeroCopy(zerocopy_bufs_, count);
+    auto now = high_resolution_clock::now();
+    for (int i = 0; i < count; i++)
+    {
+        if (i < sent)
+            zerocopy_pending_.push_back({id + i, std::move(zerocopy_bufs_[i]), now, false});
+        else
+            zerocopy_free_.push_back(std::move(zerocopy_bufs_[i]));
+    }
+    if (sent > 0)
+        zerocopy_packets_ += sent;
+    return sent;
+}
+
+int SendCommandSender::RecvZeroCopy()
+{
+    int result = data_sock_->RecvZeroCopy(zerocopy_ranges_);
+    if (result <= 0)
+        return result;
+    auto now = high_resolution_clock::now();
+    for (auto &range : zerocopy_ranges_)
+    {
+        for (auto &buffer : zerocopy_pending_)
+        {
+            // the ids may wrap around.
+            if (buffer.is_completed || buffer.id - range.lo > range.hi - range.lo)
+                continue;
+            buffer.is_completed = true;
+            zerocopy_completed_++;
+            zerocopy_delay_ += duration_cast<microseconds>(now - buffer.time).count();
+            if (range.copied)
+                zerocopy_copied_++;
+        }
+    }
+    while (!zerocopy_pending_.empty() && zerocopy_pending_.front().is_completed)
+    {
+        zerocopy_free_.push_back(std::move(zerocopy_pending_.front().buf));
+        zerocopy_pending_.pop_front();
     }
     return result;
 }
+
+void SendCommandSender::StartPacingOffload()
+{
+    auto mode = command_->GetPacing();
+    auto interval = command_->GetIntervalNs();
+    if (mode == PacingMode::User || command_->is_multicast || interval == 0)
+        return;
+    int result;
+    if (mode == PacingMode::Rate)
+    {
+        // fq paces by the packet length on the wire.
+        result = data_sock_->SetPacingRate((data_buf_.length() + PACING_HEADER_SIZE) * 1000000000LL / interval);
+    }
+    else
+    {
+        result = data_sock_->SetTxTime(true);
+    }
+    if (result < 0)
+    {
+        LOGWP("kernel pacing is not available(%d), fallback to user pacing.", data_sock_->GetFd());
+        return;
+    }
+    pacing_ = mode;
+    // the offload needs the launch times of the datagrams, which gso does not have.
+    is_gso_ = false;
+    // the tx timestamps are numbered from 0, which is the sequence of the packets.
+    is_tx_timestamp_ = data_sock_->SetTxTimestamp(true) >= 0;
+}
+
+void SendCommandSender::StopPacingOffload()
+{
+    if (pacing_ == PacingMode::User)
+        return;
+    if (is_tx_timestamp_)
+    {
+        RecvTxTimestamps();
+        data_sock_->SetTxTimestamp(false);
+    }
+    if (pacing_ == PacingMode::Rate)
+        data_sock_->SetPacingRate(0);
+    else
+        data_sock_->SetTxTime(false);
+}
+
+int SendCommandSender::RecvTxTimestamps()
+{
+    int result = data_sock_->RecvTxTimestamps(tx_timestamps_);
+    if (result <= 0)
+        return result;
+    for (auto &timestamp : tx_timestamps_)
+    {
+        pacer_.OnDeparted(timestamp.id, timestamp.timestamp);
+    }
+    return result;
+}
+
 int SendCommandSender::RecvData()
 {
+    // the zero copy completions and the tx timestamps come from the error queue.
+    if (is_zerocopy_ && RecvZeroCopy() > 0)
+    {
+        if (is_zerocopy_exhausted_ && !zerocopy_free_.empty())
+        {
+            is_zerocopy_exhausted_ = false;
+            if (!is_stoping_)
+                context_->SetWriteFd(data_sock_->GetFd());
+        }
+        return 0;
+    }
+    if (is_tx_timestamp_ && RecvTxTimestamps() > 0)
+        return 0;
     // we don't expect recv any data
-    std::string buf(MAX_UDP_LENGTH,'\0');
-    int result = data_sock_->Recv(&buf[0], buf.length());
-    buf.resize(std::max(result,0));
-    LOGWP("recv illegal data(%d): length=%d, %s",data_sock_->GetFd(),result,Tools::GetDataSum(buf).c_str());
+    auto buf = context_->GetBufferPool().Get();
+    ASSERT_RETURN(buf, -1);
+    int result = data_sock_->Recv(buf.data(), buf.size());
+    // nothing to read on the non-blocking socket.
+    if (result == ERR_TIMEOUT)
+        return 0;
+    LOGWP("recv illegal data(%d): length=%d, %s",data_sock_->GetFd(),result,Tools::GetDataSum(buf.data(),std::max(result,0)).c_str());
     return result;
 }
 int SendCommandSender::OnTimeout()
@@ -362,8 +721,13 @@ int SendCommandSender::OnTimeout()
         return Stop();
     }
 
+    // the completions resume the sending.
+    if (is_zerocopy_exhausted_)
+        return 0;
     context_->SetWriteFd(data_sock_->GetFd());
-    SetTimeout(command_->GetInterval());
+    // the next deadline is set after the due packets are sent.
+    if (command_->GetIntervalNs() == 0)
+        SetTimeout(0);
 
     return 0;
 }
@@ -378,6 +742,8 @@ bool SendCommandSender::TryStop()
 int SendCommandSender::OnStop(std::shared_ptr<NetStat> netstat)
 {
     LOGDP("SendCommandSender stop payload.");
+    // the departures are reported when the client results arrive.
+    StopPacingOffload();
     if (!OnStopped)
         return 0;
 
@@ -386,6 +752,37 @@ int SendCommandSender::OnStop(std::shared_ptr<NetStat> netstat)
     {
         stat->send_bytes = send_bytes_;
         stat->send_packets = send_packets_;
+        stat->send_batch = 1.0 * send_packets_ / std::max<long long>(send_calls_, 1);
+        stat->max_send_batch = max_send_batch_;
+        if (command_->GetIntervalNs() > 0)
+        {
+            stat->pacing_error_us = pacer_.GetError() / 1000.0;
+            stat->max_pacing_error_us = pacer_.GetMaxError() / 1000;
+        }
+        if (pacing_ != PacingMode::User)
+        {
+            // the kernel accepts the offload but only fq or etf qdisc honours it.
+            if (pacer_.GetMeasuredCount() == 0)
+            {
+                // no tx timestamp, so it is unknown, which is not counted as honoured.
+                stat->pacing_offload = 0;
+                LOGWP("kernel pacing is not measured(%d), tx timestamp is not available.", data_sock_->GetFd());
+            }
+            else
+            {
+                stat->pacing_offload = pacer_.GetError() < pacer_.GetInterval() / 2;
+                if (!stat->pacing_offload)
+                    LOGWP("kernel pacing is not honoured(%d), check the qdisc.", data_sock_->GetFd());
+            }
+        }
+        if (is_zerocopy_)
+        {
+            // the buffers still pending are released with this sender, the kernel holds their pages.
+            RecvZeroCopy();
+            stat->zerocopy_packets = zerocopy_packets_;
+            stat->zerocopy_copied = zerocopy_copied_;
+            stat->zerocopy_delay_us = zerocopy_delay_ / std::max<long long>(zerocopy_completed_, 1);
+        }
         stat->send_time = duration_cast<milliseconds>(stop_ - start_).count();
         auto seconds = duration_cast<duration<double>>(stop_ - start_).count();
         if (seconds > 0.001)
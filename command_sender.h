@@ -3,21 +3,31 @@
 #include <memory>
 #include <functional>
 #include <chrono>
+#include <deque>
 
 #include "sock.h"
 #include "context2.h"
+#include "pacer.h"
+#include "latency_histogram.h"
 
 using namespace std::chrono;
 
 class Peer;
 class Command;
 class CommandChannel;
+class ControlChannel;
 class EchoCommand;
 class SendCommand;
 class NetStat;
+enum class PacingMode;
 
 using SendCommandClazz = class SendCommand;
 
+// the max payload buffers pinned by the zero copy sends.
+#define ZEROCOPY_POOL_SIZE 128
+// the udp, ip and ethernet headers length counted by the kernel pacing.
+#define PACING_HEADER_SIZE 42
+
 class CommandSender
 {
 public:
@@ -30,12 +40,32 @@ public:
     virtual int SendData() { return 0; };
     virtual int RecvData() { return 0; };
 
-    int Timeout(int timeout);
+    /**
+     * @brief Fire the timeout, which is called by the timer of context.
+     * 
+     * @return int 
+     */
+    int Timeout();
 
-    void SetTimeout(int timeout) { timeout_ = timeout>0?timeout:-1; };
-    int GetTimeout() { return timeout_; };
+    /**
+     * @brief Set a timeout, cancel it if timeout is not positive.
+     * 
+     * @param timeout in microseconds
+     */
+    void SetTimeout(int timeout);
+    /**
+     * @brief Set a timeout which fires at deadline.
+     * 
+     * @param deadline 
+     */
+    void SetDeadline(std::chrono::steady_clock::time_point deadline);
 
     std::function<void(std::shared_ptr<NetStat>)> OnStopped;
+    /**
+     * @brief An interim report of the client comes, with its report index.
+     * 
+     */
+    std::function<void(int, std::shared_ptr<NetStat>)> OnReported;
 
 protected:
     virtual int OnSendCommand();
@@ -43,14 +73,27 @@ protected:
     virtual int OnStart();
     virtual int OnStop(std::shared_ptr<NetStat> result_command);
     virtual int OnTimeout() { return 0; };
+    /**
+     * @brief Send a control message, wait for the control socket writable if it is queued.
+     * 
+     * @param cmd 
+     * @return int 
+     */
+    int PostCommand(const Command &command);
     std::shared_ptr<Sock> control_sock_;
+    std::shared_ptr<ControlChannel> control_;
     std::shared_ptr<Sock> data_sock_;
     std::shared_ptr<Context> context_;
 
 private:
-    int timeout_;
+    std::shared_ptr<Timer> timer_;
     std::shared_ptr<Command> command_;
     bool is_stopping_;
+    /**
+     * @brief The wait after payload is over, the stop command can be sent.
+     * 
+     */
+    bool is_stop_due_;
     bool is_stopped_;
     bool is_starting_;
     bool is_started_;
@@ -94,12 +137,19 @@ private:
 
     uint64_t varn_delay_ = 0;
     uint64_t std_delay_ = 0;
+    std::shared_ptr<LatencyHistogram> delay_histogram_;
+    // the RFC 3550 jitter of the round trip delays in nanoseconds, and the latest echo.
+    double jitter_rfc3550_ = 0;
+    int64_t last_delay_ = 0;
+    int64_t last_sequence_ = -1;
+    std::shared_ptr<LatencyHistogram> ipdv_histogram_;
 };
 
 class SendCommandSender : public CommandSender
 {
 public:
     SendCommandSender(std::shared_ptr<CommandChannel> channel);
+    ~SendCommandSender();
     
     int SendData() override;
     int RecvData() override;
@@ -109,6 +159,49 @@ private:
     int OnStart() override;
     int OnStop(std::shared_ptr<NetStat> netstat) override;
     inline bool TryStop();
+    /**
+     * @brief Send count packets by the best available method.
+     * 
+     * @return int the sent packets count, ERR_WOULD_BLOCK if the socket buffer is full.
+     */
+    int SendBurst(int count);
+    /**
+     * @brief Send count packets as individual datagrams.
+     * 
+     * @return int the sent packets count.
+     */
+    int SendPackets(int count);
+    /**
+     * @brief Send count packets as the segments of one UDP GSO buffer.
+     * 
+     * @return int the sent packets count.
+     */
+    int SendSegments(int count);
+    /**
+     * @brief Send count packets by MSG_ZEROCOPY from the free buffers of the pool.
+     * 
+     * @return int the sent packets count, 0 with is_zerocopy_exhausted_ set if all the
+     *  buffers wait for the completions.
+     */
+    int SendZeroCopy(int count);
+    /**
+     * @brief Recycle the buffers whose zero copy sends are completed.
+     * 
+     * @return int the completions count.
+     */
+    int RecvZeroCopy();
+    /**
+     * @brief Measure the pacing by the departure time reported by kernel.
+     * 
+     * @return int the timestamps count.
+     */
+    int RecvTxTimestamps();
+    /**
+     * @brief Hand the pacing to kernel if the command asks for it.
+     * 
+     */
+    void StartPacingOffload();
+    void StopPacingOffload();
 
     std::shared_ptr<SendCommandClazz> command_;
     bool is_stoping_;
@@ -120,5 +213,56 @@ private:
 
     ssize_t send_packets_;
     ssize_t send_bytes_;
+    /**
+     * @brief The syscalls count which sent some packets.
+     * 
+     */
+    long long send_calls_;
+    int max_send_batch_;
     std::string data_buf_;
+    std::vector<std::string> data_bufs_;
+    std::string gso_buf_;
+    /**
+     * @brief The max packets count sent by one wakeup.
+     * 
+     */
+    int burst_;
+    /**
+     * @brief The max packets count sent by one writable event, the loop yields to
+     *  the other peers when it is used up.
+     * 
+     */
+    int budget_;
+    bool is_gso_;
+    Pacer pacer_;
+    /**
+     * @brief The effective pacing mode, it is User if the kernel rejects the offload.
+     * 
+     */
+    PacingMode pacing_;
+    bool is_tx_timestamp_;
+    std::vector<TxTimestamp> tx_timestamps_;
+
+    /**
+     * @brief A payload buffer pinned by kernel until its zero copy send completes.
+     * 
+     */
+    struct ZeroCopyBuffer
+    {
+        uint32_t id;
+        std::string buf;
+        high_resolution_clock::time_point time;
+        bool is_completed;
+    };
+    bool is_zerocopy_;
+    // the sending waits for the completions, which wake the data socket up as readable.
+    bool is_zerocopy_exhausted_;
+    std::vector<std::string> zerocopy_free_;
+    std::vector<std::string> zerocopy_bufs_;
+    std::deque<ZeroCopyBuffer> zerocopy_pending_;
+    std::vector<ZeroCopyRange> zerocopy_ranges_;
+    long long zerocopy_packets_;
+    long long zerocopy_copied_;
+    long long zerocopy_completed_;
+    long long zerocopy_delay_;
 };
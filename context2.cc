@@ -1,30 +1,439 @@
+#include <string.h>
+#include <errno.h>
+
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif // __linux__
 
 #include "context2.h"
+#include "uring.h"
+
+#define INTEREST_READ 1
+#define INTEREST_WRITE 2
+#define MAX_EPOLL_EVENTS 1024
+// the spin before a timer deadline in nanoseconds.
+#define MIN_TIMER_SPIN 2000
+#define MAX_TIMER_SPIN 200000
+#define DEFAULT_TIMER_SPIN 60000
+
+Context::Context() : Context(DEFAULT_POLL_MODE) {}
 
-Context::Context() : max_fd(-1), control_fd(-1), data_fd(-1)
+Context::Context(PollMode mode)
+    : max_fd(-1), control_fd(-1), data_fd(-1), mode_(mode), epoll_fd_(-1),
+      buffer_pool_(std::make_shared<BufferPool>()), spin_(DEFAULT_TIMER_SPIN)
 {
     FD_ZERO(&read_fds);
     FD_ZERO(&write_fds);
+    FD_ZERO(&ready_read_fds_);
+    FD_ZERO(&ready_write_fds_);
+    if (mode_ == PollMode::Epoll)
+    {
+#ifdef __linux__
+        if ((epoll_fd_ = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        {
+            PSOCKETERROR("epoll_create1 error, fallback to select");
+            mode_ = PollMode::Select;
+        }
+#else
+        LOGWP("epoll is not supported, fallback to select.");
+        mode_ = PollMode::Select;
+#endif // __linux__
+    }
+    LOGDP("create context: %s", mode_ == PollMode::Epoll ? "epoll" : "select");
+}
+
+Context::~Context()
+{
+    if (epoll_fd_ >= 0)
+        close(epoll_fd_);
 }
 
 void Context::SetReadFd(int fd)
 {
-    FD_SET(fd, &read_fds);
-    max_fd = std::max(max_fd, fd);
+    UpdateInterest(fd, INTEREST_READ, true);
 }
 
 void Context::SetWriteFd(int fd)
 {
-    FD_SET(fd, &write_fds);
-    max_fd = std::max(max_fd, fd);
+    UpdateInterest(fd, INTEREST_WRITE, true);
 }
 
 void Context::ClrReadFd(int fd)
 {
-    FD_CLR(fd, &read_fds);
+    UpdateInterest(fd, INTEREST_READ, false);
 }
 
 void Context::ClrWriteFd(int fd)
 {
-    FD_CLR(fd, &write_fds);
+    UpdateInterest(fd, INTEREST_WRITE, false);
+}
+
+void Context::SetUring(std::shared_ptr<IoUring> uring)
+{
+    if (uring_)
+        ClrReadFd(uring_->GetFd());
+    uring_ = uring;
+    if (uring_)
+        SetReadFd(uring_->GetFd());
+}
+
+void Context::UpdateInterest(int fd, int mask, bool set)
+{
+    if (fd < 0)
+        return;
+    // the packets of attached sockets come from the completions, not the poller.
+    if (mask == INTEREST_READ && uring_ && uring_->IsAttached(fd))
+    {
+        uring_->SetReadInterest(fd, set);
+        return;
+    }
+    if (mode_ == PollMode::Select)
+    {
+#ifndef WIN32
+        if (fd >= FD_SETSIZE)
+        {
+            LOGEP("fd(%d) exceeds FD_SETSIZE, use epoll instead.", fd);
+            return;
+        }
+#endif // !WIN32
+        fd_set *fds = mask == INTEREST_READ ? &read_fds : &write_fds;
+        if (set)
+            FD_SET(fd, fds);
+        else
+            FD_CLR(fd, fds);
+        if (set)
+            max_fd = std::max(max_fd, fd);
+        return;
+    }
+
+#ifdef __linux__
+    if (fd >= interests_.size())
+    {
+        interests_.resize(fd + 1, 0);
+        registered_.resize(fd + 1, 0);
+        ready_.resize(fd + 1, 0);
+    }
+    uint8_t interest = set ? (interests_[fd] | mask) : (interests_[fd] & ~mask);
+    if (interest == interests_[fd])
+        return;
+    interests_[fd] = interest;
+    if (set)
+        max_fd = std::max(max_fd, fd);
+    // remove it right now, because the fd may be closed before the next Wait.
+    if (interest == 0 && registered_[fd])
+    {
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL) < 0 && errno != ENOENT && errno != EBADF)
+        {
+            PSOCKETERROREX("epoll_ctl del error(%d)", fd);
+        }
+        registered_[fd] = 0;
+        return;
+    }
+    // add or modify it when Wait, so multiple changes between two Wait cost one syscall.
+    changes_.push_back(fd);
+#endif // __linux__
+}
+
+void Context::SetTimer(std::shared_ptr<Timer> timer, int64_t timeout)
+{
+    SetTimer(timer, std::chrono::steady_clock::now() + std::chrono::microseconds(std::max<int64_t>(timeout, 0)));
+}
+
+void Context::SetTimer(std::shared_ptr<Timer> timer, std::chrono::steady_clock::time_point deadline, bool is_precise)
+{
+    ASSERT(timer);
+    timer->deadline_ = deadline;
+    timer->is_precise_ = is_precise;
+    timer->gen_++;
+    timer->is_active_ = true;
+    timers_.push(TimerEntry{timer->deadline_, timer->gen_, timer});
+}
+
+void Context::ClrTimer(std::shared_ptr<Timer> timer)
+{
+    if (!timer)
+        return;
+    timer->gen_++;
+    timer->is_active_ = false;
+}
+
+int Context::RunTimers()
+{
+    int count = 0;
+    auto now = std::chrono::steady_clock::now();
+    while (!timers_.empty() && timers_.top().deadline <= now)
+    {
+        auto entry = timers_.top();
+        timers_.pop();
+        auto timer = entry.timer.lock();
+        if (!timer || !timer->is_active_ || timer->gen_ != entry.gen)
+            continue;
+        timer->is_active_ = false;
+        // the callback may set the timer again, which pushes a new entry.
+        timer->callback_();
+        count++;
+    }
+    return count;
+}
+
+bool Context::GetNextDeadline(std::chrono::steady_clock::time_point &deadline, bool *is_precise)
+{
+    while (!timers_.empty())
+    {
+        auto &entry = timers_.top();
+        auto timer = entry.timer.lock();
+        if (timer && timer->is_active_ && timer->gen_ == entry.gen)
+        {
+            deadline = entry.deadline;
+            if (is_precise)
+                *is_precise = timer->is_precise_;
+            return true;
+        }
+        timers_.pop();
+    }
+    return false;
+}
+
+int64_t Context::GetNextTimeout()
+{
+    std::chrono::steady_clock::time_point deadline;
+    if (!GetNextDeadline(deadline))
+        return -1;
+    // round up to avoid waking up before the deadline.
+    auto timeout = std::chrono::duration_cast<std::chrono::microseconds>(
+                       deadline - std::chrono::steady_clock::now() + std::chrono::nanoseconds(999))
+                       .count();
+    return std::max<int64_t>(timeout, 0);
+}
+
+int Context::Wait(int timeout)
+{
+    using namespace std::chrono;
+    steady_clock::time_point deadline;
+    bool is_precise = false;
+    if (!GetNextDeadline(deadline, &is_precise))
+        return Poll(timeout);
+    auto now = steady_clock::now();
+    auto next_timeout = duration_cast<nanoseconds>(deadline - now).count();
+    if (timeout >= 0 && next_timeout >= timeout * 1000LL)
+        return Poll(timeout);
+    // the others sleep to the deadline, rounded up to avoid waking up before it.
+    if (!is_precise)
+        return Poll((int)std::min<int64_t>(std::max<int64_t>((next_timeout + 999) / 1000, 0), INT32_MAX));
+
+    // the sleep overshoots by the timer slack and the scheduling latency,
+    // so wake up a little early and spin to the deadline.
+    int result = 0;
+    if (next_timeout > spin_)
+    {
+        auto sleep = (next_timeout - spin_) / 1000;
+        result = Poll((int)std::min<int64_t>(sleep, INT32_MAX));
+        if (result == 0)
+        {
+            auto overshoot = duration_cast<nanoseconds>(steady_clock::now() - now).count() - sleep * 1000;
+            spin_ += (overshoot + MIN_TIMER_SPIN - spin_) / 8;
+            spin_ = std::min<int64_t>(std::max<int64_t>(spin_, MIN_TIMER_SPIN), MAX_TIMER_SPIN);
+        }
+    }
+    while (result == 0 && steady_clock::now() < deadline)
+        result = Poll(0);
+    return result;
+}
+
+int Context::Poll(int timeout)
+{
+    if (!uring_)
+        return mode_ == PollMode::Epoll ? WaitEpoll(timeout) : WaitSelect(timeout);
+
+    uring_->Submit();
+    uring_->Reap();
+    uring_fds_.clear();
+    // don't block if some packets are waiting to be read.
+    if (uring_->GetReadableFds(uring_fds_) > 0)
+        timeout = 0;
+    int result = mode_ == PollMode::Epoll ? WaitEpoll(timeout) : WaitSelect(timeout);
+    if (result < 0)
+        return result;
+    AddUringEvents();
+    return events.size();
+}
+
+void Context::AddUringEvents()
+{
+    int ring_fd = uring_->GetFd();
+    for (auto it = events.begin(); it != events.end(); it++)
+    {
+        if (it->fd == ring_fd)
+        {
+            events.erase(it);
+            break;
+        }
+    }
+    if (mode_ == PollMode::Select)
+        FD_CLR(ring_fd, &ready_read_fds_);
+    else if (ring_fd < ready_.size())
+        ready_[ring_fd] = 0;
+
+    uring_->Reap();
+    uring_fds_.clear();
+    uring_->GetReadableFds(uring_fds_);
+    for (auto fd : uring_fds_)
+    {
+        if (IsWritable(fd))
+        {
+            for (auto &event : events)
+            {
+                if (event.fd == fd)
+                    event.readable = true;
+            }
+        }
+        else
+        {
+            events.push_back(Event{fd, true, false});
+        }
+        if (mode_ == PollMode::Select)
+        {
+            FD_SET(fd, &ready_read_fds_);
+            continue;
+        }
+        if (fd >= ready_.size())
+            ready_.resize(fd + 1, 0);
+        ready_[fd] |= INTEREST_READ;
+    }
+}
+
+int Context::WaitSelect(int timeout)
+{
+    timeval tv = {0, 0};
+    timeval *tv_ptr = NULL;
+    if (timeout >= 0)
+    {
+        tv.tv_sec = timeout / 1000000;
+        tv.tv_usec = timeout % 1000000;
+        tv_ptr = &tv;
+    }
+    events.clear();
+    memcpy(&ready_read_fds_, &read_fds, sizeof(ready_read_fds_));
+    memcpy(&ready_write_fds_, &write_fds, sizeof(ready_write_fds_));
+    int result = select(max_fd + 1, &ready_read_fds_, &ready_write_fds_, NULL, tv_ptr);
+    if (result <= 0)
+    {
+        FD_ZERO(&ready_read_fds_);
+        FD_ZERO(&ready_write_fds_);
+        return result;
+    }
+    for (int fd = 0; fd < max_fd + 1; fd++)
+    {
+        Event event{fd, !!FD_ISSET(fd, &ready_read_fds_), !!FD_ISSET(fd, &ready_write_fds_)};
+        if (event.readable || event.writable)
+        {
+            LOGVP("can %s%s: %d", event.readable ? "read" : "", event.writable ? "write" : "", fd);
+            events.push_back(event);
+        }
+    }
+    return events.size();
+}
+
+int Context::WaitEpoll(int timeout)
+{
+#ifdef __linux__
+    int result;
+    for (auto &event : events)
+    {
+        ready_[event.fd] = 0;
+    }
+    events.clear();
+
+    epoll_event ev;
+    for (auto fd : changes_)
+    {
+        if (interests_[fd] == registered_[fd])
+            continue;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = (interests_[fd] & INTEREST_READ ? EPOLLIN : 0) | (interests_[fd] & INTEREST_WRITE ? EPOLLOUT : 0);
+        ev.data.fd = fd;
+        int op = registered_[fd] ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        result = epoll_ctl(epoll_fd_, op, fd, &ev);
+        if (result < 0 && (errno == ENOENT || errno == EEXIST))
+        {
+            op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            result = epoll_ctl(epoll_fd_, op, fd, &ev);
+        }
+        if (result < 0)
+        {
+            PSOCKETERROREX("epoll_ctl error(%d)", fd);
+            interests_[fd] = 0;
+            registered_[fd] = 0;
+            continue;
+        }
+        registered_[fd] = interests_[fd];
+    }
+    changes_.clear();
+
+    static thread_local epoll_event ready_events[MAX_EPOLL_EVENTS];
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+    // epoll_wait only supports milliseconds, which is too coarse for pacing.
+    // shared by the contexts of all the shard threads.
+    static std::atomic<bool> has_epoll_pwait2(true);
+    bool is_pwait2 = has_epoll_pwait2.load(std::memory_order_relaxed);
+    if (is_pwait2)
+    {
+        timespec ts = {timeout / 1000000, (timeout % 1000000) * 1000};
+        result = epoll_pwait2(epoll_fd_, ready_events, MAX_EPOLL_EVENTS, timeout < 0 ? NULL : &ts, NULL);
+        if (result < 0 && errno == ENOSYS)
+        {
+            is_pwait2 = false;
+            has_epoll_pwait2.store(false, std::memory_order_relaxed);
+        }
+    }
+    if (!is_pwait2)
+#endif
+    {
+        // round up to avoid waking up before the timeout.
+        int timeout_ms = timeout < 0 ? -1 : (timeout + 999) / 1000;
+        result = epoll_wait(epoll_fd_, ready_events, MAX_EPOLL_EVENTS, timeout_ms);
+    }
+    if (result < 0 && errno == EINTR)
+        return 0;
+    if (result <= 0)
+        return result;
+
+    for (int i = 0; i < result; i++)
+    {
+        int fd = ready_events[i].data.fd;
+        auto flags = ready_events[i].events;
+        // keep the same semantics with select: error and hangup make fd readable.
+        Event event{fd,
+                    (interests_[fd] & INTEREST_READ) && (flags & (EPOLLIN | EPOLLERR | EPOLLHUP)),
+                    (interests_[fd] & INTEREST_WRITE) && (flags & (EPOLLOUT | EPOLLERR | EPOLLHUP))};
+        if (!event.readable && !event.writable)
+            continue;
+        LOGVP("can %s%s: %d", event.readable ? "read" : "", event.writable ? "write" : "", fd);
+        ready_[fd] = (event.readable ? INTEREST_READ : 0) | (event.writable ? INTEREST_WRITE : 0);
+        events.push_back(event);
+    }
+    return events.size();
+#else
+    return -1;
+#endif // __linux__
+}
+
+bool Context::IsReadable(int fd) const
+{
+    if (fd < 0)
+        return false;
+    if (mode_ == PollMode::Select)
+        return FD_ISSET(fd, const_cast<fd_set *>(&ready_read_fds_));
+    return fd < ready_.size() && (ready_[fd] & INTEREST_READ);
+}
+
+bool Context::IsWritable(int fd) const
+{
+    if (fd < 0)
+        return false;
+    if (mode_ == PollMode::Select)
+        return FD_ISSET(fd, const_cast<fd_set *>(&ready_write_fds_));
+    return fd < ready_.size() && (ready_[fd] & INTEREST_WRITE);
 }
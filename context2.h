@@ -3,24 +3,190 @@
 #include <memory>
 #include <functional>
 #include <vector>
+#include <queue>
+#include <chrono>
 
 #include "sock.h"
+#include "buffer_pool.h"
 
 class Peer;
+class IoUring;
+
+/**
+ * @brief A ready fd returned by Context::Wait.
+ *
+ */
+struct Event
+{
+    int fd;
+    bool readable;
+    bool writable;
+};
+
+/**
+ * @brief A one-shot timer scheduled by Context::SetTimer, set it again to repeat.
+ *
+ */
+class Timer
+{
+public:
+    Timer(std::function<void()> callback) : callback_(callback), gen_(0), is_active_(false), is_precise_(false) {}
+    bool IsActive() const { return is_active_; }
+
+private:
+    std::function<void()> callback_;
+    std::chrono::steady_clock::time_point deadline_;
+    // bumped by every set, so the stale entries in the heap can be ignored.
+    uint64_t gen_;
+    bool is_active_;
+    // Wait spins the last moment before the deadline, only for the pacing.
+    bool is_precise_;
+
+    friend struct Context;
+    DISALLOW_COPY_AND_ASSIGN(Timer);
+};
 
 struct Context
 {
     Context();
+    Context(PollMode mode);
+    ~Context();
 
     void SetReadFd(int fd);
     void SetWriteFd(int fd);
     void ClrReadFd(int fd);
     void ClrWriteFd(int fd);
 
+    /**
+     * @brief Wait until some fds are ready, the ready fds are stored in events.
+     * It never waits beyond the earliest timer deadline, and spins the last moment
+     * before the deadline of a precise timer so it fires on time.
+     *
+     * @param timeout in microseconds, wait forever if it is negative.
+     * @return int the ready fds count, 0 if timeout, <0 if error.
+     */
+    int Wait(int timeout);
+    bool IsReadable(int fd) const;
+    bool IsWritable(int fd) const;
+
+    PollMode GetPollMode() const { return mode_; }
+
+    /**
+     * @brief Schedule timer to fire after timeout, reschedule it if it is active.
+     * The context only keeps a weak reference, destroying the timer cancels it.
+     *
+     * @param timer
+     * @param timeout in microseconds.
+     */
+    void SetTimer(std::shared_ptr<Timer> timer, int64_t timeout);
+    /**
+     * @brief Schedule timer to fire at deadline, reschedule it if it is active.
+     *
+     * @param timer
+     * @param deadline
+     * @param is_precise whether to spin to the deadline instead of sleeping with the timer slack.
+     */
+    void SetTimer(std::shared_ptr<Timer> timer, std::chrono::steady_clock::time_point deadline, bool is_precise = false);
+    void ClrTimer(std::shared_ptr<Timer> timer);
+    /**
+     * @brief Fire the expired timers.
+     *
+     * @return int the fired timers count.
+     */
+    int RunTimers();
+    /**
+     * @brief Get the time until the earliest timer deadline.
+     *
+     * @return int64_t in microseconds, -1 if there is no timer.
+     */
+    int64_t GetNextTimeout();
+
+    /**
+     * @brief Let the reads of the sockets attached to uring be driven by Wait.
+     *
+     * @param uring
+     */
+    void SetUring(std::shared_ptr<IoUring> uring);
+    std::shared_ptr<IoUring> GetUring() const { return uring_; }
+    /**
+     * @brief The packet buffers shared by the peers of this loop, replace it before any buffer is borrowed.
+     *
+     * @param pool
+     */
+    void SetBufferPool(std::shared_ptr<BufferPool> pool) { buffer_pool_ = pool; }
+    BufferPool &GetBufferPool() const { return *buffer_pool_; }
+
     int control_fd;
     int data_fd;
     fd_set read_fds;
     fd_set write_fds;
     int max_fd;
+    /**
+     * @brief The ready fds of the latest Wait.
+     *
+     */
+    std::vector<Event> events;
     //std::vector<std::shared_ptr<Peer>> peers;
-};
\ No newline at end of file
+
+private:
+    /**
+     * @brief Wait once by the poll backend and uring.
+     *
+     */
+    int Poll(int timeout);
+    int WaitSelect(int timeout);
+    int WaitEpoll(int timeout);
+    bool GetNextDeadline(std::chrono::steady_clock::time_point &deadline, bool *is_precise = NULL);
+    void UpdateInterest(int fd, int mask, bool set);
+    void AddUringEvents();
+
+    struct TimerEntry
+    {
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t gen;
+        std::weak_ptr<Timer> timer;
+        bool operator>(const TimerEntry &other) const { return deadline > other.deadline; }
+    };
+
+    PollMode mode_;
+    fd_set ready_read_fds_;
+    fd_set ready_write_fds_;
+    int epoll_fd_;
+    /**
+     * @brief The interest mask of every fd, the index is fd.
+     *
+     */
+    std::vector<uint8_t> interests_;
+    /**
+     * @brief The mask which has been registered to epoll, the index is fd.
+     *
+     */
+    std::vector<uint8_t> registered_;
+    /**
+     * @brief The ready mask of the latest Wait, the index is fd.
+     *
+     */
+    std::vector<uint8_t> ready_;
+    /**
+     * @brief The fds whose interest changed since the latest Wait.
+     *
+     */
+    std::vector<int> changes_;
+    std::shared_ptr<IoUring> uring_;
+    std::vector<int> uring_fds_;
+    std::shared_ptr<BufferPool> buffer_pool_;
+    /**
+     * @brief The min-heap of the timer deadlines, rescheduled or cancelled timers
+     * leave stale entries which are dropped when they reach the top.
+     *
+     */
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<TimerEntry>> timers_;
+    /**
+     * @brief How long to spin before a timer deadline in nanoseconds, it is calibrated
+     * by the overshoot of the sleeps.
+     *
+     */
+    int64_t spin_;
+
+    DISALLOW_COPY_AND_ASSIGN(Context);
+};
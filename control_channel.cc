@@ -0,0 +1,145 @@
+#include "command.h"
+#include "control_channel.h"
+
+ControlChannel::ControlChannel(std::shared_ptr<Sock> sock)
+    : sock_(sock), is_binary_(false)
+{
+}
+
+int ControlChannel::Send(const Command &command)
+{
+    auto result_command = dynamic_cast<const ResultCommand *>(&command);
+    auto report_command = dynamic_cast<const ReportCommand *>(&command);
+    if (!is_binary_)
+    {
+        auto cmd = result_command ? result_command->Serialize(*result_command->netstat)
+                   : report_command ? report_command->Serialize(*report_command->netstat) : command.GetCmd();
+        return sock_->Send(cmd.c_str(), cmd.length());
+    }
+
+    ControlType type;
+    std::string payload;
+    if (result_command)
+    {
+        type = ControlType::Result;
+        result_command->netstat->Serialize(payload);
+    }
+    else if (report_command)
+    {
+        type = ControlType::Report;
+        NetStat::PutField(payload, report_command->index);
+        report_command->netstat->SerializeReport(payload);
+    }
+    else if (dynamic_cast<const AckCommand *>(&command))
+        type = ControlType::Ack;
+    else if (dynamic_cast<const StopCommand *>(&command))
+        type = ControlType::Stop;
+    else
+    {
+        type = ControlType::Command;
+        payload = command.GetCmd();
+    }
+    ASSERT_RETURN(payload.length() <= CONTROL_MAX_LENGTH, -1, "control message too long: %d", (int)payload.length());
+
+    std::string frame(CONTROL_HEAD_LENGTH, 0);
+    frame[0] = (char)CONTROL_MAGIC;
+    frame[1] = CONTROL_VERSION;
+    frame[2] = (char)type;
+    for (int i = 0; i < 4; i++)
+        frame[4 + i] = (char)(payload.length() >> (i * 8));
+    frame += payload;
+    return sock_->Send(frame.c_str(), frame.length());
+}
+
+int ControlChannel::Recv()
+{
+    char buf[4096];
+    int result = sock_->Recv(buf, sizeof(buf));
+    if (result > 0)
+        buf_.append(buf, result);
+    return result;
+}
+
+int ControlChannel::Next(std::shared_ptr<Command> &command)
+{
+    command = NULL;
+    if (buf_.empty())
+        return 0;
+    // the server answers a client which can speak binary by frames.
+    if (!is_binary_ && (unsigned char)buf_[0] == CONTROL_MAGIC)
+    {
+        LOGDP("switch to binary control protocol(%d).", sock_->GetFd());
+        is_binary_ = true;
+    }
+    if (!is_binary_)
+    {
+        command = CommandFactory::New(buf_);
+        buf_.clear();
+        return command ? 1 : ERR_ILLEGAL_DATA;
+    }
+
+    ControlType type;
+    size_t length;
+    const char *payload;
+    while (true)
+    {
+        if (buf_.length() < CONTROL_HEAD_LENGTH)
+            return 0;
+        auto head = reinterpret_cast<const unsigned char *>(buf_.data());
+        length = 0;
+        for (int i = 0; i < 4; i++)
+            length |= (size_t)head[4 + i] << (i * 8);
+        if (head[0] != CONTROL_MAGIC || head[1] != CONTROL_VERSION || length > CONTROL_MAX_LENGTH)
+        {
+            LOGWP("recv illegal control frame(%d): %s", sock_->GetFd(), Tools::GetDataSum(buf_).c_str());
+            buf_.clear();
+            return ERR_ILLEGAL_DATA;
+        }
+        if (buf_.length() < CONTROL_HEAD_LENGTH + length)
+            return 0;
+        type = (ControlType)head[2];
+        if (type >= ControlType::Command && type <= ControlType::Report)
+            break;
+        // a newer peer may send the types we don't know, skip them by the length.
+        LOGWP("skip unknown control frame(%d): type %d length %d", sock_->GetFd(), (int)type, (int)length);
+        buf_.erase(0, CONTROL_HEAD_LENGTH + length);
+    }
+
+    payload = buf_.data() + CONTROL_HEAD_LENGTH;
+    switch (type)
+    {
+    case ControlType::Command:
+        command = CommandFactory::New(std::string(payload, length));
+        break;
+    case ControlType::Ack:
+        command = std::make_shared<AckCommand>();
+        break;
+    case ControlType::Stop:
+        command = std::make_shared<StopCommand>();
+        break;
+    case ControlType::Result:
+    {
+        auto result_command = std::make_shared<ResultCommand>();
+        result_command->netstat = std::make_shared<NetStat>();
+        result_command->netstat->Deserialize(payload, length);
+        command = result_command;
+        break;
+    }
+    case ControlType::Report:
+    {
+        auto report_command = std::make_shared<ReportCommand>();
+        report_command->netstat = std::make_shared<NetStat>();
+        auto end = payload + length;
+        NetStat::GetField(payload, end, report_command->index);
+        report_command->netstat->DeserializeReport(payload, end - payload);
+        command = report_command;
+        break;
+    }
+    }
+    buf_.erase(0, CONTROL_HEAD_LENGTH + length);
+    if (!command)
+        return ERR_ILLEGAL_DATA;
+    // the ack, stop, result and report are private as they are registered.
+    command->is_private = type != ControlType::Command;
+    return 1;
+}
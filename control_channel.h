@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "sock.h"
+
+// the first byte of a binary control frame, it is never the first byte of a text command.
+#define CONTROL_MAGIC 0xa5
+// the major version of the binary control protocol, only bumped by the incompatible changes.
+// the compatible changes append the result fields or add the frame types, which are skipped by the older peers.
+#define CONTROL_VERSION 1
+#define CONTROL_HEAD_LENGTH 8
+#define CONTROL_MAX_LENGTH (64 * 1024)
+// the client appends it to the cookie if it can speak the binary protocol.
+#define CONTROL_COOKIE_OPTION " control "
+
+class Command;
+
+/**
+ * @brief The type of a binary control frame.
+ *
+ */
+enum class ControlType : uint8_t
+{
+    // a main command, the payload is the command text.
+    Command = 1,
+    Ack = 2,
+    Stop = 3,
+    // the payload is the binary NetStat.
+    Result = 4,
+    // the payload is the report index and the report fields of NetStat.
+    Report = 5
+};
+
+/**
+ * @brief Send and recv the control messages on the control socket.
+ *  The binary messages are length-prefixed frames: magic, version, type, reserved
+ *  and the little endian payload length, so the coalesced and split TCP reads are
+ *  reassembled. Without the binary protocol negotiated, one read is one text message
+ *  as before.
+ *
+ */
+class ControlChannel
+{
+public:
+    ControlChannel(std::shared_ptr<Sock> sock);
+
+    /**
+     * @brief Send a command, ack, stop, result or report in the negotiated format.
+     *
+     * @param command
+     * @return int the bytes sent or queued, -1 if error.
+     */
+    int Send(const Command &command);
+    /**
+     * @brief Read the socket once and keep the bytes until they are complete messages.
+     *
+     * @return int the bytes read, 0 if the socket is closed, ERR_TIMEOUT if there is nothing to read.
+     */
+    int Recv();
+    /**
+     * @brief Take the next complete message.
+     * The frames of unknown types are skipped.
+     *
+     * @param command
+     * @return int 1 if a message is taken, 0 if more bytes are needed,
+     *  ERR_ILLEGAL_DATA if the message is broken or of another major version.
+     */
+    int Next(std::shared_ptr<Command> &command);
+
+    /**
+     * @brief Use the binary protocol, the client switches to it when it recvs the first frame.
+     *
+     * @param is_binary
+     */
+    void SetBinary(bool is_binary) { is_binary_ = is_binary; }
+    bool IsBinary() const { return is_binary_; }
+    /**
+     * @brief Get the bytes received but not taken by Next.
+     *
+     * @return size_t
+     */
+    size_t GetBufferedSize() const { return buf_.length(); }
+    std::shared_ptr<Sock> GetSock() const { return sock_; }
+
+private:
+    std::shared_ptr<Sock> sock_;
+    std::string buf_;
+    bool is_binary_;
+
+    DISALLOW_COPY_AND_ASSIGN(ControlChannel);
+};
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cmath>
+
+#include "latency_histogram.h"
+
+#define SUB_BUCKETS (1 << (HISTOGRAM_SUB_BITS - 1))
+
+LatencyHistogram::LatencyHistogram() : count_(0), min_(0), max_(0) {}
+
+int LatencyHistogram::GetIndex(uint64_t value)
+{
+    value = std::min<uint64_t>(value, (1ULL << HISTOGRAM_MAX_BITS) - 1);
+    if (value < 2 * SUB_BUCKETS)
+        return value;
+    int shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BITS - 1);
+    return shift * SUB_BUCKETS + (value >> shift);
+}
+
+uint64_t LatencyHistogram::GetLowest(int index)
+{
+    if (index < 2 * SUB_BUCKETS)
+        return index;
+    int shift = index / SUB_BUCKETS - 1;
+    return (uint64_t)(index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::GetWidth(int index)
+{
+    return index < 2 * SUB_BUCKETS ? 1 : 1ULL << (index / SUB_BUCKETS - 1);
+}
+
+void LatencyHistogram::Record(int64_t value, uint64_t count)
+{
+    if (count == 0)
+        return;
+    auto &counts = value < 0 ? negative_counts_ : counts_;
+    // the memory is taken when the first value comes.
+    if (counts.empty())
+        counts.resize(HISTOGRAM_BUCKETS);
+    counts[GetIndex(value < 0 ? -(uint64_t)value : value)] += count;
+    min_ = count_ == 0 ? value : std::min(min_, value);
+    max_ = count_ == 0 ? value : std::max(max_, value);
+    count_ += count;
+}
+
+void LatencyHistogram::AddCount(int index, uint64_t count, bool is_negative)
+{
+    if (index < 0 || index >= HISTOGRAM_BUCKETS || count == 0)
+        return;
+    auto &counts = is_negative ? negative_counts_ : counts_;
+    if (counts.empty())
+        counts.resize(HISTOGRAM_BUCKETS);
+    counts[index] += count;
+    auto lowest = (int64_t)GetLowest(index);
+    auto highest = lowest + (int64_t)GetWidth(index) - 1;
+    if (is_negative)
+    {
+        std::swap(lowest, highest);
+        lowest = -lowest;
+        highest = -highest;
+    }
+    min_ = count_ == 0 ? lowest : std::min(min_, lowest);
+    max_ = count_ == 0 ? highest : std::max(max_, highest);
+    count_ += count;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &histogram)
+{
+    if (histogram.count_ == 0)
+        return;
+    for (auto counts : {std::make_pair(&counts_, &histogram.counts_), std::make_pair(&negative_counts_, &histogram.negative_counts_)})
+    {
+        if (counts.second->empty())
+            continue;
+        if (counts.first->empty())
+            counts.first->resize(HISTOGRAM_BUCKETS);
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+            (*counts.first)[i] += (*counts.second)[i];
+    }
+    min_ = count_ == 0 ? histogram.min_ : std::min(min_, histogram.min_);
+    max_ = count_ == 0 ? histogram.max_ : std::max(max_, histogram.max_);
+    count_ += histogram.count_;
+}
+
+std::shared_ptr<LatencyHistogram> LatencyHistogram::Shift(int64_t delta) const
+{
+    auto histogram = std::make_shared<LatencyHistogram>();
+    // the middles are kept in [min, max], so a histogram shifted by -min has no negative value.
+    for (int i = 0; i < (int)negative_counts_.size(); i++)
+        histogram->Record(std::min(std::max(GetMiddle(i, true), min_), max_) + delta, negative_counts_[i]);
+    for (int i = 0; i < (int)counts_.size(); i++)
+        histogram->Record(std::min(std::max(GetMiddle(i, false), min_), max_) + delta, counts_[i]);
+    if (count_ > 0)
+    {
+        histogram->min_ = min_ + delta;
+        histogram->max_ = max_ + delta;
+    }
+    return histogram;
+}
+
+int64_t LatencyHistogram::GetMiddle(int index, bool is_negative) const
+{
+    auto middle = (int64_t)(GetLowest(index) + GetWidth(index) / 2);
+    return is_negative ? -middle : middle;
+}
+
+int64_t LatencyHistogram::GetPercentile(double percentile) const
+{
+    if (count_ == 0)
+        return 0;
+    auto rank = std::max<uint64_t>((uint64_t)std::ceil(count_ * std::min(std::max(percentile, 0.0), 100.0) / 100), 1);
+    uint64_t total = 0;
+    // the most negative values come first.
+    for (int i = (int)negative_counts_.size() - 1; i >= 0; i--)
+    {
+        total += negative_counts_[i];
+        if (total >= rank)
+            return std::min(std::max(GetMiddle(i, true), min_), max_);
+    }
+    for (int i = 0; i < (int)counts_.size(); i++)
+    {
+        total += counts_[i];
+        if (total >= rank)
+            return std::min(std::max(GetMiddle(i, false), min_), max_);
+    }
+    return max_;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+// the linear sub buckets per power of two are 2^(bits-1), the value error is below 1/64.
+#define HISTOGRAM_SUB_BITS 6
+// the values are clamped below 2^bits nanoseconds, about 68 seconds.
+#define HISTOGRAM_MAX_BITS 36
+#define HISTOGRAM_BUCKETS (((HISTOGRAM_MAX_BITS) - (HISTOGRAM_SUB_BITS) + 2) << ((HISTOGRAM_SUB_BITS) - 1))
+
+/**
+ * @brief A fixed memory log-linear histogram of delays in nanoseconds, like HdrHistogram.
+ *  The buckets are linear below 2^HISTOGRAM_SUB_BITS and every power of two above is split
+ *  into the same count of linear sub buckets, so recording is a bit scan and an increment.
+ *  The negative values, such as the one-way delays relative to a baseline, are kept apart.
+ *
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void Record(int64_t value) { Record(value, 1); }
+    void Record(int64_t value, uint64_t count);
+    void Merge(const LatencyHistogram &histogram);
+    /**
+     * @brief Get a copy with every value moved by delta, the values in a bucket move together.
+     *
+     * @param delta
+     * @return std::shared_ptr<LatencyHistogram>
+     */
+    std::shared_ptr<LatencyHistogram> Shift(int64_t delta) const;
+    /**
+     * @brief Get the value which percentile percent of the values are equal to or below.
+     *
+     * @param percentile in [0, 100]
+     * @return int64_t the middle of its bucket, 0 if there is no value.
+     */
+    int64_t GetPercentile(double percentile) const;
+
+    uint64_t GetCount() const { return count_; }
+    int64_t GetMin() const { return min_; }
+    int64_t GetMax() const { return max_; }
+    /**
+     * @brief Get the counts of the non-negative values by bucket, it is empty if there is no value.
+     *
+     * @return const std::vector<uint64_t>&
+     */
+    const std::vector<uint64_t> &GetCounts() const { return counts_; }
+    /**
+     * @brief Get the counts of the negative values by the bucket of their absolute values.
+     *
+     * @return const std::vector<uint64_t>&
+     */
+    const std::vector<uint64_t> &GetNegativeCounts() const { return negative_counts_; }
+    /**
+     * @brief Add count values to a bucket.
+     *
+     * @param index
+     * @param count
+     * @param is_negative whether the bucket is of the negative values.
+     */
+    void AddCount(int index, uint64_t count, bool is_negative = false);
+    /**
+     * @brief Restore the exact min and max after the buckets are added by AddCount.
+     *
+     * @param min
+     * @param max
+     */
+    void SetRange(int64_t min, int64_t max)
+    {
+        min_ = min;
+        max_ = max;
+    }
+
+    static int GetIndex(uint64_t value);
+    static uint64_t GetLowest(int index);
+    static uint64_t GetWidth(int index);
+
+private:
+    int64_t GetMiddle(int index, bool is_negative) const;
+
+    std::vector<uint64_t> counts_;
+    std::vector<uint64_t> negative_counts_;
+    uint64_t count_;
+    int64_t min_;
+    int64_t max_;
+};
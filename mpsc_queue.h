@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+#include "netsnoop.h"
+
+/**
+ * @brief A lock-free unbounded queue, any thread can push and only one thread can pop.
+ *  A push is one atomic exchange, so the producers never wait for each other or the consumer.
+ *
+ * @tparam T
+ */
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() : head_(new Node()), tail_(head_.load()) {}
+    ~MpscQueue()
+    {
+        T value;
+        while (Pop(value))
+            ;
+        delete tail_;
+    }
+
+    /**
+     * @brief Push a value, it is thread safe.
+     *
+     * @param value
+     */
+    void Push(T value)
+    {
+        auto node = new Node(std::move(value));
+        auto prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+    /**
+     * @brief Pop the oldest value, should be called by the consumer thread only.
+     *  A value being pushed may be invisible for a moment, the producer wakes the consumer after it.
+     *
+     * @param value
+     * @return bool false if there is no value.
+     */
+    bool Pop(T &value)
+    {
+        auto next = tail_->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        value = std::move(next->value);
+        // the popped node becomes the new stub.
+        next->value = T();
+        delete tail_;
+        tail_ = next;
+        return true;
+    }
+    /**
+     * @brief Whether there is no value to pop, should be called by the consumer thread only.
+     *
+     * @return bool
+     */
+    bool IsEmpty() const { return !tail_->next.load(std::memory_order_acquire); }
+
+private:
+    struct Node
+    {
+        Node() : next(NULL) {}
+        Node(T &&v) : value(std::move(v)), next(NULL) {}
+        T value;
+        std::atomic<Node *> next;
+    };
+
+    // the latest pushed node, shared by the producers.
+    std::atomic<Node *> head_;
+    // the stub before the oldest value, owned by the consumer.
+    Node *tail_;
+
+    DISALLOW_COPY_AND_ASSIGN(MpscQueue);
+};
@@ -1,80 +1,58 @@
 
 
 #include "context2.h"
+#include "uring.h"
 #include "command.h"
 #include "net_snoop_client.h"
 
 int NetSnoopClient::Run()
 {
     int result;
-    char buf[100] = {0};
-    fd_set read_fds, write_fds;
-    FD_ZERO(&read_fds);
-    FD_ZERO(&write_fds);
 
-    context_ = std::make_shared<Context>();
+    context_ = std::make_shared<Context>(option_->poll_mode);
     auto context = context_;
+    if (option_->io_engine == IoEngine::Uring)
+        context_->SetUring(IoUring::Create());
+    if (option_->hugepage)
+        context_->SetBufferPool(std::make_shared<BufferPool>(MAX_UDP_LENGTH, true));
 
     if ((result = Connect()) != 0)
         return result;
 
     while (true)
     {
-        memcpy(&read_fds, &context->read_fds, sizeof(read_fds));
-        memcpy(&write_fds, &context->write_fds, sizeof(write_fds));
+        // the timers of the receiver, such as the interim reports.
+        context->RunTimers();
 
-#ifdef _DEBUG
-        for (int i = 0; i < context_->max_fd + 1; i++)
+        LOGVP("client[%d] waiting",control_sock_->GetFd());
+        result = context->Wait(-1);
+        LOGVP("client[%d] waited",control_sock_->GetFd());
+        if (result < 0)
         {
-            if (FD_ISSET(i, &read_fds))
-            {
-                LOGVP("want read: %d", i);
-            }
-            if (FD_ISSET(i, &write_fds))
-            {
-                LOGVP("want write: %d", i);
-            }
-        }
-#endif
-        LOGVP("client[%d] selecting",control_sock_->GetFd());
-        result = select(context->max_fd + 1, &read_fds, &write_fds, NULL, NULL);
-        LOGVP("client[%d] selected",control_sock_->GetFd());
-#ifdef _DEBUG
-        for (int i = 0; i < context_->max_fd + 1; i++)
-        {
-            if (FD_ISSET(i, &read_fds))
-            {
-                LOGVP("can read: %d", i);
-            }
-            if (FD_ISSET(i, &write_fds))
-            {
-                LOGVP("can write: %d", i);
-            }
-        }
-#endif
-        if (result <= 0)
-        {
-            PSOCKETERROR("select error");
+            PSOCKETERROR("wait error");
             return -1;
         }
-        if (FD_ISSET(data_sock_->GetFd(), &write_fds))
+        if (result == 0)
+            continue;
+        if (context->IsWritable(data_sock_->GetFd()))
         {
             result = SendData();
             ASSERT_RETURN(result>=0,-1);
         }
-        if (FD_ISSET(data_sock_->GetFd(), &read_fds))
+        if (context->IsReadable(data_sock_->GetFd()))
         {
             result = RecvData(data_sock_);
             if(result<=0) LOGWP("data sock recv error.");
             // in a long delay network(>100ms)，we may recv a port unreachable ICMP packet.
             //ASSERT_RETURN(result>0,-1);
         }
-        if (FD_ISSET(multicast_sock_->GetFd(), &read_fds))
+        if (context->IsReadable(multicast_sock_->GetFd()))
         {
             result = RecvData(multicast_sock_);
-            ASSERT_RETURN(result>0,-1);
+            // the socket may have been drained by the previous wakeup.
+            ASSERT_RETURN(result>0||result==ERR_TIMEOUT,-1);
         }
-        if (FD_ISSET(control_sock_->GetFd(), &write_fds))
+        if (context->IsWritable(control_sock_->GetFd()))
         {
             if ((result = SendCommand()) < 0)
             {
@@ -82,7 +60,7 @@ int NetSnoopClient::Run()
                 break;
             }
         }
-        if (FD_ISSET(control_sock_->GetFd(), &read_fds))
+        if (context->IsReadable(control_sock_->GetFd()))
         {
             if ((result = RecvCommand()) == ERR_DEFAULT)
             {
@@ -128,7 +106,7 @@ int NetSnoopClient::Connect()
     ASSERT(result>=0);
 #endif // WIN32
     
-    data_sock_ = std::make_shared<Udp>();
+    data_sock_ = UringUdp::New(context_->GetUring());
     result = data_sock_->Initialize();
     result = data_sock_->Connect(option_->ip_remote, option_->port);
     ASSERT_RETURN(result >= 0,-1,"data socket connect server error.");
@@ -138,19 +116,38 @@ int NetSnoopClient::Connect()
     result = data_sock_->GetLocalAddress(ip_local, port_local);
     ASSERT(result >= 0);
 
-    multicast_sock_ = std::make_shared<Udp>();
+    multicast_sock_ = UringUdp::New(context_->GetUring());
     result = multicast_sock_->Initialize();
     result = multicast_sock_->Bind("0.0.0.0",option_->port);
     ASSERT_RETURN(result >= 0,-1,"multicast socket bind error: %s:%d",ip_local.c_str(),option_->port);
     result = multicast_sock_->JoinMUlticastGroup(option_->ip_multicast,ip_local);
     ASSERT_RETURN(result>=0,-1);
 
+    // the delay is measured by the kernel arrival time if possible.
+    if (data_sock_->SetTimestamp(true) < 0 || multicast_sock_->SetTimestamp(true) < 0)
+        LOGWP("enable kernel timestamp error, measure delay by user time.");
+
+    if (option_->gro)
+    {
+        // the datagrams are still counted one by one if gro is not available.
+        if (data_sock_->SetGro(true) < 0 || multicast_sock_->SetGro(true) < 0)
+            LOGWP("enable udp gro error, receive datagrams one by one.");
+    }
+
     // only recv the target's multicast packets,windows can not do this
     // result = multicast_sock_->Connect(option_->ip_remote, option_->port);
     // ASSERT_RETURN(result >= 0,-1,"multicast socket connect server error.");
 
+    // never wait for a slow server in the event loop.
+    if (control_sock_->SetNonBlocking(true) < 0 || data_sock_->SetNonBlocking(true) < 0 ||
+        multicast_sock_->SetNonBlocking(true) < 0)
+        return -1;
+
     cookie_ = "cookie:" + ip_local + ":" + std::to_string(port_local);
-    result = control_sock_->Send(cookie_.c_str(), cookie_.length());
+    control_ = std::make_shared<ControlChannel>(control_sock_);
+    // an older server takes the port by atoi, so the option after it is ignored.
+    auto auth = option_->binary_control ? cookie_ + CONTROL_COOKIE_OPTION + std::to_string(CONTROL_VERSION) : cookie_;
+    result = control_sock_->Send(auth.c_str(), auth.length());
     ASSERT_RETURN(result >= 0,-1);
     // TODO: optimize this code, wait 100 millseconds for server creating the data sock
     usleep(500*1000);
@@ -173,9 +170,11 @@ int NetSnoopClient::Connect()
 int NetSnoopClient::RecvCommand()
 {
     int result;
-    std::string cmd(MAX_UDP_LENGTH, '\0');
-    if ((result = control_sock_->Recv(&cmd[0], cmd.length())) < 0)
+    if ((result = control_->Recv()) < 0)
     {
+        // nothing to read on the non-blocking socket.
+        if (result == ERR_TIMEOUT)
+            return 0;
         return ERR_DEFAULT;
     }
     if(result == 0)
@@ -183,17 +182,26 @@ int NetSnoopClient::RecvCommand()
         // socket closed.
         return ERR_SOCKET_CLOSED;
     }
-    cmd.resize(result);
+    std::shared_ptr<Command> command;
+    // a read may carry a part of a message or several messages.
+    while ((result = control_->Next(command)) > 0)
+    {
+        if ((result = ProcessCommand(command)) < 0)
+            return result;
+    }
+    return result;
+}
 
-    auto command = CommandFactory::New(cmd);
-    if (!command)
-        return ERR_ILLEGAL_DATA;
+int NetSnoopClient::ProcessCommand(std::shared_ptr<Command> command)
+{
+    int result;
     LOGDP("recv new command: %s",command->GetCmd().c_str());
     if(receiver_ && command->is_private)
     {
         auto stop_command = std::dynamic_pointer_cast<StopCommand>(command);
         if(stop_command)
         {
+            is_result_due_ = true;
             return receiver_->Stop();    
         }
         return receiver_->RecvPrivateCommand(command);
@@ -215,11 +223,14 @@ int NetSnoopClient::RecvCommand()
     }
     
     auto ack_command = std::make_shared<AckCommand>();
-    result = control_sock_->Send(ack_command->GetCmd().c_str(),ack_command->GetCmd().length());
+    result = control_->Send(*ack_command);
     ASSERT_RETURN(result>0,ERR_DEFAULT,"send ack command error.");
+    // the rest is sent when the control socket is writable.
+    if (control_sock_->GetPendingSize() > 0)
+        context_->SetWriteFd(control_sock_->GetFd());
 
     auto channel = std::shared_ptr<CommandChannel>(new CommandChannel{
-        command,context_,control_sock_,command->is_multicast?multicast_sock_:data_sock_
+        command,context_,control_sock_,command->is_multicast?multicast_sock_:data_sock_,control_
     });
     receiver_ = command->CreateCommandReceiver(channel);
     ASSERT(receiver_);
@@ -229,11 +240,28 @@ int NetSnoopClient::RecvCommand()
 
 int NetSnoopClient::SendCommand()
 {
+    int result;
+    if (control_sock_->GetPendingSize() > 0)
+    {
+        // drain the queued messages first, a slow server never blocks the loop.
+        if ((result = control_sock_->Flush()) < 0)
+            return -1;
+        if (control_sock_->GetPendingSize() > 0)
+            return result;
+        if (!is_result_due_)
+        {
+            context_->ClrWriteFd(control_sock_->GetFd());
+            return result;
+        }
+    }
     ASSERT(receiver_);
+    is_result_due_ = false;
     receiver_->out_of_command_packets_ = illegal_packets_;
-    int result = receiver_->SendPrivateCommand();
+    result = receiver_->SendPrivateCommand();
     receiver_ = NULL;
     illegal_packets_ = 0;
+    if (control_sock_->GetPendingSize() > 0)
+        context_->SetWriteFd(control_sock_->GetFd());
     return result;
 }
 
@@ -242,16 +270,16 @@ int NetSnoopClient::RecvData(std::shared_ptr<Sock> data_sock)
     int result;
     if(!receiver_ || receiver_->GetDataFd() != data_sock->GetFd())
     {
-        std::string buf(MAX_UDP_LENGTH,'\0');
-        result = data_sock->Recv(&buf[0],buf.length());
+        auto buf = context_->GetBufferPool().Get();
+        ASSERT_RETURN(buf, -1);
+        result = data_sock->Recv(buf.data(),buf.size());
         if(result<=0)
         {
             LOGWP("recv data error(%d).",data_sock->GetFd());
             return result;
         }
-        buf.resize(result);
         illegal_packets_++;
-        LOGWP("recv out of command data(%d): %s",data_sock->GetFd(),Tools::GetDataSum(buf).c_str());
+        LOGWP("recv out of command data(%d): %s",data_sock->GetFd(),Tools::GetDataSum(buf.data(),result).c_str());
         return result;
     }
     result = receiver_->Recv();
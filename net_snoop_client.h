@@ -6,6 +6,7 @@
 #include "tcp.h"
 #include "udp.h"
 #include "command_receiver.h"
+#include "control_channel.h"
 
 class NetSnoopClient
 {
@@ -22,6 +23,7 @@ public:
 private:
     int Connect();
     int RecvCommand();
+    int ProcessCommand(std::shared_ptr<Command> command);
     int SendCommand();
     int RecvData(std::shared_ptr<Sock> data_sock);
     int SendData();
@@ -29,11 +31,17 @@ private:
     std::shared_ptr<Option> option_;
     std::shared_ptr<Context> context_;
     std::shared_ptr<Sock> control_sock_;
+    std::shared_ptr<ControlChannel> control_;
     std::shared_ptr<Sock> data_sock_;
     std::shared_ptr<Udp> multicast_sock_;
     std::shared_ptr<CommandReceiver> receiver_;
 
     ssize_t illegal_packets_ = 0;
+    /**
+     * @brief The command is stopped, the result should be sent when the control socket is writable.
+     * 
+     */
+    bool is_result_due_ = false;
     std::string cookie_;
 
     DISALLOW_COPY_AND_ASSIGN(NetSnoopClient);
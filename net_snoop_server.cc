@@ -6,10 +6,16 @@
 #include <functional>
 #include <thread>
 #include <chrono>
+#include <climits>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif // !WIN32
 
 #include "sock.h"
 #include "command.h"
 #include "context2.h"
+#include "uring.h"
 #include "netsnoop.h"
 #include "net_snoop_server.h"
 
@@ -23,12 +29,6 @@ using namespace std::chrono;
 int NetSnoopServer::Run()
 {
     int result;
-    int time_microseconds = 0;
-    timeval timeout = {0, 0};
-    timeval *timeout_ptr = NULL;
-    fd_set read_fdsets, write_fdsets;
-    FD_ZERO(&read_fdsets);
-    FD_ZERO(&write_fdsets);
 
     // result = pipe(pipefd_);
     // ASSERT_RETURN(result == 0, -1, "create pipe failed.");
@@ -37,154 +37,132 @@ int NetSnoopServer::Run()
     result = StartListen();
     ASSERT_RETURN(result >= 0, -1, "start server error.");
 
-    high_resolution_clock::time_point start, end;
-    int64_t time_spend;
     while (true)
     {
-        if (timeout_ptr)
-        {
-            for (auto &peer : peers_)
-            {
-                end = high_resolution_clock::now();
-                time_spend = duration_cast<microseconds>(end - start).count();
-                if (time_spend > 0 && peer->GetTimeout() > 0)
-                    peer->Timeout(time_spend);
-                //ASSERT(result>=0);
-            }
-        }
+        // only the expired timers cost, no matter how many peers are connected.
+        context_->RunTimers();
 
         result = ProcessNextCommand();
         ASSERT(result == 0);
 
-        memcpy(&read_fdsets, &context_->read_fds, sizeof(read_fdsets));
-        memcpy(&write_fdsets, &context_->write_fds, sizeof(write_fdsets));
-        timeout_ptr = NULL;
-        time_microseconds = INT32_MAX;
-
-        for (auto &peer : peers_)
-        {
-            if (peer->GetTimeout() > 0 && time_microseconds > peer->GetTimeout())
-            {
-                time_microseconds = peer->GetTimeout();
-                timeout.tv_sec = time_microseconds / 1000000;
-                timeout.tv_usec = time_microseconds % 1000000;
-                timeout_ptr = &timeout;
-                start = high_resolution_clock::now();
-                LOGVP("Set timeout: %ld", time_microseconds);
-            }
-        }
-
-#ifdef _DEBUG
-        for (int i = 0; i < context_->max_fd + 1; i++)
-        {
-            if (FD_ISSET(i, &read_fdsets))
-            {
-                LOGVP("want read: %d", i);
-            }
-            if (FD_ISSET(i, &write_fdsets))
-            {
-                LOGVP("want write: %d", i);
-            }
-        }
-#endif
-        LOGVP("selecting...");
-        result = select(context_->max_fd + 1, &read_fdsets, &write_fdsets, NULL, timeout_ptr);
-        LOGVP("selected---------------");
-#ifdef _DEBUG
-        for (int i = 0; i < context_->max_fd + 1; i++)
-        {
-            if (FD_ISSET(i, &read_fdsets))
-            {
-                LOGVP("can read: %d", i);
-            }
-            if (FD_ISSET(i, &write_fdsets))
-            {
-                LOGVP("can write: %d", i);
-            }
-        }
-#endif
+        LOGVP("waiting...");
+        // the timers limit the wait time.
+        result = context_->Wait(-1);
+        LOGVP("waited---------------");
         if (result < 0)
         {
             // Todo: close socket
-            PSOCKETERROR("select error");
+            PSOCKETERROR("wait error");
             return -1;
         }
 
         if (result == 0)
         {
-            LOGVP("time out: %d", time_microseconds);
+            LOGVP("time out");
             continue;
         }
-        if (FD_ISSET(command_sock_read_->GetFd(), &read_fdsets))
+        if (context_->IsReadable(command_notifier_.GetFd()))
         {
             result = AcceptNewCommand();
             ASSERT_RETURN(result >= 0, -1, "accept new command error.");
         }
-        if (FD_ISSET(context_->control_fd, &read_fdsets))
+        if (context_->IsReadable(context_->control_fd))
         {
             result = AceeptNewConnect();
             ASSERT_RETURN(result >= 0, -1, "accept new connect error.");
         }
-        bool is_multicast_ready = true;
-        // process clients
-        for (auto it = peers_.begin(); it != peers_.end();)
+        if (tasks_ && context_->IsReadable(tasks_->GetFd()))
         {
-            result = 0;
-            auto peer = *it;
-            if (result >= 0 && FD_ISSET(peer->GetControlFd(), &write_fdsets))
-            {
-                result = peer->SendCommand();
-            }
-            if (result >= 0 && FD_ISSET(peer->GetControlFd(), &read_fdsets))
-            {
-                result = peer->RecvCommand();
-            }
-            if (peer->GetDataFd() > 0)
-            {
-                if (result >= 0 && FD_ISSET(peer->GetDataFd(), &write_fdsets))
-                {
-                    result = peer->SendData();
-                }
-                if (result >= 0 && FD_ISSET(peer->GetDataFd(), &read_fdsets))
-                {
-                    result = peer->RecvData();
-                }
-            }
-            if (result < 0)
-            {
-                LOGWP("client removed: %s", peer->GetCookie().c_str());
-                context_->ClrReadFd(peer->GetControlFd());
-                context_->ClrWriteFd(peer->GetControlFd());
-                if (peer->GetDataFd() > 0)
-                {
-                    context_->ClrReadFd(peer->GetDataFd());
-                    context_->ClrWriteFd(peer->GetDataFd());
-                }
-                peer->Stop();
-                it = peers_.erase(it);
-                if (result!=ERR_AUTH_ERROR&&OnPeerDisconnected)
-                    OnPeerDisconnected(peer.get());
-            }
-            else
-            {
-                if (peer->GetCommand())
-                    is_multicast_ready &= peer->IsPayloadStarted();
-                it++;
-            }
+            result = tasks_->Run();
+            ASSERT_RETURN(result >= 0, -1, "run server tasks error.");
         }
-        if (is_multicast_ready && current_command_ && current_command_->is_multicast && is_multicast_started_ == false)
+        // the shard shares the server context if it has no thread.
+        if (!tasks_)
+            shards_[0]->ProcessEvents();
+    }
+
+    return 0;
+}
+
+void NetSnoopServer::PostTask(TaskQueue::Task task)
+{
+    if (!tasks_)
+    {
+        task();
+        return;
+    }
+    tasks_->Push(task);
+}
+
+int NetSnoopServer::StartShards()
+{
+    int result;
+    int count = std::max(option_->shards, 1);
+    if (count > 1)
+    {
+        tasks_ = std::make_shared<TaskQueue>();
+        result = tasks_->Initialize();
+        ASSERT_RETURN(result >= 0, -1, "create server task queue error.");
+        context_->SetReadFd(tasks_->GetFd());
+    }
+    for (int i = 0; i < count; i++)
+    {
+        auto context = context_;
+        if (count > 1)
         {
-            is_multicast_started_ = true;
-            for (auto &&peer : peers_)
-            {
-                if (peer->GetDataFd() > 0 && peer->GetCommand())
-                {
-                    context_->SetWriteFd(peer->GetDataFd());
-                }
-            }
+            context = std::make_shared<Context>(option_->poll_mode);
         }
+        if (option_->io_engine == IoEngine::Uring)
+            context->SetUring(IoUring::Create());
+        if (option_->hugepage)
+            context->SetBufferPool(std::make_shared<BufferPool>(MAX_UDP_LENGTH, true));
+        auto shard = std::make_shared<Shard>(i, option_, context);
+        // the shard callbacks are called in the shard thread.
+        // the shard owns the peers, so post the copies of what the callbacks read only.
+        shard->OnPeerConnected = [this](std::shared_ptr<Peer> peer) {
+            auto info = peer->GetInfo();
+            PostTask([this, info]() {
+                ready_peers_count_++;
+                if (OnPeerConnected)
+                    OnPeerConnected(info);
+            });
+        };
+        shard->OnPeerDisconnected = [this](std::shared_ptr<Peer> peer) {
+            auto info = peer->GetInfo();
+            PostTask([this, info]() {
+                if (info.is_ready)
+                    ready_peers_count_--;
+                if (OnPeerDisconnected)
+                    OnPeerDisconnected(info);
+            });
+        };
+        shard->OnPeerStopped = [this](std::shared_ptr<Peer> peer, std::shared_ptr<NetStat> netstat) {
+            // the shard keeps merging the netstat too.
+            auto cookie = peer->GetCookie();
+            auto cmd = peer->GetCommand() ? peer->GetCommand()->GetCmd() : std::string();
+            auto stat = netstat ? std::make_shared<NetStat>(*netstat) : NULL;
+            PostTask([this, cookie, cmd, stat]() {
+                if (OnPeerStopped)
+                    OnPeerStopped(cookie, cmd, stat);
+            });
+        };
+        shard->OnMulticastReady = [this](Shard *shard) {
+            PostTask([this]() { OnShardMulticastReady(); });
+        };
+        shard->OnCommandStopped = [this](Shard *shard, const ShardResult &result) {
+            PostTask([this, result]() { OnShardCommandStopped(result); });
+        };
+        shard->OnCommandReported = [this](Shard *shard, int index, std::shared_ptr<NetStat> netstat) {
+            PostTask([this, index, netstat]() { OnShardCommandReported(index, netstat); });
+        };
+        if (count > 1)
+        {
+            result = shard->StartThread();
+            ASSERT_RETURN(result >= 0, -1);
+        }
+        shards_.push_back(shard);
     }
-
+    LOGDP("start shards: %d", count);
     return 0;
 }
 
@@ -201,28 +179,26 @@ int NetSnoopServer::StartListen()
 
     LOGDP("listen on(%d): %s:%d", listen_peers_sock_->GetFd(), option_->ip_local, option_->port);
 
-    context_->control_fd = listen_peers_sock_->GetFd();
-    context_->SetReadFd(listen_peers_sock_->GetFd());
+#ifndef WIN32
+    // every peer takes two fds, raise the soft limit to serve as many peers as possible.
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+            PSOCKETERROR("setrlimit RLIMIT_NOFILE error");
+    }
+#endif // !WIN32
 
-    command_sock_read_ = std::make_shared<Udp>();
-    result = command_sock_read_->Initialize();
-    ASSERT(result >= 0);
-    // auto select a port to create a local read udp.
-    result = command_sock_read_->Bind("127.0.0.1", 0);
-    ASSERT(result >= 0);
-    context_->SetReadFd(command_sock_read_->GetFd());
+    result = StartShards();
+    ASSERT_RETURN(result >= 0, -1, "start shards error.");
 
-    std::string ip;
-    int port;
-    result = command_sock_read_->GetLocalAddress(ip, port);
-    ASSERT(result >= 0);
+    context_->control_fd = listen_peers_sock_->GetFd();
+    context_->SetReadFd(listen_peers_sock_->GetFd());
 
-    command_sock_write_ = std::make_shared<Udp>();
-    result = command_sock_write_->Initialize();
-    ASSERT(result >= 0);
-    result = command_sock_write_->Connect(ip, port);
-    ASSERT(result >= 0);
-    LOGVP("create command socket: %s:%d", ip.c_str(), port);
+    result = command_notifier_.Initialize();
+    ASSERT_RETURN(result >= 0, -1, "create command notifier error.");
+    context_->SetReadFd(command_notifier_.GetFd());
 
     if (OnServerStart)
         OnServerStart(this);
@@ -241,6 +217,9 @@ int NetSnoopServer::AceeptNewConnect()
     std::string ip,ip_remote;
     int port,port_remote;
     auto tcp = std::make_shared<Tcp>(result);
+    // the control messages are queued if the peer is slow.
+    result = tcp->SetNonBlocking(true);
+    ASSERT_RETURN(result>=0,-1);
     result = tcp->GetLocalAddress(ip, port);
     ASSERT_RETURN(result>=0,-1);
     result = tcp->GetPeerAddress(ip_remote, port_remote);
@@ -258,155 +237,168 @@ int NetSnoopServer::AceeptNewConnect()
         ASSERT_RETURN(result >= 0, -1, "multicast socket connect server error.");
     }
 
-    auto peer = std::make_shared<Peer>(tcp, option_, context_);
-    peer->OnAuthSuccess = OnPeerConnected;
-    peer->multicast_sock_ = multicast_sock_;
-    peers_.push_back(peer);
-    return 0;
+    // serve the peer by the shard with the fewest peers.
+    auto shard = *std::min_element(shards_.begin(), shards_.end(), [](const std::shared_ptr<Shard> &a, const std::shared_ptr<Shard> &b) {
+        return a->GetPeersCount() < b->GetPeersCount();
+    });
+    std::shared_ptr<Sock> multicast_sock = multicast_sock_;
+    return shard->Post([shard, tcp, multicast_sock]() { shard->AddPeer(tcp, multicast_sock); });
 }
 
 int NetSnoopServer::PushCommand(std::shared_ptr<Command> command)
 {
-    int result;
-    std::unique_lock<std::mutex> lock(mtx);
     ASSERT_RETURN(command, -1);
-    commands_.push(command);
-    //result = write(pipefd_[1], command->GetCmd().c_str(), command->cmd.length());
-    result = command_sock_write_->Send(command->GetCmd().c_str(), command->GetCmd().length());
-    ASSERT_RETURN(result > 0, -1);
-    return 0;
+    commands_.Push(command);
+    return command_notifier_.Notify();
 }
 
 int NetSnoopServer::AcceptNewCommand()
 {
-    int result;
-    std::string cmd(MAX_CMD_LENGTH, 0);
-    // result = read(pipefd_[0], &cmd[0], cmd.length());
-    result = command_sock_read_->Recv(&cmd[0], cmd.length());
-    ASSERT_RETURN(result > 0, -1);
-    cmd.resize(result);
+    int result = command_notifier_.Clear();
+    ASSERT_RETURN(result >= 0, -1);
     return ProcessNextCommand();
 }
 
 int NetSnoopServer::ProcessNextCommand()
 {
-    if (is_running_ || commands_.empty())
+    std::shared_ptr<Command> command;
+    if (is_running_ || !commands_.Pop(command))
     {
         return 0;
     }
-    std::unique_lock<std::mutex> lock(mtx);
-    // when commands is empty, commands_.front() causes random segmentfault.
-    auto command = commands_.front();
-    commands_.pop();
-    lock.unlock();
 
-    int result;
-    auto ready_peers = &ready_peers_;
-    for (auto &peer : peers_)
-    {
-        if (peer->IsReady())
-            ready_peers->push_back(peer);
-    }
-
-    if (ready_peers->size() == 0)
+    if (ready_peers_count_ == 0)
     {
         ASSERT(command->GetCmd().length() > 3);
         command->InvokeCallback(NULL);
-        while (commands_.size() > 0)
+        while (commands_.Pop(command))
         {
-            command = commands_.front();
-            commands_.pop();
             command->InvokeCallback(NULL);
         }
         LOGDP("no client ready.");
         return 0;
     }
 
-    LOGIP("start command: %s (peers count = %ld)", command->GetCmd().c_str(), ready_peers->size());
-    // All the below variables should be captured by pointer value.
-    // The total ready peers count when we start a command.
-    auto peers_count = std::make_shared<int>(ready_peers->size());
-    // The failed peers when the command is running.
-    auto peers_failed = std::make_shared<int>(0);
-    // The actual peers that do send some data,only useful in multicast.
-    auto peers_active = std::make_shared<int>(0);
+    LOGIP("start command: %s (peers count = %d)", command->GetCmd().c_str(), ready_peers_count_);
     netstat_ = NULL;
-    is_multicast_started_ = false;
+    reports_.clear();
+    next_report_ = 0;
+    report_peers_ = ready_peers_count_;
+    stopped_shards_ = 0;
+    multicast_ready_shards_ = 0;
+    peers_count_ = 0;
+    peers_failed_ = 0;
+    peers_active_ = 0;
+    current_command_ = command;
+    is_running_ = true;
 
-    for (auto &peer : *ready_peers)
+    for (auto &shard : shards_)
     {
-        result = peer->SetCommand(command);
-        ASSERT(result == 0);
-        peer->OnStopped = [&, peer, command, ready_peers, peers_count, peers_failed, peers_active](const Peer *p, std::shared_ptr<NetStat> netstat) mutable {
-            ready_peers->remove_if([&p](std::shared_ptr<Peer> p1) { return p1.get() == p; });
-            LOGIP("stop command (%ld/%d): %s (%s)", (*peers_count - ready_peers->size()), *peers_count, command->GetCmd().c_str(), netstat ? netstat->ToString().c_str() : "NULL");
-            if (OnPeerStopped)
-                OnPeerStopped(p, netstat);
-            if (netstat)
-            {
-                netstat->max_send_time = netstat->send_time;
-                netstat->max_recv_time = netstat->recv_time;
-                netstat->min_send_time = netstat->send_time;
-                netstat->min_recv_time = netstat->recv_time;
-                netstat->max_send_speed = netstat->send_speed;
-                netstat->min_send_speed = netstat->send_speed;
-                netstat->send_avg_speed = netstat->send_speed;
-                netstat->recv_avg_speed = netstat->recv_speed;
-                if (!netstat_)
-                {
-                    netstat_ = netstat;
-                }
-                else
-                {
-                    *netstat_ += *netstat;
-                }
-                if (netstat->send_bytes > 0)
-                {
-                    (*peers_active)++;
-                }
-            }
-            else
-            {
-                (*peers_failed)++;
-            }
-            if (ready_peers->size() > 0)
-            {
-                peer->OnStopped = NULL;
-                return;
-            }
-            LOGIP("command total : %s || %s", command->GetCmd().c_str(), netstat_ ? netstat_->ToString().c_str() : "NULL");
-            is_running_ = false;
-            if (netstat_ != NULL)
-            {
-                auto success_count = *peers_count - *peers_failed;
-                ASSERT(success_count > 0);
-                ASSERT(*peers_active > 0);
-                netstat_->send_time /= *peers_active;
-                netstat_->loss /= *peers_active;
-                netstat_->send_avg_speed /= *peers_active;
-                netstat_->recv_avg_speed /= success_count;
-                netstat_->recv_time /= success_count;
-                netstat_->delay /= success_count;
-                if (command->is_multicast)
-                {
-                    netstat_->loss = 1 - 1.0 * netstat_->recv_bytes / (netstat_->send_bytes * success_count);
-                    netstat_->max_send_speed = netstat_->send_speed;
-                    netstat_->min_send_speed = netstat_->send_speed;
-                }
-
-                netstat_->peers_count = *peers_count;
-                netstat_->peers_failed = *peers_failed;
-            }
-            LOGIP("command finish: %s || %s", command->GetCmd().c_str(), netstat_ ? netstat_->ToString().c_str() : "NULL");
-            command->InvokeCallback(netstat_);
-            current_command_ = NULL;
-            peer->OnStopped = NULL;
-        };
-        result = peer->Start();
-        ASSERT(result == 0);
+        shard->Post([shard, command]() { shard->StartCommand(command); });
     }
-    current_command_ = command;
-    is_running_ = true;
 
     return 0;
 }
+
+void NetSnoopServer::OnShardMulticastReady()
+{
+    if (++multicast_ready_shards_ < shards_.size())
+        return;
+    // all the peers are ready, start multicast together.
+    for (auto &shard : shards_)
+    {
+        shard->Post([shard]() { shard->StartMulticast(); });
+    }
+}
+
+void NetSnoopServer::OnShardCommandStopped(const ShardResult &result)
+{
+    ASSERT(current_command_);
+    auto command = current_command_;
+    peers_count_ += result.peers_count;
+    peers_failed_ += result.peers_failed;
+    peers_active_ += result.peers_active;
+    if (result.netstat)
+    {
+        if (!netstat_)
+            netstat_ = result.netstat;
+        else
+            *netstat_ += *result.netstat;
+    }
+    if (++stopped_shards_ < shards_.size())
+        return;
+
+    // the reports of the failed peers never come.
+    FlushReports(INT_MAX);
+    LOGIP("command total : %s || %s", command->GetCmd().c_str(), netstat_ ? netstat_->ToString().c_str() : "NULL");
+    is_running_ = false;
+    if (netstat_ != NULL)
+    {
+        auto success_count = peers_count_ - peers_failed_;
+        ASSERT(success_count > 0);
+        ASSERT(peers_active_ > 0);
+        netstat_->send_time /= peers_active_;
+        netstat_->loss /= peers_active_;
+        netstat_->send_avg_speed /= peers_active_;
+        netstat_->send_batch /= peers_active_;
+        netstat_->zerocopy_delay_us /= peers_active_;
+        netstat_->pacing_error_us /= peers_active_;
+        netstat_->recv_avg_speed /= success_count;
+        netstat_->recv_time /= success_count;
+        netstat_->delay /= success_count;
+        netstat_->jitter_rfc3550_us /= success_count;
+        if (command->is_multicast)
+        {
+            netstat_->loss = 1 - 1.0 * netstat_->recv_bytes / (netstat_->send_bytes * success_count);
+            netstat_->max_send_speed = netstat_->send_speed;
+            netstat_->min_send_speed = netstat_->send_speed;
+        }
+
+        netstat_->peers_count = peers_count_;
+        netstat_->peers_failed = peers_failed_;
+    }
+    LOGIP("command finish: %s || %s", command->GetCmd().c_str(), netstat_ ? netstat_->ToString().c_str() : "NULL");
+    current_command_ = NULL;
+    command->InvokeCallback(netstat_);
+}
+
+void NetSnoopServer::OnShardCommandReported(int index, std::shared_ptr<NetStat> netstat)
+{
+    // the late ones of a flushed interval are dropped.
+    if (!current_command_ || index < next_report_)
+        return;
+    netstat->max_recv_speed = netstat->recv_speed;
+    netstat->min_recv_speed = netstat->recv_speed;
+    netstat->recv_avg_speed = netstat->recv_speed;
+    auto &report = reports_[index];
+    if (!report.first)
+        report.first = netstat;
+    else
+        *report.first += *netstat;
+    report.second++;
+    FlushReports(index);
+}
+
+void NetSnoopServer::FlushReports(int latest)
+{
+    // an interval is complete when all the peers report it, or the latest report is two intervals later.
+    while (!reports_.empty())
+    {
+        auto it = reports_.begin();
+        auto index = it->first;
+        auto netstat = it->second.first;
+        auto count = it->second.second;
+        if (count < report_peers_ && index + 2 > latest)
+            return;
+        netstat->loss /= count;
+        netstat->delay /= count;
+        netstat->recv_avg_speed /= count;
+        netstat->recv_time /= count;
+        netstat->peers_count = count;
+        next_report_ = index + 1;
+        reports_.erase(it);
+        LOGIP("command report: %s || index %d %s", current_command_->GetCmd().c_str(), index, netstat->ToString().c_str());
+        if (OnCommandReported)
+            OnCommandReported(current_command_.get(), index, netstat);
+    }
+}
@@ -1,13 +1,15 @@
 #pragma once
 
 #include <list>
-#include <queue>
-#include <mutex>
+#include <map>
+#include <vector>
 
 #include "command.h"
 #include "tcp.h"
 #include "udp.h"
 #include "peer.h"
+#include "shard.h"
+#include "task_queue.h"
 
 #define CMD_ILLEGAL "command illegal."
 
@@ -16,8 +18,10 @@ class NetSnoopServer
 public:
     NetSnoopServer(std::shared_ptr<Option> option)
         :option_(option),
-        context_(std::make_shared<Context>()),
-        is_running_(false),is_multicast_started_(false)
+        context_(std::make_shared<Context>(option->poll_mode)),
+        is_running_(false),ready_peers_count_(0),stopped_shards_(0),multicast_ready_shards_(0),
+        next_report_(0),report_peers_(0),
+        peers_count_(0),peers_failed_(0),peers_active_(0)
         {}
     /**
      * @brief Start the server, it will stuck here.
@@ -36,15 +40,44 @@ public:
     int PushCommand(std::shared_ptr<Command> command);
 
     std::function<void(const NetSnoopServer* server)> OnServerStart;
-    std::function<void(const Peer*)> OnPeerConnected;
-    std::function<void(const Peer*)> OnPeerDisconnected;
-    std::function<void(const Peer*,std::shared_ptr<NetStat>)> OnPeerStopped;
+    /**
+     * @brief A peer connects or disconnects, with a copy of its identity.
+     * 
+     */
+    std::function<void(const PeerInfo &)> OnPeerConnected;
+    std::function<void(const PeerInfo &)> OnPeerDisconnected;
+    /**
+     * @brief A peer stops the command, with the peer cookie, the command and a copy of its result.
+     * 
+     */
+    std::function<void(const std::string &, const std::string &, std::shared_ptr<NetStat>)> OnPeerStopped;
+    /**
+     * @brief The interim reports of the peers for a report interval are merged.
+     * 
+     */
+    std::function<void(const Command*,int,std::shared_ptr<NetStat>)> OnCommandReported;
 
 private:
     int StartListen();
     int AceeptNewConnect();
     int AcceptNewCommand();
     int ProcessNextCommand();
+    int StartShards();
+    /**
+     * @brief Run task on the server loop thread, run it right now if there is no shard thread.
+     * 
+     * @param task 
+     */
+    void PostTask(TaskQueue::Task task);
+    void OnShardCommandStopped(const ShardResult &result);
+    void OnShardMulticastReady();
+    void OnShardCommandReported(int index, std::shared_ptr<NetStat> netstat);
+    /**
+     * @brief Report the complete intervals in order, all of them if latest is INT_MAX.
+     * 
+     * @param latest the latest report index received.
+     */
+    void FlushReports(int latest);
 
     std::shared_ptr<Option> option_;
     std::shared_ptr<Context> context_;
@@ -54,15 +87,10 @@ private:
      */
     std::shared_ptr<Sock> listen_peers_sock_;
     /**
-     * @brief The socket to read test command.
-     * 
-     */
-    std::shared_ptr<Udp> command_sock_read_;
-    /**
-     * @brief The socket to wake select up to begin a new command.
+     * @brief To wake the loop up to begin a new command.
      * 
      */
-    std::shared_ptr<Udp> command_sock_write_;
+    Notifier command_notifier_;
     /**
      * @brief The socket for multicast testing.
      * 
@@ -70,27 +98,40 @@ private:
     std::shared_ptr<Udp> multicast_sock_;
 
     /**
-     * @brief All connected peers, no matter auth or not.
+     * @brief The shards serving the peers, there is only one shard driven by
+     *  the server loop if the server is not sharded.
+     * 
+     */
+    std::vector<std::shared_ptr<Shard>> shards_;
+    /**
+     * @brief The tasks posted by the shard threads.
      * 
      */
-    std::list<std::shared_ptr<Peer>> peers_;
+    std::shared_ptr<TaskQueue> tasks_;
     /**
-     * @brief The authed peers.
+     * @brief The pushed commands, any thread can push without lock.
      * 
      */
-    std::list<std::shared_ptr<Peer>> ready_peers_;
-    std::queue<std::shared_ptr<Command>> commands_;
+    MpscQueue<std::shared_ptr<Command>> commands_;
     std::shared_ptr<Command> current_command_;
     std::shared_ptr<NetStat> netstat_;
     /**
-     * @brief To sync commands read and write.
+     * @brief The merged interim reports by report index, and the peers count of each.
      * 
      */
-    std::mutex mtx;
-    //int pipefd_[2];
+    std::map<int, std::pair<std::shared_ptr<NetStat>, int>> reports_;
+    // the first report index not flushed yet.
+    int next_report_;
+    // the peers which should report, the ready ones when the command starts.
+    int report_peers_;
 
     bool is_running_;
-    bool is_multicast_started_;
+    int ready_peers_count_;
+    int stopped_shards_;
+    int multicast_ready_shards_;
+    int peers_count_;
+    int peers_failed_;
+    int peers_active_;
 
     DISALLOW_COPY_AND_ASSIGN(NetSnoopServer);
 };
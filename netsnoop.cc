@@ -9,6 +9,7 @@
 
 void StartClient();
 void StartServer();
+int ResolveOptions(int argc, char *argv[]);
 
 auto g_option = std::make_shared<Option>();
 
@@ -20,6 +21,7 @@ auto g_option = std::make_shared<Option>();
  */
 int main(int argc, char *argv[])
 {
+    argc = ResolveOptions(argc, argv);
     if (argc < 2 || !strcmp(argv[1], "-h"))
     {
         std::cout << "usage: \n"
@@ -31,6 +33,14 @@ int main(int argc, char *argv[])
                      "  send count 1000                     (test unicast)\n"
                      "  send count 1000 multicast true      (test multicast)\n"
                      "  send speed 500 time 3000            (test unicast)\n"
+                     "  --------\n"
+                     "  options:\n"
+                     "  --poll <select|epoll>               (event loop backend)\n"
+                     "  --io <sock|uring>                   (data socket io engine)\n"
+                     "  --shards <num>                      (server event loop threads)\n"
+                     "  --gro <on|off>                      (client udp receive offload)\n"
+                     "  --hugepage <on|off>                 (huge pages for packet buffers)\n"
+                     "  --control <binary|text>             (control protocol)\n"
                      "  \n"
                      "  version: "
                   << VERSION(v) << " (" << __DATE__ << " " << __TIME__ << ")" << std::endl;
@@ -64,6 +74,8 @@ int main(int argc, char *argv[])
     if (argc > 4)
     {
         Logger::SetGlobalLogLevel(LogLevel(LLERROR - strlen(argv[4]) + 1));
+        if (Logger::GetGlobalLogLevel() < LOG_MIN_LEVEL)
+            std::cerr << "the logs below level " << LOG_MIN_LEVEL << " are removed from this build." << std::endl;
     }
 
     if (argc > 1)
@@ -81,6 +93,81 @@ int main(int argc, char *argv[])
     return 0;
 }
 
+/**
+ * @brief resolve the '--name value' options and remove them from argv.
+ * 
+ * @return int the count of the remaining arguments.
+ */
+int ResolveOptions(int argc, char *argv[])
+{
+    int count = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) || i + 1 >= argc)
+        {
+            argv[count++] = argv[i];
+            continue;
+        }
+        std::string name = argv[i] + 2;
+        std::string value = argv[++i];
+        if (name == "poll")
+        {
+            if (value == "select")
+                g_option->poll_mode = PollMode::Select;
+            else if (value == "epoll")
+                g_option->poll_mode = PollMode::Epoll;
+            else
+                std::clog << "unknown poll mode: " << value << std::endl;
+        }
+        else if (name == "io")
+        {
+            if (value == "sock")
+                g_option->io_engine = IoEngine::Sock;
+            else if (value == "uring")
+                g_option->io_engine = IoEngine::Uring;
+            else
+                std::clog << "unknown io engine: " << value << std::endl;
+        }
+        else if (name == "shards")
+        {
+            g_option->shards = std::max(atoi(value.c_str()), 1);
+        }
+        else if (name == "gro")
+        {
+            if (value == "on")
+                g_option->gro = true;
+            else if (value == "off")
+                g_option->gro = false;
+            else
+                std::clog << "unknown gro mode: " << value << std::endl;
+        }
+        else if (name == "hugepage")
+        {
+            if (value == "on")
+                g_option->hugepage = true;
+            else if (value == "off")
+                g_option->hugepage = false;
+            else
+                std::clog << "unknown hugepage mode: " << value << std::endl;
+        }
+        else if (name == "control")
+        {
+            if (value == "binary")
+                g_option->binary_control = true;
+            else if (value == "text")
+                g_option->binary_control = false;
+            else
+                std::clog << "unknown control protocol: " << value << std::endl;
+        }
+        else
+        {
+            std::clog << "unknown option: --" << name << std::endl;
+        }
+    }
+    argv[count] = NULL;
+    return count;
+}
+
 void StartClient()
 {
     NetSnoopClient client(g_option);
@@ -117,18 +204,21 @@ void StartServer()
 
     int count = 0;
     NetSnoopServer server(g_option);
-    server.OnPeerConnected = [&](const Peer *peer) {
+    server.OnPeerConnected = [&](const PeerInfo &peer) {
         count++;
-        std::clog << "peer connect(" << count << "): " << peer->GetCookie() << std::endl;
+        std::clog << "peer connect(" << count << "): " << peer.cookie << std::endl;
     };
-    server.OnPeerDisconnected = [&](const Peer *peer) {
+    server.OnPeerDisconnected = [&](const PeerInfo &peer) {
         count--;
-        std::clog << "peer disconnect(" << count << "): " << peer->GetCookie() << std::endl;
+        std::clog << "peer disconnect(" << count << "): " << peer.cookie << std::endl;
     };
-    server.OnPeerStopped = [&](const Peer *peer, std::shared_ptr<NetStat> netstat) {
-        std::clog << "peer stoped: (" << peer->GetCookie() << ") " << peer->GetCommand()->GetCmd().c_str()
+    server.OnPeerStopped = [&](const std::string &cookie, const std::string &cmd, std::shared_ptr<NetStat> netstat) {
+        std::clog << "peer stoped: (" << cookie << ") " << cmd
                   << " || " << (netstat ? netstat->ToString() : "NULL") << std::endl;
     };
+    server.OnCommandReported = [&](const Command *command, int index, std::shared_ptr<NetStat> netstat) {
+        std::cout << "command report: " << command->GetCmd() << " || index " << index << " " << netstat->ToString() << std::endl;
+    };
     auto t = std::thread([&]() {
         LOGVP("server running...");
         server.Run();
@@ -13,6 +13,8 @@
 #include <algorithm>
 #include <iomanip>
 
+#include "async_logger.h"
+
 #define TAG "NETSNOOP"
 
 #ifndef BUILD_VERSION
@@ -32,6 +34,11 @@ enum LogLevel
     LLERROR = 4
 };
 
+// the logs below this level are removed at compile time, whatever the runtime level is.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LLVERBOSE
+#endif // !LOG_MIN_LEVEL
+
 class Logger
 {
 public:
@@ -88,7 +95,8 @@ public:
     
     static bool ShouldPrintLog(LogLevel level)
     {
-        return GetGlobalLogLevel()<=level;
+        // a constant level below LOG_MIN_LEVEL folds to false, so the log site is compiled out.
+        return LOG_MIN_LEVEL<=level && GetGlobalLogLevel()<=level;
     }
 
     /**
@@ -136,11 +144,15 @@ private:
 #define LOGW LOG(LLWARN).GetStream()
 #define LOGE LOG(LLERROR).GetStream()
 
-#define LOGVP(...) LOG(LLVERBOSE).Print(__VA_ARGS__)
-#define LOGDP(...) LOG(LLDEBUG).Print(__VA_ARGS__)
-#define LOGIP(...) LOG(LLINFO).Print(__VA_ARGS__)
-#define LOGWP(...) LOG(LLWARN).Print(__VA_ARGS__)
-#define LOGEP(...) LOG(LLERROR).Print(__VA_ARGS__)
+// the printf style logs are recorded in binary and formatted by a background thread.
+// it is one expression, so it is safe in an if-else without braces.
+#define LOGP(level,...) ((!Logger::ShouldPrintLog(level)) ? (void)0 : AsyncLogger::Log(level,"[" __FILE__ ":" __S(__LINE__) "] ",__VA_ARGS__))
+
+#define LOGVP(...) LOGP(LLVERBOSE,__VA_ARGS__)
+#define LOGDP(...) LOGP(LLDEBUG,__VA_ARGS__)
+#define LOGIP(...) LOGP(LLINFO,__VA_ARGS__)
+#define LOGWP(...) LOGP(LLWARN,__VA_ARGS__)
+#define LOGEP(...) LOGP(LLERROR,__VA_ARGS__)
 
 #ifdef _DEBUG
     #define ASSERT(expr) assert(expr)
@@ -168,6 +180,8 @@ private:
 #define ERR_DEFAULT -1
 #define ERR_SOCKET_CLOSED -2
 #define ERR_TIMEOUT -3
+// the socket buffer is full, try again when it is writable.
+#define ERR_WOULD_BLOCK -4
 #define ERR_ILLEGAL_DATA -5
 #define ERR_AUTH_ERROR -6
 #define ERR_OTHER -99
@@ -181,15 +195,62 @@ private:
 
 #define MAX_CLINETS 500
 #define MAX_SENDERS 10
-#define MAX_SEQ (1UL<<16)
+
+/**
+ * @brief The backend used by the event loops to wait fds.
+ * 
+ */
+enum class PollMode
+{
+    Select,
+    Epoll
+};
+
+#ifdef __linux__
+#define DEFAULT_POLL_MODE PollMode::Epoll
+#else
+#define DEFAULT_POLL_MODE PollMode::Select
+#endif // __linux__
+
+/**
+ * @brief The engine used to do the io of the data sockets.
+ * 
+ */
+enum class IoEngine
+{
+    Sock,
+    Uring
+};
 
 struct Option
 {
-    Option():ip_local{0},ip_remote{0},ip_multicast{0},port{0}{}
+    Option():ip_local{0},ip_remote{0},ip_multicast{0},port{0},poll_mode(DEFAULT_POLL_MODE),io_engine(IoEngine::Sock),shards(1),gro(false),hugepage(false),binary_control(true){}
     char ip_local[20];
     char ip_remote[20];
     char ip_multicast[20];
     int port;
+    PollMode poll_mode;
+    IoEngine io_engine;
+    /**
+     * @brief The event loop threads count of server to serve the peers.
+     * 
+     */
+    int shards;
+    /**
+     * @brief Let the kernel coalesce the datagrams received by client (UDP GRO).
+     * 
+     */
+    bool gro;
+    /**
+     * @brief Back the packet buffer pools by huge pages.
+     * 
+     */
+    bool hugepage;
+    /**
+     * @brief Speak the binary control protocol if the peer can, text otherwise.
+     * 
+     */
+    bool binary_control;
 };
 
 class Tools
@@ -197,12 +258,28 @@ class Tools
 public:
     static std::string GetDataSum(const std::string& data,size_t length=64)
     {
-        std::ostringstream out;
-        auto count = std::min(data.length(),length);
+        return GetDataSum(data.c_str(),data.length(),length);
+    }
+    static std::string GetDataSum(const char* data,size_t size,size_t length=64)
+    {
+        std::string out(std::min(size,length),'.');
+        GetDataSum(data,size,&out[0],out.length()+1);
+        return out;
+    }
+    /**
+     * @brief Write the printable preview of data into out without any allocation.
+     * 
+     * @param out_size the bytes of out including the terminating null.
+     * @return const char* out
+     */
+    static const char* GetDataSum(const char* data,size_t size,char* out,size_t out_size)
+    {
+        auto count = std::min(size,out_size-1);
         for(size_t i = 0;i<count;i++)
         {
-            out<< (isprint(data[i])?data[i]:'.');
+            out[i] = isprint(data[i])?data[i]:'.';
         }
-        return out.str();
+        out[count] = '\0';
+        return out;
     }
 };
@@ -67,16 +67,16 @@ void StartServer()
 {
     static int count = 0;
     auto server = std::make_shared<NetSnoopServer>(g_option);
-    server->OnPeerConnected = [&](const Peer *peer) {
+    server->OnPeerConnected = [&](const PeerInfo &peer) {
         count++;
-        std::cout << "peer connect(" << count << "): " << peer->GetCookie() << std::endl;
+        std::cout << "peer connect(" << count << "): " << peer.cookie << std::endl;
     };
-    server->OnPeerDisconnected = [&](const Peer *peer) {
+    server->OnPeerDisconnected = [&](const PeerInfo &peer) {
         count--;
-        std::cout << "peer disconnect(" << count << "): " << peer->GetCookie() << std::endl;
+        std::cout << "peer disconnect(" << count << "): " << peer.cookie << std::endl;
     };
-    server->OnPeerStopped = [&](const Peer *peer, std::shared_ptr<NetStat> netstat) {
-        std::cout << "peer stoped: (" << peer->GetCookie() << ") " << peer->GetCommand()->GetCmd().c_str()
+    server->OnPeerStopped = [&](const std::string &cookie, const std::string &cmd, std::shared_ptr<NetStat> netstat) {
+        std::cout << "peer stoped: (" << cookie << ") " << cmd
                   << " || " << (netstat ? netstat->ToString() : "NULL") << std::endl;
     };
     auto server_thread = std::thread([server]() {
@@ -15,6 +15,7 @@
 void RunTest(NetSnoopServer *server, int);
 void StartClients(int count, bool join);
 void StartServer();
+int RunUnitTests();
 
 std::vector<std::string> cmds{
     "ping",
@@ -26,7 +27,13 @@ std::vector<std::string> cmds{
     "send count 1000 interval 1 size 1024",
     "send count 1000 interval 0 size 8096",
     "send count 10000 interval 0 size 12024",
-    "send count 1000 interval 1 size 20240"};
+    "send count 1000 interval 1 size 20240",
+    "send count 10000 interval 0 size 1024 batch 32",
+    "send count 10000 interval 0 size 1024 gso 32",
+    "send count 10000 interval 0 size 1024 batch 8 budget 256",
+    "send count 1000 interval 0 size 65000 zerocopy true",
+    "send speed 1000 time 1000 batch 16 pacing txtime",
+    "send speed 1000 time 1000 report 100"};
 
 std::shared_ptr<Option> g_option = std::make_shared<Option>();
 int main(int argc, char *argv[])
@@ -67,6 +74,10 @@ int main(int argc, char *argv[])
         {
             StartClients(10,true);
         }
+        else if (!strcmp(argv[1], "-u"))
+        {
+            return RunUnitTests() ? 1 : 0;
+        }
         return 0;
     }
 
@@ -78,7 +89,7 @@ int main(int argc, char *argv[])
     std::condition_variable cv;
 
     NetSnoopServer server(g_option);
-    server.OnPeerConnected = [&](const Peer *peer) {
+    server.OnPeerConnected = [&](const PeerInfo &peer) {
         std::unique_lock<std::mutex> lock;
         client_count++;
         // All client has connected.
@@ -138,19 +149,13 @@ void StartServer()
 {
     static int count = 0;
     std::shared_ptr<NetSnoopServer> server = std::make_shared<NetSnoopServer>(g_option);
-    server->OnPeerConnected = [&](const Peer *peer) {
+    server->OnPeerConnected = [&](const PeerInfo &peer) {
         count++;
-        std::string ip;
-        int port;
-        peer->GetControlSock()->GetPeerAddress(ip,port);
-        std::clog << "peer connect: [" << count <<"]: "<<ip.c_str()<<":"<<port<< std::endl;
+        std::clog << "peer connect: [" << count <<"]: "<<peer.ip.c_str()<<":"<<peer.port<< std::endl;
     };
-    server->OnPeerDisconnected = [&](const Peer* peer){
+    server->OnPeerDisconnected = [&](const PeerInfo &peer){
         count--;
-        std::string ip;
-        int port;
-        peer->GetControlSock()->GetPeerAddress(ip,port);
-        std::clog << "peer disconnect: [" << count <<"]: "<<ip.c_str()<<":"<<port<< std::endl;
+        std::clog << "peer disconnect: [" << count <<"]: "<<peer.ip.c_str()<<":"<<peer.port<< std::endl;
     };
     auto thread = std::thread([&] {
         LOGVP("start server.");
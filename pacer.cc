@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "pacer.h"
+
+using namespace std::chrono;
+
+Pacer::Pacer()
+    : interval_(0), sent_(0), measured_(0), total_error_(0), max_error_(0), departure_base_(0),
+      is_started_(false), is_offloaded_(false) {}
+
+void Pacer::Start(int64_t interval, bool is_offloaded)
+{
+    start_ = steady_clock::now();
+    interval_ = std::max<int64_t>(interval, 0);
+    sent_ = 0;
+    measured_ = 0;
+    total_error_ = 0;
+    max_error_ = 0;
+    departure_base_ = 0;
+    is_started_ = true;
+    is_offloaded_ = is_offloaded;
+}
+
+int64_t Pacer::GetDueCount(int64_t ahead) const
+{
+    if (interval_ == 0)
+        return INT32_MAX;
+    auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start_).count() + ahead;
+    return std::max<int64_t>(elapsed / interval_ + 1 - sent_, 0);
+}
+
+steady_clock::time_point Pacer::GetNextDeadline(int count) const
+{
+    return start_ + nanoseconds((sent_ + std::max(count, 1) - 1) * interval_);
+}
+
+void Pacer::OnSent(int count)
+{
+    if (interval_ == 0 || is_offloaded_)
+    {
+        sent_ += count;
+        return;
+    }
+    auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start_).count();
+    for (int i = 0; i < count; i++, sent_++)
+    {
+        // the packets sent ahead of their deadlines count as the errors too.
+        auto error = std::abs(elapsed - sent_ * interval_);
+        total_error_ += error;
+        max_error_ = std::max(max_error_, error);
+    }
+    measured_ += count;
+}
+
+void Pacer::OnDeparted(int64_t index, int64_t timestamp)
+{
+    if (interval_ == 0)
+        return;
+    if (measured_ == 0)
+        departure_base_ = timestamp - index * interval_;
+    auto error = std::abs(timestamp - departure_base_ - index * interval_);
+    total_error_ += error;
+    max_error_ = std::max(max_error_, error);
+    measured_++;
+}
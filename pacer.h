@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+
+#include "netsnoop.h"
+
+/**
+ * @brief Schedule the packets departure on absolute deadlines, start + n * interval,
+ *  so the late wakeups are caught up instead of accumulated.
+ *
+ */
+class Pacer
+{
+public:
+    Pacer();
+
+    /**
+     * @brief Start pacing from now.
+     *
+     * @param interval in nanoseconds, 0 means no pacing.
+     * @param is_offloaded the kernel paces the packets, so the errors are measured by OnDeparted.
+     */
+    void Start(int64_t interval, bool is_offloaded = false);
+    /**
+     * @brief Get the packets count whose deadlines have passed but are not sent.
+     *
+     * @param ahead count the packets due in this nanoseconds too.
+     * @return int64_t
+     */
+    int64_t GetDueCount(int64_t ahead = 0) const;
+    /**
+     * @brief Get the time when the next count packets are all due.
+     *
+     * @param count
+     * @return std::chrono::steady_clock::time_point
+     */
+    std::chrono::steady_clock::time_point GetNextDeadline(int count = 1) const;
+    /**
+     * @brief Record the departure of the next count packets.
+     *
+     * @param count
+     */
+    void OnSent(int count);
+    /**
+     * @brief Record the time when the packet index left, which is reported by kernel.
+     *  The schedule is anchored at the first reported departure.
+     *
+     * @param index
+     * @param timestamp in nanoseconds.
+     */
+    void OnDeparted(int64_t index, int64_t timestamp);
+
+    bool IsStarted() const { return is_started_; }
+    /**
+     * @brief Get the average departure error in nanoseconds.
+     *
+     * @return int64_t
+     */
+    int64_t GetError() const { return measured_ > 0 ? total_error_ / measured_ : 0; }
+    int64_t GetMaxError() const { return max_error_; }
+    /**
+     * @brief Get the packets count whose departure errors are measured.
+     *
+     * @return int64_t
+     */
+    int64_t GetMeasuredCount() const { return measured_; }
+    int64_t GetInterval() const { return interval_; }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+    int64_t interval_;
+    int64_t sent_;
+    int64_t measured_;
+    int64_t total_error_;
+    int64_t max_error_;
+    // the departure time of the first reported packet minus its schedule offset.
+    int64_t departure_base_;
+    bool is_started_;
+    bool is_offloaded_;
+
+    DISALLOW_COPY_AND_ASSIGN(Pacer);
+};
@@ -1,5 +1,6 @@
 
 #include <thread>
+#include <mutex>
 
 #include "command.h"
 #include "netsnoop.h"
@@ -7,16 +8,26 @@
 #include "tcp.h"
 #include "command_sender.h"
 #include "context2.h"
+#include "uring.h"
 #include "peer.h"
 
 Peer::Peer(std::shared_ptr<Sock> control_sock, std::shared_ptr<Option> option, std::shared_ptr<Context> context)
-    : control_sock_(control_sock), option_(option), context_(context)
+    : control_sock_(control_sock), control_(std::make_shared<ControlChannel>(control_sock)), option_(option), context_(context)
 {
     // keep control channel readable even no any data want to read,
     // because we use read to detect client disconnect.
     context_->SetReadFd(control_sock_->GetFd());
 }
 
+PeerInfo Peer::GetInfo() const
+{
+    PeerInfo info;
+    info.cookie = cookie_;
+    control_sock_->GetPeerAddress(info.ip, info.port);
+    info.is_ready = IsReady();
+    return info;
+}
+
 int Peer::Start()
 {
     ASSERT_RETURN(commandsender_, -1);
@@ -48,15 +59,15 @@ int Peer::RecvCommand()
     if(!commandsender_)
     {
         ASSERT_RETURN(control_sock_,-1);
-        std::string buf(MAX_UDP_LENGTH,'\0');
-        int result = control_sock_->Recv(&buf[0],buf.length());
+        auto buf = context_->GetBufferPool().Get();
+        ASSERT_RETURN(buf,-1);
+        int result = control_sock_->Recv(buf.data(),buf.size());
         if(result<=0) 
         {
             LOGWP("recv command error(%d)",control_sock_->GetFd());
             return -1;
         }
-        buf.resize(result);
-        LOGWP("recv illegal command(%d): %s",control_sock_->GetFd(),Tools::GetDataSum(buf).c_str());
+        LOGWP("recv illegal command(%d): %s",control_sock_->GetFd(),Tools::GetDataSum(buf.data(),result).c_str());
         return -1;
     }
     return commandsender_->RecvCommand();
@@ -75,15 +86,18 @@ int Peer::RecvData()
     if(!commandsender_)
     {
         ASSERT_RETURN(data_sock_,-1);
-        std::string buf(MAX_UDP_LENGTH,'\0');
-        int result = data_sock_->Recv(&buf[0],buf.length());
+        auto buf = context_->GetBufferPool().Get();
+        ASSERT_RETURN(buf,-1);
+        int result = data_sock_->Recv(buf.data(),buf.size());
+        // nothing to read on the non-blocking socket.
+        if(result==ERR_TIMEOUT)
+            return 0;
         if(result<=0) 
         {
             LOGWP("recv data error(%d)",data_sock_->GetFd());
             return -1;
         }
-        buf.resize(result);
-        LOGWP("recv out of command data(%d): %s",data_sock_->GetFd(),Tools::GetDataSum(buf).c_str());
+        LOGWP("recv out of command data(%d): %s",data_sock_->GetFd(),Tools::GetDataSum(buf.data(),result).c_str());
         return 0;
     }
     return commandsender_->RecvData();
@@ -92,19 +106,32 @@ int Peer::RecvData()
 int Peer::Auth()
 {
     int result;
-    std::string buf(MAX_UDP_LENGTH, '\0');
-    if ((result = control_sock_->Recv(&buf[0], buf.length())) <= 0)
+    std::string buf;
     {
-        LOGEP("Disconnect.");
-        return ERR_AUTH_ERROR;
+        auto recv_buf = context_->GetBufferPool().Get();
+        ASSERT_RETURN(recv_buf, ERR_AUTH_ERROR);
+        if ((result = control_sock_->Recv(recv_buf.data(), recv_buf.size())) <= 0)
+        {
+            LOGEP("Disconnect.");
+            return ERR_AUTH_ERROR;
+        }
+        buf.assign(recv_buf.data(), result);
     }
-    buf.resize(result);
 
     if (buf.rfind("cookie:", 0) != 0)
     {
         LOGEP("Bad client.");
         return ERR_AUTH_ERROR;
     }
+    // the client which can speak binary appends the protocol version to the cookie.
+    auto option = buf.find(CONTROL_COOKIE_OPTION);
+    if (option != std::string::npos)
+    {
+        auto version = atoi(buf.substr(option + sizeof(CONTROL_COOKIE_OPTION) - 1).c_str());
+        control_->SetBinary(option_->binary_control && version >= 1);
+        buf.erase(option);
+    }
+    LOGDP("use %s control protocol(%d).", control_->IsBinary() ? "binary" : "text", control_sock_->GetFd());
     cookie_ = buf;
     std::string local_ip;
     int local_port;
@@ -123,13 +150,19 @@ int Peer::Auth()
     // TODO: support NAT environment.
     ASSERT_RETURN(peer_ip==remote_ip,ERR_AUTH_ERROR,"support test on the same network only.");
 
-    data_sock_ = std::make_shared<Udp>();
+    data_sock_ = UringUdp::New(context_->GetUring());
     result = data_sock_->Initialize();
     ASSERT_RETURN(result >= 0,ERR_AUTH_ERROR);
     result = data_sock_->Bind(local_ip, local_port);
     ASSERT_RETURN(result >= 0,ERR_AUTH_ERROR);
     result = data_sock_->Connect(peer_ip, peer_port);
     ASSERT_RETURN(result >= 0,ERR_AUTH_ERROR);
+    // a slow peer should never block the shard.
+    result = data_sock_->SetNonBlocking(true);
+    ASSERT_RETURN(result >= 0,ERR_AUTH_ERROR);
+    // the ping delay is measured by the kernel arrival time if possible.
+    if (data_sock_->SetTimestamp(true) < 0)
+        LOGWP("enable kernel timestamp error(%d), measure delay by user time.", data_sock_->GetFd());
     context_->SetReadFd(data_sock_->GetFd());
 
     LOGDP("connect new client(fd=%d): %s:%d", data_sock_->GetFd(), peer_ip.c_str(), peer_port);
@@ -139,13 +172,6 @@ int Peer::Auth()
     return 0;
 }
 
-int Peer::Timeout(int timeout)
-{
-    if (!commandsender_)
-        return 0;
-    return commandsender_->Timeout(timeout);
-}
-
 class MultiCastSock : public Udp
 {
 public:
@@ -157,27 +183,51 @@ public:
     ssize_t Send(const char *buf, size_t size) const override
     {
         //auto that = const_cast<MultiCastSock*>(this);
+        // the peers of all shards share one multicast sequence.
+        std::lock_guard<std::mutex> lock(mtx_);
         if (count_ >= command_->GetCount())
         {
             return 0;
         }
-        auto interval = std::chrono::duration_cast<microseconds>(std::chrono::high_resolution_clock::now() - begin_).count();
-
-        if (interval < command_->GetInterval())
+        // schedule the datagrams on the absolute deadlines, so the late ones are caught up.
+        auto now = std::chrono::steady_clock::now();
+        if (count_ == 0)
+            begin_ = now;
+        auto elapsed = std::chrono::duration_cast<nanoseconds>(now - begin_).count();
+        if (elapsed < count_ * command_->GetIntervalNs())
         {
             return 0;
         }
 
-        begin_ = std::chrono::high_resolution_clock::now();
         DataHead* head = (DataHead*)&buf[0];
-        head->sequence = count_;
+        head->SetSequence(count_);
         count_++;
         command_->is_finished = count_ >= command_->GetCount();
         return multicast_sock_->Send(buf, size);
     }
+    int SendBatch(const std::vector<std::string> &bufs, int count) const override
+    {
+        // the shared sequence and interval decide how many datagrams can be sent.
+        int sent = 0;
+        for (; sent < count; sent++)
+        {
+            auto result = Send(bufs[sent].data(), bufs[sent].length());
+            if (result < 0)
+                return sent > 0 ? sent : -1;
+            if (result == 0)
+                break;
+        }
+        return sent;
+    }
+    int SendSegments(const std::string &buf, int segment_size) const override
+    {
+        // the segments can not share the multicast sequence.
+        return -1;
+    }
     static void Start()
     {
-        begin_ = std::chrono::high_resolution_clock::time_point();
+        std::lock_guard<std::mutex> lock(mtx_);
+        begin_ = std::chrono::steady_clock::time_point();
         count_ = 0;
     }
 
@@ -187,14 +237,16 @@ public:
     }
 
 private:
-    static std::chrono::high_resolution_clock::time_point begin_;
+    static std::chrono::steady_clock::time_point begin_;
     static int count_;
+    static std::mutex mtx_;
     std::shared_ptr<Sock> multicast_sock_;
     std::shared_ptr<Sock> data_sock_;
     std::shared_ptr<SendCommand> command_;
 };
 int MultiCastSock::count_ = 0;
-std::chrono::high_resolution_clock::time_point MultiCastSock::begin_;
+std::mutex MultiCastSock::mtx_;
+std::chrono::steady_clock::time_point MultiCastSock::begin_;
 
 int Peer::GetDataFd() const
 {
@@ -214,7 +266,7 @@ int Peer::SetCommand(std::shared_ptr<Command> command)
 
     command_ = command;
     std::shared_ptr<CommandChannel> channel(new CommandChannel{
-        command, context_, control_sock_, current_sock_});
+        command, context_, control_sock_, current_sock_, control_});
     commandsender_ = command->CreateCommandSender(channel);
     ASSERT_RETURN(commandsender_, -1);
     commandsender_->OnStopped = [&](std::shared_ptr<NetStat> netstat) {
@@ -223,5 +275,9 @@ int Peer::SetCommand(std::shared_ptr<Command> command)
         //commandsender_ is not reusable.
         commandsender_ = NULL;
     };
+    commandsender_->OnReported = [&](int index, std::shared_ptr<NetStat> netstat) {
+        if (OnReported)
+            OnReported(this, index, netstat);
+    };
     return 0;
 }
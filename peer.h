@@ -7,12 +7,25 @@
 #include "sock.h"
 #include "command.h"
 #include "context2.h"
+#include "control_channel.h"
 
 using namespace std::chrono;
 
 class Peer;
 class CommandSender;
 
+/**
+ * @brief A copy of the peer identity, it is safe to read in another thread than the peer's.
+ * 
+ */
+struct PeerInfo
+{
+    std::string cookie;
+    std::string ip;
+    int port = 0;
+    bool is_ready = false;
+};
+
 class Peer
 {
 public:
@@ -25,7 +38,6 @@ public:
     int RecvCommand();
     int SendData();
     int RecvData();
-    int Timeout(int timeout);
     
     int GetControlFd() const{ return control_sock_->GetFd(); }
     int GetDataFd() const;
@@ -35,11 +47,12 @@ public:
     int SetCommand(std::shared_ptr<Command> command);
     std::shared_ptr<Command> GetCommand() const{return command_;};
     const std::string &GetCookie() const { return cookie_; }
-    int GetTimeout() const{ return commandsender_?commandsender_->GetTimeout():-1; }
     bool IsReady() const{return !!data_sock_;}
+    PeerInfo GetInfo() const;
     bool IsPayloadStarted() const {return commandsender_&&commandsender_->is_started_;}
 
     std::function<void(const Peer*,std::shared_ptr<NetStat>)> OnStopped;
+    std::function<void(const Peer*,int,std::shared_ptr<NetStat>)> OnReported;
     std::function<void(const Peer*)> OnAuthSuccess;
 
     bool operator==(const Peer &peer)
@@ -56,12 +69,12 @@ private:
 
     std::shared_ptr<Option> option_;
     std::shared_ptr<Sock> control_sock_;
+    std::shared_ptr<ControlChannel> control_;
     std::shared_ptr<Sock> data_sock_;
     std::shared_ptr<Sock> current_sock_;
     std::string cookie_;
     std::shared_ptr<Command> command_;
     std::shared_ptr<CommandSender> commandsender_; 
-    char buf_[MAX_UDP_LENGTH];
     std::shared_ptr<Context> context_;
 
     friend class CommandSender;
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <cmath>
+
+#include "quantile_sketch.h"
+
+QuantileSketch::QuantileSketch()
+    : gamma_((1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY)), log_gamma_(std::log(gamma_)),
+      offset_(0), zero_count_(0), count_(0), min_(0), max_(0) {}
+
+int QuantileSketch::GetIndex(double value) const
+{
+    return (int)std::ceil(std::log(value) / log_gamma_);
+}
+
+double QuantileSketch::GetValue(int index) const
+{
+    // the value of the same relative error to both ends of the bucket.
+    return 2 * std::pow(gamma_, index) / (gamma_ + 1);
+}
+
+void QuantileSketch::Add(double value, uint64_t count)
+{
+    if (count == 0)
+        return;
+    value = std::max(value, 0.0);
+    if (value < 1)
+        zero_count_ += count;
+    else
+        AddBucket(GetIndex(value), count);
+    min_ = count_ == 0 ? value : std::min(min_, value);
+    max_ = count_ == 0 ? value : std::max(max_, value);
+    count_ += count;
+}
+
+void QuantileSketch::AddCount(int index, uint64_t count, bool zero)
+{
+    if (count == 0)
+        return;
+    if (zero)
+        zero_count_ += count;
+    else
+        AddBucket(index, count);
+    double lowest = zero ? 0 : GetValue(index);
+    double highest = zero ? 1 : GetValue(index);
+    min_ = count_ == 0 ? lowest : std::min(min_, lowest);
+    max_ = count_ == 0 ? highest : std::max(max_, highest);
+    count_ += count;
+}
+
+void QuantileSketch::AddBucket(int index, uint64_t count)
+{
+    if (counts_.empty())
+    {
+        offset_ = index;
+        counts_.resize(1);
+    }
+    int high = offset_ + (int)counts_.size() - 1;
+    if (index < offset_)
+    {
+        // a value below the collapsed range goes to the lowest bucket.
+        int low = std::max(index, high - SKETCH_MAX_BUCKETS + 1);
+        counts_.insert(counts_.begin(), offset_ - low, 0);
+        offset_ = low;
+        index = std::max(index, low);
+    }
+    else if (index > high)
+    {
+        int low = std::max(offset_, index - SKETCH_MAX_BUCKETS + 1);
+        int collapsed = std::min(low - offset_, (int)counts_.size());
+        uint64_t sum = 0;
+        for (int i = 0; i < collapsed; i++)
+            sum += counts_[i];
+        counts_.erase(counts_.begin(), counts_.begin() + collapsed);
+        offset_ = low;
+        counts_.resize(index - low + 1);
+        counts_[0] += sum;
+    }
+    counts_[index - offset_] += count;
+}
+
+void QuantileSketch::Merge(const QuantileSketch &sketch)
+{
+    if (sketch.count_ == 0)
+        return;
+    // grow to the highest bucket first, so the lower ones collapse once.
+    for (int i = (int)sketch.counts_.size() - 1; i >= 0; i--)
+    {
+        if (sketch.counts_[i] > 0)
+            AddBucket(sketch.offset_ + i, sketch.counts_[i]);
+    }
+    zero_count_ += sketch.zero_count_;
+    min_ = count_ == 0 ? sketch.min_ : std::min(min_, sketch.min_);
+    max_ = count_ == 0 ? sketch.max_ : std::max(max_, sketch.max_);
+    count_ += sketch.count_;
+}
+
+double QuantileSketch::GetPercentile(double percentile) const
+{
+    if (count_ == 0)
+        return 0;
+    auto rank = std::max<uint64_t>((uint64_t)std::ceil(count_ * std::min(std::max(percentile, 0.0), 100.0) / 100), 1);
+    uint64_t total = zero_count_;
+    if (total >= rank)
+        return min_;
+    for (int i = 0; i < (int)counts_.size(); i++)
+    {
+        total += counts_[i];
+        if (total >= rank)
+            return std::min(std::max(GetValue(offset_ + i), min_), max_);
+    }
+    return max_;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+// the relative error of the quantiles, the bucket i holds (gamma^(i-1), gamma^i].
+#define SKETCH_ACCURACY 0.01
+// about 1% error from 1 to 1e17, the lowest buckets are collapsed beyond it.
+#define SKETCH_MAX_BUCKETS 2048
+
+/**
+ * @brief A mergeable quantile sketch of non-negative values, like DDSketch. The buckets
+ *  grow logarithmically, so any quantile is within SKETCH_ACCURACY of the real value
+ *  whatever the range is, and two sketches merge by adding the counts of the same buckets.
+ *  The memory is bounded by SKETCH_MAX_BUCKETS, which collapses the lowest buckets first,
+ *  so the high quantiles stay accurate.
+ *
+ */
+class QuantileSketch
+{
+public:
+    QuantileSketch();
+
+    void Add(double value) { Add(value, 1); }
+    /**
+     * @brief Add count values, the ones below 1 are counted as 0.
+     *
+     * @param value
+     * @param count
+     */
+    void Add(double value, uint64_t count);
+    void Merge(const QuantileSketch &sketch);
+    /**
+     * @brief Get the value which percentile percent of the values are equal to or below.
+     *
+     * @param percentile in [0, 100]
+     * @return double within SKETCH_ACCURACY of the value, 0 if there is no value.
+     */
+    double GetPercentile(double percentile) const;
+
+    uint64_t GetCount() const { return count_; }
+    uint64_t GetZeroCount() const { return zero_count_; }
+    double GetMin() const { return min_; }
+    double GetMax() const { return max_; }
+    /**
+     * @brief Get the counts of the buckets from GetOffset() on.
+     *
+     * @return const std::vector<uint64_t>&
+     */
+    const std::vector<uint64_t> &GetCounts() const { return counts_; }
+    int GetOffset() const { return offset_; }
+    /**
+     * @brief Add count values to a bucket, or to the zero bucket if zero is true.
+     *
+     * @param index
+     * @param count
+     * @param zero
+     */
+    void AddCount(int index, uint64_t count, bool zero = false);
+    /**
+     * @brief Restore the exact min and max after the buckets are added by AddCount.
+     *
+     * @param min
+     * @param max
+     */
+    void SetRange(double min, double max)
+    {
+        min_ = min;
+        max_ = max;
+    }
+
+private:
+    int GetIndex(double value) const;
+    double GetValue(int index) const;
+    void AddBucket(int index, uint64_t count);
+
+    double gamma_;
+    double log_gamma_;
+    std::vector<uint64_t> counts_;
+    int offset_;
+    uint64_t zero_count_;
+    uint64_t count_;
+    double min_;
+    double max_;
+};
@@ -0,0 +1,57 @@
+#include <algorithm>
+
+#include "sequence_window.h"
+
+SequenceWindow::SequenceWindow(uint64_t size)
+    : words_(std::max<uint64_t>((size + 63) / 64, 1), 0), base_(0) {}
+
+int SequenceWindow::Set(uint64_t sequence)
+{
+    if (sequence < base_)
+        return -1;
+    auto size = GetSize();
+    if (sequence >= base_ + size)
+    {
+        auto base = (sequence - size + 1 + 63) / 64 * 64;
+        if (base - base_ >= size)
+            std::fill(words_.begin(), words_.end(), 0);
+        else
+        {
+            // the words before the new base are reused for the sequences after the old end.
+            for (auto s = base_; s < base; s += 64)
+                Word(s) = 0;
+        }
+        base_ = base;
+    }
+    auto &word = Word(sequence);
+    auto bit = 1ULL << (sequence % 64);
+    if (word & bit)
+        return 0;
+    word |= bit;
+    return 1;
+}
+
+bool SequenceWindow::Test(uint64_t sequence) const
+{
+    if (sequence < base_ || sequence >= base_ + GetSize())
+        return false;
+    return Word(sequence) & (1ULL << (sequence % 64));
+}
+
+uint64_t SequenceWindow::GetNextMissing(uint64_t sequence) const
+{
+    auto end = base_ + GetSize();
+    if (sequence < base_ || sequence >= end)
+        return sequence;
+    // the bits before sequence in its word are treated as received.
+    auto word = Word(sequence) | ((1ULL << (sequence % 64)) - 1);
+    auto s = sequence / 64 * 64;
+    while (word == ~0ULL)
+    {
+        s += 64;
+        if (s >= end)
+            return end;
+        word = Word(s);
+    }
+    return s + __builtin_ctzll(~word);
+}
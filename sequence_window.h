@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "netsnoop.h"
+
+// the sequences tracked behind the latest one, 1M covers one second at 1 Mpps.
+#define SEQUENCE_WINDOW_SIZE (1 << 20)
+
+/**
+ * @brief A bitmap of the received sequences in [base, base + size), which slides
+ *  forward with the latest sequence. The words are kept in a ring, so sliding clears
+ *  the dropped words only and the scans go 64 sequences at a time.
+ *
+ */
+class SequenceWindow
+{
+public:
+    /**
+     * @brief Construct a new Sequence Window object
+     *
+     * @param size rounded up to a multiple of 64.
+     */
+    SequenceWindow(uint64_t size = SEQUENCE_WINDOW_SIZE);
+
+    /**
+     * @brief Mark the sequence received, the window slides if it is beyond the end.
+     *
+     * @param sequence
+     * @return int 1 if it is new, 0 if it is received already, -1 if it is before the window.
+     */
+    int Set(uint64_t sequence);
+    /**
+     * @brief Whether the sequence is received, the ones out of the window are not.
+     *
+     * @param sequence
+     * @return bool
+     */
+    bool Test(uint64_t sequence) const;
+    /**
+     * @brief Get the first sequence not received from sequence on.
+     *
+     * @param sequence
+     * @return uint64_t
+     */
+    uint64_t GetNextMissing(uint64_t sequence) const;
+    uint64_t GetBase() const { return base_; }
+    uint64_t GetSize() const { return words_.size() * 64; }
+
+private:
+    uint64_t &Word(uint64_t sequence) { return words_[(sequence / 64) % words_.size()]; }
+    const uint64_t &Word(uint64_t sequence) const { return words_[(sequence / 64) % words_.size()]; }
+
+    std::vector<uint64_t> words_;
+    // the first sequence of the window, a multiple of 64.
+    uint64_t base_;
+
+    DISALLOW_COPY_AND_ASSIGN(SequenceWindow);
+};
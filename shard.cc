@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <thread>
+
+#include "command.h"
+#include "context2.h"
+#include "shard.h"
+
+Shard::Shard(int id, std::shared_ptr<Option> option, std::shared_ptr<Context> context)
+    : id_(id), option_(option), context_(context), result_{NULL, 0, 0, 0},
+      is_multicast_ready_(false), rotation_(0), peers_count_(0)
+{
+}
+
+int Shard::StartThread()
+{
+    ASSERT_RETURN(!tasks_, -1, "shard(%d) has already started.", id_);
+    tasks_ = std::make_shared<TaskQueue>();
+    int result = tasks_->Initialize();
+    ASSERT_RETURN(result >= 0, -1, "create shard(%d) task queue error.", id_);
+    context_->SetReadFd(tasks_->GetFd());
+
+    auto t = std::thread([this]() {
+        LOGVP("shard(%d) running...", id_);
+        Run();
+        LOGEP("shard(%d) exit.", id_);
+    });
+    t.detach();
+    return 0;
+}
+
+int Shard::Post(TaskQueue::Task task)
+{
+    if (!tasks_)
+    {
+        task();
+        return 0;
+    }
+    return tasks_->Push(task);
+}
+
+int Shard::Run()
+{
+    int result;
+    while (true)
+    {
+        context_->RunTimers();
+
+        result = context_->Wait(-1);
+        if (result < 0)
+        {
+            PSOCKETERROREX("shard(%d) wait error", id_);
+            return -1;
+        }
+        if (result == 0)
+            continue;
+        if (context_->IsReadable(tasks_->GetFd()))
+        {
+            result = tasks_->Run();
+            ASSERT_RETURN(result >= 0, -1, "shard(%d) run tasks error.", id_);
+        }
+        ProcessEvents();
+    }
+    return 0;
+}
+
+void Shard::AddPeer(std::shared_ptr<Sock> control_sock, std::shared_ptr<Sock> multicast_sock)
+{
+    auto peer = std::make_shared<Peer>(control_sock, option_, context_);
+    peer->OnAuthSuccess = [this](const Peer *p) {
+        // the data fd is created after auth.
+        auto peer = fd_peers_[p->GetControlFd()];
+        fd_peers_[p->GetDataFd()] = peer;
+        if (OnPeerConnected)
+            OnPeerConnected(peer);
+    };
+    peer->multicast_sock_ = multicast_sock;
+    peers_.push_back(peer);
+    fd_peers_[peer->GetControlFd()] = peer;
+    peers_count_++;
+    LOGDP("shard(%d) add peer(%d): peers count = %d", id_, peer->GetControlFd(), (int)peers_count_);
+}
+
+void Shard::RemovePeer(std::shared_ptr<Peer> peer, int reason)
+{
+    LOGWP("client removed: %s", peer->GetCookie().c_str());
+    context_->ClrReadFd(peer->GetControlFd());
+    context_->ClrWriteFd(peer->GetControlFd());
+    fd_peers_.erase(peer->GetControlFd());
+    if (peer->GetDataFd() > 0)
+    {
+        context_->ClrReadFd(peer->GetDataFd());
+        context_->ClrWriteFd(peer->GetDataFd());
+        fd_peers_.erase(peer->GetDataFd());
+    }
+    peer->Stop();
+    peers_.remove(peer);
+    peers_count_--;
+    if (reason != ERR_AUTH_ERROR && OnPeerDisconnected)
+        OnPeerDisconnected(peer);
+}
+
+int Shard::ProcessEvents()
+{
+    int result;
+    // process the ready clients only, every peer sends a budget per event, so start
+    // from a rotating offset to let each of them be the first in turn.
+    auto &events = context_->events;
+    auto size = events.size();
+    auto offset = size > 0 ? rotation_++ % size : 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        auto &event = events[(offset + i) % size];
+        auto it = fd_peers_.find(event.fd);
+        // the peer may have been removed by an earlier event.
+        if (it == fd_peers_.end())
+            continue;
+        auto peer = it->second;
+        result = 0;
+        if (event.fd == peer->GetControlFd())
+        {
+            if (result >= 0 && event.writable)
+            {
+                result = peer->SendCommand();
+            }
+            if (result >= 0 && event.readable)
+            {
+                result = peer->RecvCommand();
+            }
+        }
+        else
+        {
+            if (result >= 0 && event.writable)
+            {
+                result = peer->SendData();
+            }
+            if (result >= 0 && event.readable)
+            {
+                result = peer->RecvData();
+            }
+        }
+        if (result < 0)
+        {
+            RemovePeer(peer, result);
+        }
+    }
+    CheckMulticastReady();
+    return 0;
+}
+
+void Shard::CheckMulticastReady()
+{
+    if (!current_command_ || !current_command_->is_multicast || is_multicast_ready_)
+        return;
+    for (auto &peer : ready_peers_)
+    {
+        if (peer->GetCommand() && !peer->IsPayloadStarted())
+            return;
+    }
+    is_multicast_ready_ = true;
+    if (OnMulticastReady)
+        OnMulticastReady(this);
+}
+
+int Shard::StartMulticast()
+{
+    for (auto &peer : ready_peers_)
+    {
+        if (peer->GetDataFd() > 0 && peer->GetCommand())
+        {
+            context_->SetWriteFd(peer->GetDataFd());
+        }
+    }
+    return 0;
+}
+
+int Shard::StartCommand(std::shared_ptr<Command> command)
+{
+    int result;
+    ASSERT_RETURN(!current_command_, -1, "shard(%d) is running a command.", id_);
+    ready_peers_.clear();
+    for (auto &peer : peers_)
+    {
+        if (peer->IsReady())
+            ready_peers_.push_back(peer);
+    }
+    result_ = ShardResult{NULL, (int)ready_peers_.size(), 0, 0};
+    is_multicast_ready_ = false;
+    if (ready_peers_.empty())
+    {
+        LOGDP("shard(%d) has no client ready.", id_);
+        if (command->is_multicast && OnMulticastReady)
+            OnMulticastReady(this);
+        if (OnCommandStopped)
+            OnCommandStopped(this, result_);
+        return 0;
+    }
+
+    LOGDP("shard(%d) start command: %s (peers count = %ld)", id_, command->GetCmd().c_str(), ready_peers_.size());
+    current_command_ = command;
+    auto peers = ready_peers_;
+    for (auto &peer : peers)
+    {
+        result = peer->SetCommand(command);
+        ASSERT(result == 0);
+        peer->OnStopped = [this, command](const Peer *p, std::shared_ptr<NetStat> netstat) {
+            auto it = std::find_if(ready_peers_.begin(), ready_peers_.end(),
+                                   [&p](std::shared_ptr<Peer> p1) { return p1.get() == p; });
+            // the peer has already stopped.
+            if (it == ready_peers_.end())
+                return;
+            auto peer = *it;
+            ready_peers_.erase(it);
+            LOGIP("stop command (%ld/%d): %s (%s)", (result_.peers_count - ready_peers_.size()), result_.peers_count, command->GetCmd().c_str(), netstat ? netstat->ToString().c_str() : "NULL");
+            if (OnPeerStopped)
+                OnPeerStopped(peer, netstat);
+            if (netstat)
+            {
+                netstat->max_send_time = netstat->send_time;
+                netstat->max_recv_time = netstat->recv_time;
+                netstat->max_jitter_rfc3550_us = netstat->jitter_rfc3550_us;
+                netstat->min_send_time = netstat->send_time;
+                netstat->min_recv_time = netstat->recv_time;
+                netstat->max_send_speed = netstat->send_speed;
+                netstat->min_send_speed = netstat->send_speed;
+                netstat->send_avg_speed = netstat->send_speed;
+                netstat->recv_avg_speed = netstat->recv_speed;
+                if (!result_.netstat)
+                {
+                    result_.netstat = netstat;
+                }
+                else
+                {
+                    *result_.netstat += *netstat;
+                }
+                if (netstat->send_bytes > 0)
+                {
+                    result_.peers_active++;
+                }
+            }
+            else
+            {
+                result_.peers_failed++;
+            }
+            if (ready_peers_.size() > 0)
+                return;
+            // the failed peers may make the rest of the shard ready.
+            if (current_command_->is_multicast && !is_multicast_ready_)
+            {
+                is_multicast_ready_ = true;
+                if (OnMulticastReady)
+                    OnMulticastReady(this);
+            }
+            current_command_ = NULL;
+            if (OnCommandStopped)
+                OnCommandStopped(this, result_);
+        };
+        peer->OnReported = [this](const Peer *p, int index, std::shared_ptr<NetStat> netstat) {
+            if (OnCommandReported)
+                OnCommandReported(this, index, netstat);
+        };
+        result = peer->Start();
+        ASSERT(result == 0);
+    }
+    return 0;
+}
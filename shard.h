@@ -0,0 +1,140 @@
+#pragma once
+
+#include <list>
+#include <atomic>
+#include <unordered_map>
+
+#include "command.h"
+#include "tcp.h"
+#include "udp.h"
+#include "peer.h"
+#include "task_queue.h"
+
+/**
+ * @brief The merged result of the peers of a shard.
+ *
+ */
+struct ShardResult
+{
+    std::shared_ptr<NetStat> netstat;
+    // The ready peers count when the command starts.
+    int peers_count;
+    // The failed peers when the command is running.
+    int peers_failed;
+    // The peers that do send some data, only useful in multicast.
+    int peers_active;
+};
+
+/**
+ * @brief A part of the peers and the event loop serving them.
+ *  A shard either shares the context of the server and is driven by the server loop,
+ *  or owns a context and runs its own loop on a dedicated thread.
+ *
+ */
+class Shard
+{
+public:
+    Shard(int id, std::shared_ptr<Option> option, std::shared_ptr<Context> context);
+
+    /**
+     * @brief Start a dedicated thread to run the loop of this shard.
+     *
+     * @return int
+     */
+    int StartThread();
+    /**
+     * @brief Run task on the thread of this shard, run it right now if the shard has no thread.
+     *
+     * @param task
+     * @return int
+     */
+    int Post(TaskQueue::Task task);
+
+    /**
+     * @brief Serve a new connected peer.
+     *
+     * @param control_sock
+     * @param multicast_sock
+     */
+    void AddPeer(std::shared_ptr<Sock> control_sock, std::shared_ptr<Sock> multicast_sock);
+    /**
+     * @brief Dispatch the ready events of the latest Wait to the peers.
+     *
+     * @return int
+     */
+    int ProcessEvents();
+
+    /**
+     * @brief Start a command on the ready peers of this shard, OnCommandStopped is
+     *  called when all of them stop.
+     *
+     * @param command
+     * @return int
+     */
+    int StartCommand(std::shared_ptr<Command> command);
+    /**
+     * @brief Let the peers send the multicast data.
+     *
+     * @return int
+     */
+    int StartMulticast();
+
+    int GetId() const { return id_; }
+    int GetPeersCount() const { return peers_count_; }
+
+    std::function<void(std::shared_ptr<Peer>)> OnPeerConnected;
+    std::function<void(std::shared_ptr<Peer>)> OnPeerDisconnected;
+    std::function<void(std::shared_ptr<Peer>, std::shared_ptr<NetStat>)> OnPeerStopped;
+    /**
+     * @brief All the peers of this shard have started the multicast command.
+     *
+     */
+    std::function<void(Shard *)> OnMulticastReady;
+    std::function<void(Shard *, const ShardResult &)> OnCommandStopped;
+    /**
+     * @brief A peer of this shard reports the interim result of a report interval.
+     *
+     */
+    std::function<void(Shard *, int, std::shared_ptr<NetStat>)> OnCommandReported;
+
+private:
+    int Run();
+    void RemovePeer(std::shared_ptr<Peer> peer, int reason);
+    void CheckMulticastReady();
+
+    int id_;
+    std::shared_ptr<Option> option_;
+    std::shared_ptr<Context> context_;
+    std::shared_ptr<TaskQueue> tasks_;
+
+    /**
+     * @brief All connected peers, no matter auth or not.
+     *
+     */
+    std::list<std::shared_ptr<Peer>> peers_;
+    /**
+     * @brief Find peer by its control fd or data fd.
+     *
+     */
+    std::unordered_map<int, std::shared_ptr<Peer>> fd_peers_;
+    /**
+     * @brief The peers running the current command.
+     *
+     */
+    std::list<std::shared_ptr<Peer>> ready_peers_;
+    std::shared_ptr<Command> current_command_;
+    ShardResult result_;
+    bool is_multicast_ready_;
+    /**
+     * @brief The rounds of events processed, to rotate the first served peer.
+     *
+     */
+    size_t rotation_;
+    /**
+     * @brief The peers count, can be read by other threads.
+     *
+     */
+    std::atomic<int> peers_count_;
+
+    DISALLOW_COPY_AND_ASSIGN(Shard);
+};
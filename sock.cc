@@ -23,6 +23,10 @@
 #include <functional>
 #include <thread>
 #include <signal.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif // __linux__
 
 #include "sock.h"
 
@@ -104,21 +108,21 @@ ssize_t Sock::Send(int fd_, const char *buf, size_t size)
 {
     ASSERT(fd_ > 0);
     ssize_t result;
-    if ((result = send(fd_, buf, size, 0)) < 0 || result != size)
+    if ((result = send(fd_, buf, size, 0)) < 0)
     {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ERR_WOULD_BLOCK;
         PSOCKETERROREX("send error(%d,result=%d)", fd_,result);
         return -1;
     }
+    // only a non-blocking stream can be written partially.
+    if (result != size)
+        LOGDP("send partially(%d): %ld of %ld", fd_, result, (long)size);
 
-    if (Logger::GetGlobalLogLevel() <= LogLevel::LLDEBUG)
+    if (Logger::ShouldPrintLog(LLVERBOSE))
     {
-        std::string tmp(buf, std::min(result, (ssize_t)64));
-        std::ostringstream out;
-        for (char c : tmp)
-        {
-            out << (isprint(c) ? c : '.');
-        }
-        LOGDP("send(%d): length=%ld,%s", fd_, result, out.str().c_str());
+        char preview[65];
+        LOGVP("send(%d): length=%ld,%s", fd_, (long)result, Tools::GetDataSum(buf, result, preview, sizeof(preview)));
     }
     return result;
 }
@@ -135,19 +139,15 @@ ssize_t Sock::Recv(int fd_, char *buf, size_t size)
             PSOCKETERROREX("recv error(%d,result=%d)", fd_,result);
             return -1;
         }
-        PSOCKETERROREX("recv timeout(%d,result=%d)", fd_,result);
+        // a non-blocking socket may be drained by an earlier recv.
+        LOGVP("recv timeout(%d,result=%d): %s", fd_, result, strerror(errno));
         return ERR_TIMEOUT;
     }
 
-    if (Logger::GetGlobalLogLevel() <= LogLevel::LLDEBUG)
+    if (Logger::ShouldPrintLog(LLVERBOSE))
     {
-        std::string tmp(buf, std::min(result, (ssize_t)64));
-        std::ostringstream out;
-        for (char c : tmp)
-        {
-            out << (isprint(c) ? c : '.');
-        }
-        LOGDP("recv(%d): length=%ld,%s", fd_, result, out.str().c_str());
+        char preview[65];
+        LOGVP("recv(%d): length=%ld,%s", fd_, (long)result, Tools::GetDataSum(buf, result, preview, sizeof(preview)));
     }
     return result;
 }
@@ -182,7 +182,62 @@ int Sock::Connect(std::string ip, int port)
 }
 ssize_t Sock::Send(const char *buf, size_t size) const
 {
-    return Send(fd_, buf, size);
+    // a datagram is sent as a whole or not at all.
+    if (!is_nonblocking_ || type_ != SOCK_STREAM)
+        return Send(fd_, buf, size);
+    // keep the stream in order, the new data goes behind the queued ones.
+    if (!pending_.empty())
+    {
+        pending_.append(buf, size);
+        LOGDP("send queued(%d): length=%ld, pending=%ld", fd_, (long)size, (long)pending_.length());
+        return size;
+    }
+    ssize_t result = Send(fd_, buf, size);
+    if (result < 0 && result != ERR_WOULD_BLOCK)
+        return -1;
+    auto sent = std::max<ssize_t>(result, 0);
+    if (sent < size)
+    {
+        pending_.append(buf + sent, size - sent);
+        LOGDP("send queued(%d): length=%ld, pending=%ld", fd_, (long)(size - sent), (long)pending_.length());
+    }
+    return size;
+}
+
+int Sock::Flush()
+{
+    if (pending_.empty())
+        return 0;
+    ssize_t result = Send(fd_, pending_.data(), pending_.length());
+    if (result == ERR_WOULD_BLOCK)
+        return 0;
+    if (result < 0)
+        return -1;
+    pending_.erase(0, result);
+    LOGDP("flush(%d): length=%ld, pending=%ld", fd_, (long)result, (long)pending_.length());
+    return result;
+}
+
+int Sock::SetNonBlocking(bool enable)
+{
+    ASSERT(fd_ > 0);
+#ifdef WIN32
+    u_long mode = enable ? 1 : 0;
+    if (ioctlsocket(fd_, FIONBIO, &mode) != 0)
+    {
+        PSOCKETERROREX("ioctlsocket FIONBIO error(%d)", fd_);
+        return -1;
+    }
+#else
+    int flags = fcntl(fd_, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd_, F_SETFL, enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0)
+    {
+        PSOCKETERROREX("fcntl O_NONBLOCK error(%d)", fd_);
+        return -1;
+    }
+#endif // WIN32
+    is_nonblocking_ = enable;
+    return 0;
 }
 
 ssize_t Sock::Recv(char *buf, size_t size) const
@@ -190,6 +245,541 @@ ssize_t Sock::Recv(char *buf, size_t size) const
     return Recv(fd_, buf, size);
 }
 
+int Sock::SendBatch(const std::vector<std::string> &bufs, int count) const
+{
+    ASSERT(fd_ > 0);
+    ASSERT(count <= bufs.size());
+#ifdef __linux__
+    // sendmmsg sends all the datagrams in one syscall.
+    thread_local static std::vector<mmsghdr> msgs;
+    thread_local static std::vector<iovec> iovs;
+    if (msgs.size() < count)
+    {
+        msgs.resize(count);
+        iovs.resize(count);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = const_cast<char *>(bufs[i].data());
+        iovs[i].iov_len = bufs[i].length();
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    // never block the event loop, the rest is sent when it is writable again.
+    int result = sendmmsg(fd_, &msgs[0], count, MSG_DONTWAIT);
+    if (result < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ERR_WOULD_BLOCK;
+        PSOCKETERROREX("sendmmsg error(%d,count=%d)", fd_, count);
+        return -1;
+    }
+    LOGVP("sendmmsg(%d): count=%d, sent=%d", fd_, count, result);
+    return result;
+#else
+    int sent = 0;
+    for (; sent < count; sent++)
+    {
+        if (Send(bufs[sent].data(), bufs[sent].length()) < 0)
+            return sent > 0 ? sent : -1;
+    }
+    return sent;
+#endif // __linux__
+}
+
+int Sock::SendSegments(const std::string &buf, int segment_size) const
+{
+    ASSERT(fd_ > 0);
+    ASSERT(segment_size > 0);
+#if defined(__linux__) && defined(UDP_SEGMENT)
+    iovec iov;
+    iov.iov_base = const_cast<char *>(buf.data());
+    iov.iov_len = buf.length();
+    char control[CMSG_SPACE(sizeof(uint16_t))] = {0};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *(uint16_t *)CMSG_DATA(cmsg) = segment_size;
+    ssize_t result = sendmsg(fd_, &msg, MSG_DONTWAIT);
+    if (result < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ERR_WOULD_BLOCK;
+        PSOCKETERROREX("send segments error(%d,length=%ld,segment=%d)", fd_, buf.length(), segment_size);
+        return -1;
+    }
+    LOGVP("send segments(%d): length=%ld, segment=%d", fd_, result, segment_size);
+    return (result + segment_size - 1) / segment_size;
+#else
+    LOGWP("udp gso is not supported.");
+    return -1;
+#endif // __linux__ && UDP_SEGMENT
+}
+
+int Sock::SetGro(bool enable)
+{
+    ASSERT(fd_ > 0);
+#if defined(__linux__) && defined(UDP_GRO)
+    int value = enable ? 1 : 0;
+    if (setsockopt(fd_, SOL_UDP, UDP_GRO, &value, sizeof(value)) < 0)
+    {
+        PSOCKETERROREX("set udp gro error(%d)", fd_);
+        return -1;
+    }
+    is_gro_ = enable;
+    return 0;
+#else
+    LOGWP("udp gro is not supported.");
+    return -1;
+#endif // __linux__ && UDP_GRO
+}
+
+int Sock::SetTimestamp(bool enable)
+{
+    ASSERT(fd_ > 0);
+#if defined(__linux__) && defined(SO_TIMESTAMPNS)
+    int value = enable ? 1 : 0;
+    if (setsockopt(fd_, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) < 0)
+    {
+        PSOCKETERROREX("set timestamp error(%d)", fd_);
+        return -1;
+    }
+    is_timestamp_ = enable;
+    return 0;
+#else
+    LOGWP("kernel timestamp is not supported.");
+    return -1;
+#endif // __linux__ && SO_TIMESTAMPNS
+}
+
+#ifdef __linux__
+/**
+ * @brief Parse the gro segment size and the kernel timestamp of a received datagram.
+ * 
+ */
+static void ParseControl(msghdr *msg, int &segment_size, int64_t &timestamp)
+{
+    segment_size = 0;
+    timestamp = 0;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+#ifdef UDP_GRO
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            segment_size = *(int *)CMSG_DATA(cmsg);
+#endif // UDP_GRO
+#ifdef SO_TIMESTAMPNS
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            // the kernel stamps by CLOCK_REALTIME, move it to the clock of DataHead by the age of the datagram.
+            auto ts = reinterpret_cast<const timespec *>(CMSG_DATA(cmsg));
+            auto stamp = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(ts->tv_sec) + std::chrono::nanoseconds(ts->tv_nsec)));
+            auto age = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::system_clock::now() - stamp);
+            timestamp = (std::chrono::high_resolution_clock::now() - age).time_since_epoch().count();
+        }
+#endif // SO_TIMESTAMPNS
+    }
+}
+#endif // __linux__
+
+ssize_t Sock::RecvWithTimestamp(char *buf, size_t size, int64_t &timestamp) const
+{
+    timestamp = 0;
+#ifdef __linux__
+    if (is_timestamp_)
+    {
+        ASSERT(fd_ > 0);
+        iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = size;
+        char control[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(timespec))];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t result = recvmsg(fd_, &msg, MSG_DONTWAIT);
+        if (result < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                PSOCKETERROREX("recvmsg error(%d)", fd_);
+                return -1;
+            }
+            // the socket may be drained by an earlier recv.
+            LOGVP("recvmsg timeout(%d): %s", fd_, strerror(errno));
+            return ERR_TIMEOUT;
+        }
+        int segment_size;
+        ParseControl(&msg, segment_size, timestamp);
+        LOGVP("recvmsg(%d): length=%ld, timestamp=%ld", fd_, result, timestamp);
+        return result;
+    }
+#endif // __linux__
+    return Recv(buf, size);
+}
+
+int Sock::SetZeroCopy(bool enable)
+{
+    ASSERT(fd_ > 0);
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+    int value = enable ? 1 : 0;
+    if (setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) < 0)
+    {
+        PSOCKETERROREX("set zerocopy error(%d)", fd_);
+        return -1;
+    }
+    is_zerocopy_ = enable;
+    return 0;
+#else
+    LOGWP("zerocopy is not supported.");
+    return -1;
+#endif // __linux__ && SO_ZEROCOPY
+}
+
+int Sock::SendZeroCopy(const std::vector<std::string> &bufs, int count)
+{
+    ASSERT(fd_ > 0);
+    ASSERT(count <= bufs.size());
+    ASSERT(is_zerocopy_);
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+    thread_local static std::vector<mmsghdr> msgs;
+    thread_local static std::vector<iovec> iovs;
+    if (msgs.size() < count)
+    {
+        msgs.resize(count);
+        iovs.resize(count);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = const_cast<char *>(bufs[i].data());
+        iovs[i].iov_len = bufs[i].length();
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int result = sendmmsg(fd_, &msgs[0], count, MSG_ZEROCOPY | MSG_DONTWAIT);
+    if (result < 0)
+    {
+        // the pinned pages exceed the limit of optmem, wait for the completions.
+        if (errno == ENOBUFS || errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        PSOCKETERROREX("sendmmsg zerocopy error(%d,count=%d)", fd_, count);
+        return -1;
+    }
+    // every sent datagram takes one notification id.
+    zerocopy_id_ += result;
+    LOGVP("sendmmsg zerocopy(%d): count=%d, sent=%d", fd_, count, result);
+    return result;
+#else
+    return -1;
+#endif // __linux__ && SO_ZEROCOPY
+}
+
+int Sock::RecvZeroCopy(std::vector<ZeroCopyRange> &ranges) const
+{
+    ASSERT(fd_ > 0);
+    ranges.clear();
+#if defined(__linux__) && defined(SO_EE_ORIGIN_ZEROCOPY)
+    char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+    while (true)
+    {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            PSOCKETERROREX("recv zerocopy completions error(%d)", fd_);
+            return -1;
+        }
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            auto err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            ranges.push_back({err->ee_info, err->ee_data, !!(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)});
+        }
+    }
+    LOGVP("recv zerocopy completions(%d): %ld", fd_, ranges.size());
+    return ranges.empty() ? ERR_TIMEOUT : ranges.size();
+#else
+    return ERR_TIMEOUT;
+#endif // __linux__ && SO_EE_ORIGIN_ZEROCOPY
+}
+
+int Sock::SetPacingRate(int64_t rate)
+{
+    ASSERT(fd_ > 0);
+#if defined(__linux__) && defined(SO_MAX_PACING_RATE)
+    // the option takes an unsigned 32 bits rate, ~0U means no limit.
+    uint32_t value = rate > 0 ? (uint32_t)std::min<int64_t>(rate, UINT32_MAX - 1) : ~0U;
+    if (setsockopt(fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) < 0)
+    {
+        PSOCKETERROREX("set pacing rate error(%d,rate=%ld)", fd_, rate);
+        return -1;
+    }
+    return 0;
+#else
+    LOGWP("kernel pacing is not supported.");
+    return -1;
+#endif // __linux__ && SO_MAX_PACING_RATE
+}
+
+int Sock::SetTxTime(bool enable)
+{
+    ASSERT(fd_ > 0);
+#if defined(__linux__) && defined(SO_TXTIME)
+    // fq schedules by CLOCK_MONOTONIC, which is the clock of steady_clock.
+    sock_txtime txtime = {CLOCK_MONOTONIC, 0};
+    int result = enable ? setsockopt(fd_, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime))
+                        : setsockopt(fd_, SOL_SOCKET, SO_TXTIME, NULL, 0);
+    // there is no way to clear SO_TXTIME in the old kernels, it is harmless without the launch times.
+    if (result < 0 && enable)
+    {
+        PSOCKETERROREX("set txtime error(%d)", fd_);
+        return -1;
+    }
+    is_txtime_ = enable;
+    return 0;
+#else
+    LOGWP("txtime is not supported.");
+    return -1;
+#endif // __linux__ && SO_TXTIME
+}
+
+int Sock::SendPackets(const std::vector<Packet> &packets, int offset, int count) const
+{
+    ASSERT(fd_ > 0);
+    ASSERT(offset + count <= packets.size());
+#ifdef __linux__
+    thread_local static std::vector<mmsghdr> msgs;
+    thread_local static std::vector<iovec> iovs;
+    if (msgs.size() < count)
+    {
+        msgs.resize(count);
+        iovs.resize(count);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        auto &packet = packets[offset + i];
+        iovs[i].iov_base = const_cast<char *>(packet.buf.data());
+        iovs[i].iov_len = std::min<size_t>(packet.length, packet.buf.length());
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int result = sendmmsg(fd_, &msgs[0], count, MSG_DONTWAIT);
+    if (result < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ERR_WOULD_BLOCK;
+        PSOCKETERROREX("sendmmsg packets error(%d,count=%d)", fd_, count);
+        return -1;
+    }
+    LOGVP("sendmmsg packets(%d): count=%d, sent=%d", fd_, count, result);
+    return result;
+#else
+    int sent = 0;
+    for (; sent < count; sent++)
+    {
+        auto &packet = packets[offset + sent];
+        auto result = Send(packet.buf.data(), std::min<size_t>(packet.length, packet.buf.length()));
+        if (result < 0)
+            return sent > 0 ? sent : result;
+    }
+    return sent;
+#endif // __linux__
+}
+
+int Sock::SendBatchAt(const std::vector<std::string> &bufs, int count, int64_t launch_time, int64_t interval) const
+{
+    ASSERT(fd_ > 0);
+    ASSERT(count <= bufs.size());
+    ASSERT(is_txtime_);
+#if defined(__linux__) && defined(SO_TXTIME)
+    const size_t control_size = CMSG_SPACE(sizeof(uint64_t));
+    thread_local static std::vector<mmsghdr> msgs;
+    thread_local static std::vector<iovec> iovs;
+    thread_local static std::vector<char> controls;
+    if (msgs.size() < count)
+    {
+        msgs.resize(count);
+        iovs.resize(count);
+        controls.resize(count * control_size);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = const_cast<char *>(bufs[i].data());
+        iovs[i].iov_len = bufs[i].length();
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = &controls[i * control_size];
+        msgs[i].msg_hdr.msg_controllen = control_size;
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        uint64_t txtime = launch_time + i * interval;
+        memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+    }
+    int result = sendmmsg(fd_, &msgs[0], count, MSG_DONTWAIT);
+    if (result < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ERR_WOULD_BLOCK;
+        PSOCKETERROREX("sendmmsg txtime error(%d,count=%d)", fd_, count);
+        return -1;
+    }
+    LOGVP("sendmmsg txtime(%d): count=%d, sent=%d", fd_, count, result);
+    return result;
+#else
+    return -1;
+#endif // __linux__ && SO_TXTIME
+}
+
+int Sock::SetTxTimestamp(bool enable)
+{
+    ASSERT(fd_ > 0);
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+    // OPT_ID numbers the datagrams, OPT_TSONLY does not loop the payload back.
+    int flags = enable ? SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                             SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY
+                       : 0;
+    if (setsockopt(fd_, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+    {
+        PSOCKETERROREX("set tx timestamp error(%d)", fd_);
+        return -1;
+    }
+    return 0;
+#else
+    LOGWP("tx timestamp is not supported.");
+    return -1;
+#endif // __linux__ && SO_TIMESTAMPING
+}
+
+int Sock::RecvTxTimestamps(std::vector<TxTimestamp> &timestamps) const
+{
+    ASSERT(fd_ > 0);
+    timestamps.clear();
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+    char control[CMSG_SPACE(sizeof(scm_timestamping)) + CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+    while (true)
+    {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            PSOCKETERROREX("recv tx timestamps error(%d)", fd_);
+            return -1;
+        }
+        // the timestamp and its id come in two cmsgs.
+        TxTimestamp timestamp = {0, 0};
+        bool has_id = false;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+            {
+                auto ts = reinterpret_cast<const scm_timestamping *>(CMSG_DATA(cmsg));
+                timestamp.timestamp = ts->ts[0].tv_sec * 1000000000LL + ts->ts[0].tv_nsec;
+                continue;
+            }
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            auto err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+            if (err->ee_errno != ENOMSG || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+                continue;
+            timestamp.id = err->ee_data;
+            has_id = true;
+        }
+        if (has_id && timestamp.timestamp > 0)
+            timestamps.push_back(timestamp);
+    }
+    LOGVP("recv tx timestamps(%d): %ld", fd_, timestamps.size());
+    return timestamps.empty() ? ERR_TIMEOUT : timestamps.size();
+#else
+    return ERR_TIMEOUT;
+#endif // __linux__ && SO_TIMESTAMPING
+}
+
+int Sock::RecvBatch(std::vector<Packet> &packets, int count) const
+{
+    ASSERT(fd_ > 0);
+    ASSERT(count <= packets.size());
+#ifdef __linux__
+    thread_local static std::vector<mmsghdr> msgs;
+    thread_local static std::vector<iovec> iovs;
+    thread_local static std::vector<char> controls;
+    const size_t control_size = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(timespec));
+    if (msgs.size() < count)
+    {
+        msgs.resize(count);
+        iovs.resize(count);
+        controls.resize(count * control_size);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        iovs[i].iov_base = &packets[i].buf[0];
+        iovs[i].iov_len = packets[i].buf.length();
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (is_gro_ || is_timestamp_)
+        {
+            msgs[i].msg_hdr.msg_control = &controls[i * control_size];
+            msgs[i].msg_hdr.msg_controllen = control_size;
+        }
+    }
+    // MSG_TRUNC makes the truncated datagrams report their real length.
+    int result = recvmmsg(fd_, &msgs[0], count, MSG_DONTWAIT | MSG_TRUNC, NULL);
+    if (result < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ERR_TIMEOUT;
+        PSOCKETERROREX("recvmmsg error(%d,count=%d)", fd_, count);
+        return -1;
+    }
+    for (int i = 0; i < result; i++)
+    {
+        packets[i].length = msgs[i].msg_len;
+        ParseControl(&msgs[i].msg_hdr, packets[i].segment_size, packets[i].timestamp);
+    }
+    LOGVP("recvmmsg(%d): count=%d, recv=%d", fd_, count, result);
+    return result;
+#else
+    // only one datagram is sure to be ready.
+    if (count <= 0)
+        return 0;
+    ssize_t result = Recv(&packets[0].buf[0], packets[0].buf.length());
+    if (result < 0)
+        return result;
+    packets[0].length = result;
+    packets[0].segment_size = 0;
+    packets[0].timestamp = 0;
+    return 1;
+#endif // __linux__
+}
+
 int Sock::GetLocalAddress(std::string &ip, int &port)
 {
     return GetLocalAddress(fd_, ip, port);
@@ -358,9 +948,9 @@ std::vector<std::string> Sock::GetLocalIps()
 }
 
 Sock::Sock(int type, int protocol)
-    : fd_(0), type_(type), protocol_(protocol) {}
+    : fd_(0), type_(type), protocol_(protocol), is_gro_(false), is_timestamp_(false), is_zerocopy_(false), zerocopy_id_(0), is_txtime_(false), is_nonblocking_(false) {}
 Sock::Sock(int type, int protocol, int fd)
-    : fd_(fd), type_(type), protocol_(protocol) {}
+    : fd_(fd), type_(type), protocol_(protocol), is_gro_(false), is_timestamp_(false), is_zerocopy_(false), zerocopy_id_(0), is_txtime_(false), is_nonblocking_(false) {}
 
 Sock::~Sock()
 {
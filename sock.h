@@ -13,6 +13,7 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
@@ -28,6 +29,59 @@
 #include "netsnoop.h"
 
 #define MAX_UDP_LENGTH 64*1024
+// the max payload of an ipv4 udp datagram
+#define MAX_UDP_PAYLOAD 65507
+
+/**
+ * @brief A preallocated datagram buffer for batch receiving.
+ * 
+ */
+struct Packet
+{
+    Packet(size_t size = MAX_UDP_LENGTH) : buf(size, '\0'), length(0), segment_size(0), timestamp(0) {}
+    std::string buf;
+    /**
+     * @brief The real datagram length, it may be larger than buf if the datagram is truncated.
+     * 
+     */
+    ssize_t length;
+    /**
+     * @brief The size of the coalesced datagrams if buf holds more than one (UDP GRO), else 0.
+     * 
+     */
+    int segment_size;
+    /**
+     * @brief The arrival time stamped by kernel in nanoseconds of high_resolution_clock, 0 if unknown.
+     * 
+     */
+    int64_t timestamp;
+};
+
+/**
+ * @brief The completion notification of the zero copy sends [lo,hi].
+ * 
+ */
+struct ZeroCopyRange
+{
+    uint32_t lo;
+    uint32_t hi;
+    /**
+     * @brief The kernel copied the data instead, e.g. the device does not support scatter-gather.
+     * 
+     */
+    bool copied;
+};
+
+/**
+ * @brief The time when the datagram id left to the device.
+ * 
+ */
+struct TxTimestamp
+{
+    uint32_t id;
+    // CLOCK_REALTIME in nanoseconds
+    int64_t timestamp;
+};
 
 class Sock
 {
@@ -47,8 +101,171 @@ public:
     int Initialize();
     int Bind(std::string ip, int port);
     int Connect(std::string ip,int port);
+    /**
+     * @brief Send buf, a non-blocking stream queues what the socket buffer can not hold,
+     * which is sent by Flush when the socket is writable.
+     * 
+     * @param buf 
+     * @param size 
+     * @return ssize_t the sent or queued bytes, ERR_WOULD_BLOCK if a non-blocking datagram
+     * socket is full, -1 if error.
+     */
     virtual ssize_t Send(const char *buf, size_t size) const;
     virtual ssize_t Recv(char *buf, size_t size) const;
+    /**
+     * @brief Make the socket calls return at once instead of waiting, Send reports
+     * ERR_WOULD_BLOCK and Recv reports ERR_TIMEOUT if they can not go on.
+     * 
+     * @param enable 
+     * @return int 0 if success, -1 if error.
+     */
+    int SetNonBlocking(bool enable);
+    bool IsNonBlocking() const { return is_nonblocking_; }
+    /**
+     * @brief Send the queued data as much as the socket buffer can hold.
+     * 
+     * @return int the sent bytes, -1 if error.
+     */
+    int Flush();
+    /**
+     * @brief Get the queued bytes which are not sent yet, the owner should wait for
+     * the socket writable and Flush them.
+     * 
+     * @return size_t 
+     */
+    size_t GetPendingSize() const { return pending_.length(); }
+    /**
+     * @brief Recv one datagram and its arrival time stamped by kernel.
+     * 
+     * @param buf 
+     * @param size 
+     * @param timestamp nanoseconds of high_resolution_clock, 0 if unknown.
+     * @return ssize_t the length, ERR_TIMEOUT if there is nothing to read.
+     */
+    virtual ssize_t RecvWithTimestamp(char *buf, size_t size, int64_t &timestamp) const;
+    /**
+     * @brief Send the first count buffers, one datagram per buffer.
+     * 
+     * @param bufs 
+     * @param count 
+     * @return int the sent datagrams count, ERR_WOULD_BLOCK if the socket buffer is full, -1 if error.
+     */
+    virtual int SendBatch(const std::vector<std::string> &bufs, int count) const;
+    /**
+     * @brief Receive up to count datagrams without blocking, one datagram per packet.
+     * 
+     * @param packets 
+     * @param count 
+     * @return int the received datagrams count, ERR_TIMEOUT if there is no datagram, -1 if error.
+     */
+    virtual int RecvBatch(std::vector<Packet> &packets, int count) const;
+    /**
+     * @brief Send the received packets [offset, offset + count) as they are, one datagram per packet.
+     * 
+     * @param packets 
+     * @param offset 
+     * @param count 
+     * @return int the sent datagrams count, ERR_WOULD_BLOCK if the socket buffer is full, -1 if error.
+     */
+    int SendPackets(const std::vector<Packet> &packets, int offset, int count) const;
+    /**
+     * @brief Send buf as datagrams of segment_size bytes by one syscall (UDP GSO).
+     * The kernel splits buf, so the receiver sees the ordinary datagrams.
+     * 
+     * @param buf 
+     * @param segment_size 
+     * @return int the sent datagrams count, ERR_WOULD_BLOCK if the socket buffer is full,
+     * -1 if error or not supported.
+     */
+    virtual int SendSegments(const std::string &buf, int segment_size) const;
+    /**
+     * @brief Let the kernel coalesce the received datagrams of one flow (UDP GRO),
+     * RecvBatch reports the segment size of the coalesced packets.
+     * 
+     * @param enable 
+     * @return int 0 if success, -1 if error or not supported.
+     */
+    virtual int SetGro(bool enable);
+    bool IsGro() const { return is_gro_; }
+    /**
+     * @brief Let the kernel stamp the arrival time of the received datagrams (SO_TIMESTAMPNS),
+     * so the time waiting in the socket and the event loop is not counted as delay.
+     * 
+     * @param enable 
+     * @return int 0 if success, -1 if error or not supported.
+     */
+    int SetTimestamp(bool enable);
+    /**
+     * @brief Allow the socket to send without copying the data (SO_ZEROCOPY).
+     * 
+     * @param enable 
+     * @return int 0 if success, -1 if error or not supported.
+     */
+    virtual int SetZeroCopy(bool enable);
+    bool IsZeroCopy() const { return is_zerocopy_; }
+    /**
+     * @brief Send the first count buffers by MSG_ZEROCOPY, one datagram per buffer.
+     * The buffers must keep unchanged until their completions are received, the sent
+     * datagrams get the notification ids from GetZeroCopyId() one by one.
+     * 
+     * @param bufs 
+     * @param count 
+     * @return int the sent datagrams count, 0 if the kernel can not pin more pages, -1 if error.
+     */
+    int SendZeroCopy(const std::vector<std::string> &bufs, int count);
+    /**
+     * @brief Receive the zero copy completions from the error queue without blocking.
+     * 
+     * @param ranges 
+     * @return int the completions count, ERR_TIMEOUT if there is none, -1 if error.
+     */
+    int RecvZeroCopy(std::vector<ZeroCopyRange> &ranges) const;
+    /**
+     * @brief Get the notification id of the next zero copy send.
+     * 
+     * @return uint32_t 
+     */
+    uint32_t GetZeroCopyId() const { return zerocopy_id_; }
+    /**
+     * @brief Let the kernel pace the socket (SO_MAX_PACING_RATE), which is honoured by the fq qdisc.
+     * 
+     * @param rate in bytes per second, 0 to remove the limit.
+     * @return int 0 if success, -1 if error or not supported.
+     */
+    int SetPacingRate(int64_t rate);
+    /**
+     * @brief Allow SendBatchAt to give the datagrams launch times (SO_TXTIME), which are
+     * honoured by the fq or etf qdisc.
+     * 
+     * @param enable 
+     * @return int 0 if success, -1 if error or not supported.
+     */
+    int SetTxTime(bool enable);
+    /**
+     * @brief Send the first count buffers, the datagram i is launched at launch_time + i * interval.
+     * 
+     * @param bufs 
+     * @param count 
+     * @param launch_time CLOCK_MONOTONIC in nanoseconds.
+     * @param interval in nanoseconds.
+     * @return int the sent datagrams count, ERR_WOULD_BLOCK if the socket buffer is full, -1 if error.
+     */
+    int SendBatchAt(const std::vector<std::string> &bufs, int count, int64_t launch_time, int64_t interval) const;
+    /**
+     * @brief Let the kernel report when the sent datagrams leave to the device (SO_TIMESTAMPING),
+     * the datagrams are numbered from 0 since it is enabled.
+     * 
+     * @param enable 
+     * @return int 0 if success, -1 if error or not supported.
+     */
+    int SetTxTimestamp(bool enable);
+    /**
+     * @brief Receive the tx timestamps from the error queue without blocking.
+     * 
+     * @param timestamps 
+     * @return int the timestamps count, ERR_TIMEOUT if there is none, -1 if error.
+     */
+    int RecvTxTimestamps(std::vector<TxTimestamp> &timestamps) const;
     int GetLocalAddress(std::string& ip,int& port);
     int GetPeerAddress(std::string& ip,int& port);
 
@@ -74,6 +291,17 @@ protected:
     int local_port_;
     std::string remote_ip_;
     int remote_port_;
+    bool is_gro_;
+    bool is_timestamp_;
+    bool is_zerocopy_;
+    uint32_t zerocopy_id_;
+    bool is_txtime_;
+    bool is_nonblocking_;
+    /**
+     * @brief The outbound queue of a non-blocking stream.
+     * 
+     */
+    mutable std::string pending_;
 
     virtual ~Sock();
 
@@ -0,0 +1,135 @@
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif // __linux__
+
+#include "task_queue.h"
+
+#ifdef __linux__
+
+Notifier::Notifier() : is_notified_(false), event_fd_(-1) {}
+
+Notifier::~Notifier()
+{
+    if (event_fd_ >= 0)
+        close(event_fd_);
+}
+
+int Notifier::Initialize()
+{
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd_ < 0)
+    {
+        PSOCKETERROR("create eventfd error");
+        return -1;
+    }
+    LOGVP("create notifier: eventfd=%d", event_fd_);
+    return 0;
+}
+
+int Notifier::GetFd() const { return event_fd_; }
+
+int Notifier::Notify()
+{
+    ASSERT_RETURN(GetFd() >= 0, -1, "notifier is not initialized.");
+    // only the first notify writes, the others are taken together with it.
+    if (is_notified_.exchange(true))
+        return 0;
+    uint64_t value = 1;
+    ASSERT_RETURN(write(event_fd_, &value, sizeof(value)) == sizeof(value), -1, "write eventfd error.");
+    return 0;
+}
+
+int Notifier::Clear()
+{
+    is_notified_.store(false);
+    uint64_t value;
+    if (read(event_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    {
+        PSOCKETERROR("read eventfd error");
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+Notifier::Notifier() : is_notified_(false) {}
+
+Notifier::~Notifier() {}
+
+int Notifier::Initialize()
+{
+    int result;
+    wake_sock_read_ = std::make_shared<Udp>();
+    result = wake_sock_read_->Initialize();
+    ASSERT_RETURN(result >= 0, -1);
+    // auto select a port to create a local read udp.
+    result = wake_sock_read_->Bind("127.0.0.1", 0);
+    ASSERT_RETURN(result >= 0, -1);
+
+    std::string ip;
+    int port;
+    result = wake_sock_read_->GetLocalAddress(ip, port);
+    ASSERT_RETURN(result >= 0, -1);
+
+    wake_sock_write_ = std::make_shared<Udp>();
+    result = wake_sock_write_->Initialize();
+    ASSERT_RETURN(result >= 0, -1);
+    result = wake_sock_write_->Connect(ip, port);
+    ASSERT_RETURN(result >= 0, -1);
+    LOGVP("create notifier: %s:%d", ip.c_str(), port);
+    return 0;
+}
+
+int Notifier::GetFd() const { return wake_sock_read_ ? wake_sock_read_->GetFd() : -1; }
+
+int Notifier::Notify()
+{
+    ASSERT_RETURN(GetFd() >= 0, -1, "notifier is not initialized.");
+    // only the first notify writes, the others are taken together with it.
+    if (is_notified_.exchange(true))
+        return 0;
+    char c = 0;
+    int result = wake_sock_write_->Send(&c, sizeof(c));
+    ASSERT_RETURN(result > 0, -1, "write notifier error.");
+    return 0;
+}
+
+int Notifier::Clear()
+{
+    if (!is_notified_.exchange(false))
+        return 0;
+    char c;
+    int result = wake_sock_read_->Recv(&c, sizeof(c));
+    ASSERT_RETURN(result > 0, -1, "read notifier error.");
+    return 0;
+}
+
+#endif // __linux__
+
+TaskQueue::TaskQueue() {}
+
+int TaskQueue::Initialize()
+{
+    return notifier_.Initialize();
+}
+
+int TaskQueue::Push(Task task)
+{
+    tasks_.Push(std::move(task));
+    return notifier_.Notify();
+}
+
+int TaskQueue::Run()
+{
+    int result = notifier_.Clear();
+    ASSERT_RETURN(result >= 0, -1, "read task queue error.");
+    int count = 0;
+    Task task;
+    while (tasks_.Pop(task))
+    {
+        task();
+        count++;
+    }
+    return count;
+}
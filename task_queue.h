@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+#include <atomic>
+
+#include "udp.h"
+#include "mpsc_queue.h"
+
+/**
+ * @brief Wake an event loop up from any thread, the loop watches GetFd().
+ *  The wakeups are coalesced until the loop clears them.
+ *
+ */
+class Notifier
+{
+public:
+    Notifier();
+    ~Notifier();
+
+    int Initialize();
+    /**
+     * @brief The fd to watch, it is readable when notified.
+     *
+     * @return int
+     */
+    int GetFd() const;
+    /**
+     * @brief Make the fd readable, it is thread safe.
+     *
+     * @return int
+     */
+    int Notify();
+    /**
+     * @brief Make the fd unreadable, should be called by the loop thread before it
+     *  takes the work, so the work pushed later wakes it up again.
+     *
+     * @return int
+     */
+    int Clear();
+
+private:
+    std::atomic<bool> is_notified_;
+#ifdef __linux__
+    int event_fd_;
+#else
+    /**
+     * @brief The local udp pair to wake the loop up, it is portable unlike pipe.
+     *
+     */
+    std::shared_ptr<Udp> wake_sock_read_;
+    std::shared_ptr<Udp> wake_sock_write_;
+#endif // __linux__
+
+    DISALLOW_COPY_AND_ASSIGN(Notifier);
+};
+
+/**
+ * @brief A queue to run tasks on the thread of an event loop.
+ * Any thread can push tasks, the loop watches GetFd() and calls Run() when it is readable.
+ *
+ */
+class TaskQueue
+{
+public:
+    using Task = std::function<void()>;
+
+    TaskQueue();
+
+    int Initialize();
+    /**
+     * @brief The fd to watch, it is readable when there are tasks to run.
+     *
+     * @return int
+     */
+    int GetFd() const { return notifier_.GetFd(); }
+
+    /**
+     * @brief Push a task, it is thread safe and lock-free.
+     *
+     * @param task
+     * @return int
+     */
+    int Push(Task task);
+    /**
+     * @brief Run all the pushed tasks, should be called by the loop thread.
+     *
+     * @return int the tasks count.
+     */
+    int Run();
+
+private:
+    MpscQueue<Task> tasks_;
+    Notifier notifier_;
+
+    DISALLOW_COPY_AND_ASSIGN(TaskQueue);
+};
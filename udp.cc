@@ -60,7 +60,7 @@ ssize_t Udp::SendTo(const std::string &buf, sockaddr_in *peeraddr)
         PSOCKETERROR("sendto error");
         return -1;
     }
-    if (Logger::GetGlobalLogLevel() == LogLevel::LLVERBOSE)
+    if (Logger::ShouldPrintLog(LLVERBOSE))
     {
         char *ip = inet_ntoa(peeraddr->sin_addr);
         int port = ntohs(peeraddr->sin_port);
@@ -84,7 +84,7 @@ ssize_t Udp::RecvFrom(std::string &buf, sockaddr_in *peeraddr)
         return -1;
     }
 
-    if (Logger::GetGlobalLogLevel() == LogLevel::LLVERBOSE)
+    if (Logger::ShouldPrintLog(LLVERBOSE))
     {
         char *ip = inet_ntoa(peeraddr->sin_addr);
         int port = ntohs(peeraddr->sin_port);
@@ -0,0 +1,484 @@
+#include <math.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "netsnoop.h"
+#include "command.h"
+#include "control_channel.h"
+#include "latency_histogram.h"
+#include "mpsc_queue.h"
+#include "quantile_sketch.h"
+#include "sequence_window.h"
+#include "tcp.h"
+
+static int failures = 0;
+
+#define CHECK(expr)                                                                               \
+    do                                                                                            \
+    {                                                                                             \
+        if (!(expr))                                                                              \
+        {                                                                                         \
+            failures++;                                                                           \
+            std::cerr << "check failed: " #expr " (" __FILE__ ":" << __LINE__ << ")" << std::endl; \
+        }                                                                                         \
+    } while (0)
+
+// the sketch promises the quantiles within SKETCH_ACCURACY of the real value.
+#define CHECK_NEAR(value, expected) CHECK(fabs((value) - (expected)) <= (expected)*SKETCH_ACCURACY + 1e-9)
+
+static void TestLatencyHistogramBuckets()
+{
+    // the values below 2^HISTOGRAM_SUB_BITS have their own buckets.
+    for (uint64_t value = 0; value < 64; value++)
+    {
+        CHECK(LatencyHistogram::GetIndex(value) == (int)value);
+        CHECK(LatencyHistogram::GetWidth(value) == 1);
+    }
+    CHECK(LatencyHistogram::GetIndex(64) == 64);
+    CHECK(LatencyHistogram::GetLowest(64) == 64);
+    CHECK(LatencyHistogram::GetWidth(64) == 2);
+    // every value is in its bucket, and the bucket is narrower than 1/32 of it.
+    for (uint64_t value = 1; value < (1ULL << HISTOGRAM_MAX_BITS); value = value * 3 / 2 + 1)
+    {
+        for (auto v : {value - 1, value, value + 1})
+        {
+            int index = LatencyHistogram::GetIndex(v);
+            CHECK(index >= 0 && index < HISTOGRAM_BUCKETS);
+            CHECK(LatencyHistogram::GetLowest(index) <= v);
+            CHECK(v < LatencyHistogram::GetLowest(index) + LatencyHistogram::GetWidth(index));
+            CHECK(v < 64 || LatencyHistogram::GetWidth(index) * 32 <= v);
+        }
+    }
+    // the values beyond the max are clamped to the last bucket.
+    CHECK(LatencyHistogram::GetIndex(1ULL << 40) == HISTOGRAM_BUCKETS - 1);
+}
+
+static void TestLatencyHistogramPercentile()
+{
+    LatencyHistogram histogram;
+    CHECK(histogram.GetPercentile(50) == 0);
+    for (int i = 1; i <= 100; i++)
+        histogram.Record(i);
+    CHECK(histogram.GetCount() == 100);
+    CHECK(histogram.GetMin() == 1);
+    CHECK(histogram.GetMax() == 100);
+    CHECK(histogram.GetPercentile(0) == 1);
+    CHECK(histogram.GetPercentile(50) == 50);
+    // 99 is in the bucket [98, 100), whose middle is 99.
+    CHECK(histogram.GetPercentile(99) == 99);
+    // the middle of [100, 102) is clamped to the max.
+    CHECK(histogram.GetPercentile(100) == 100);
+
+    LatencyHistogram negative;
+    negative.Record(-10);
+    negative.Record(5);
+    negative.Record(20, 2);
+    CHECK(negative.GetCount() == 4);
+    CHECK(negative.GetMin() == -10);
+    CHECK(negative.GetMax() == 20);
+    CHECK(negative.GetPercentile(25) == -10);
+    CHECK(negative.GetPercentile(50) == 5);
+    CHECK(negative.GetPercentile(100) == 20);
+}
+
+static void TestLatencyHistogramShiftMerge()
+{
+    LatencyHistogram histogram;
+    histogram.Record(-10);
+    histogram.Record(5);
+    histogram.Record(20, 2);
+    auto shifted = histogram.Shift(10);
+    CHECK(shifted->GetCount() == 4);
+    CHECK(shifted->GetMin() == 0);
+    CHECK(shifted->GetMax() == 30);
+    CHECK(shifted->GetNegativeCounts().empty());
+    CHECK(shifted->GetPercentile(25) == 0);
+    CHECK(shifted->GetPercentile(50) == 15);
+    CHECK(shifted->GetPercentile(100) == 30);
+
+    LatencyHistogram low, high;
+    for (int i = 1; i <= 50; i++)
+        low.Record(i);
+    for (int i = 51; i <= 100; i++)
+        high.Record(i);
+    high.Record(-5);
+    low.Merge(high);
+    CHECK(low.GetCount() == 101);
+    CHECK(low.GetMin() == -5);
+    CHECK(low.GetMax() == 100);
+    CHECK(low.GetPercentile(0) == -5);
+    CHECK(low.GetPercentile(50) == 50);
+    // merging an empty one changes nothing.
+    low.Merge(LatencyHistogram());
+    CHECK(low.GetCount() == 101);
+}
+
+static void TestQuantileSketch()
+{
+    QuantileSketch sketch;
+    CHECK(sketch.GetPercentile(50) == 0);
+    for (int i = 1; i <= 1000; i++)
+        sketch.Add(i);
+    CHECK(sketch.GetCount() == 1000);
+    CHECK(sketch.GetMin() == 1);
+    CHECK(sketch.GetMax() == 1000);
+    CHECK_NEAR(sketch.GetPercentile(50), 500);
+    CHECK_NEAR(sketch.GetPercentile(99), 990);
+    CHECK(sketch.GetPercentile(100) == 1000);
+
+    // the values below 1 are counted as 0.
+    QuantileSketch zero;
+    zero.Add(0.5, 10);
+    zero.Add(100, 10);
+    CHECK(zero.GetZeroCount() == 10);
+    CHECK(zero.GetPercentile(50) == 0.5);
+    CHECK_NEAR(zero.GetPercentile(100), 100);
+
+    // the same buckets as adding all the values to one sketch.
+    QuantileSketch low, high;
+    for (int i = 1; i <= 500; i++)
+        low.Add(i);
+    for (int i = 501; i <= 1000; i++)
+        high.Add(i);
+    low.Merge(high);
+    CHECK(low.GetCount() == 1000);
+    CHECK(low.GetMin() == 1);
+    CHECK(low.GetMax() == 1000);
+    CHECK(low.GetOffset() == sketch.GetOffset());
+    CHECK(low.GetCounts() == sketch.GetCounts());
+    CHECK(low.GetPercentile(50) == sketch.GetPercentile(50));
+}
+
+static void TestQuantileSketchCollapse()
+{
+    QuantileSketch sketch;
+    sketch.Add(1);
+    sketch.Add(1e30);
+    CHECK((int)sketch.GetCounts().size() <= SKETCH_MAX_BUCKETS);
+    CHECK(sketch.GetCount() == 2);
+    CHECK(sketch.GetMin() == 1);
+    // the high quantiles stay accurate, the low value goes to the lowest bucket.
+    CHECK_NEAR(sketch.GetPercentile(100), 1e30);
+    CHECK(sketch.GetPercentile(50) < 1e30 * (1 - SKETCH_ACCURACY));
+
+    QuantileSketch merged;
+    merged.Add(1e30);
+    QuantileSketch other;
+    other.Add(1, 5);
+    merged.Merge(other);
+    CHECK((int)merged.GetCounts().size() <= SKETCH_MAX_BUCKETS);
+    CHECK(merged.GetCount() == 6);
+    CHECK(merged.GetMin() == 1);
+    CHECK_NEAR(merged.GetPercentile(100), 1e30);
+}
+
+static void TestSequenceWindow()
+{
+    SequenceWindow window(128);
+    CHECK(window.GetSize() == 128);
+    CHECK(window.Set(0) == 1);
+    CHECK(window.Set(0) == 0);
+    CHECK(window.Set(2) == 1);
+    CHECK(window.Test(2));
+    CHECK(!window.Test(1));
+    CHECK(window.GetNextMissing(0) == 1);
+    CHECK(window.Set(1) == 1);
+    CHECK(window.GetNextMissing(0) == 3);
+    // a full word is skipped at once.
+    for (uint64_t i = 3; i < 70; i++)
+        window.Set(i);
+    CHECK(window.GetNextMissing(0) == 70);
+
+    // the window slides with the latest one, the ones before it are too late.
+    CHECK(window.Set(1000) == 1);
+    CHECK(window.GetBase() > 5);
+    CHECK(window.Set(5) == -1);
+    CHECK(!window.Test(5));
+    CHECK(window.Test(1000));
+    CHECK(window.GetNextMissing(window.GetBase()) == window.GetBase());
+
+    // count the loss, reorder and duplicate as the receiver does.
+    SequenceWindow packets(128);
+    uint64_t expected = 0, end = 0;
+    int reorder = 0, duplicate = 0, received = 0;
+    for (uint64_t sequence : {0, 1, 3, 2, 2, 5, 6, 6})
+    {
+        if (packets.Set(sequence) == 0)
+        {
+            duplicate++;
+            continue;
+        }
+        received++;
+        if (sequence != expected)
+            reorder++;
+        if (sequence >= expected)
+            expected = packets.GetNextMissing(sequence + 1);
+        end = std::max(end, sequence + 1);
+    }
+    CHECK(received == 6);
+    CHECK(duplicate == 2);
+    CHECK(reorder == 3);
+    CHECK(expected == 7);
+    CHECK(end - received == 1);
+}
+
+static void TestMpscQueue()
+{
+    MpscQueue<int> queue;
+    int value;
+    CHECK(queue.IsEmpty());
+    CHECK(!queue.Pop(value));
+    for (int i = 0; i < 5; i++)
+        queue.Push(i);
+    CHECK(!queue.IsEmpty());
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK(queue.Pop(value));
+        CHECK(value == i);
+    }
+    CHECK(!queue.Pop(value));
+
+    // the values of every producer keep their order.
+    const int producers = 4;
+    const int count = 10000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.push_back(std::thread([&queue, p, count] {
+            for (int i = 0; i < count; i++)
+                queue.Push(p * count + i);
+        }));
+    }
+    std::vector<int> next(producers, 0);
+    int popped = 0;
+    bool is_ordered = true;
+    while (popped < producers * count)
+    {
+        if (!queue.Pop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        int p = value / count;
+        is_ordered &= p >= 0 && p < producers && value % count == next[p];
+        if (p >= 0 && p < producers)
+            next[p] = value % count + 1;
+        popped++;
+    }
+    for (auto &thread : threads)
+        thread.join();
+    CHECK(is_ordered);
+    CHECK(queue.IsEmpty());
+}
+
+static std::shared_ptr<NetStat> MakeNetStat()
+{
+    auto netstat = std::make_shared<NetStat>();
+    netstat->loss = 0.25;
+    netstat->recv_packets = 300;
+    netstat->recv_bytes = 1LL << 40;
+    netstat->send_batch = 1.5;
+    netstat->delay = 3;
+    auto delay = std::make_shared<LatencyHistogram>();
+    for (int i = 1; i <= 100; i++)
+        delay->Record(i * 1000);
+    netstat->SetDelayHistogram(delay);
+    auto ipdv = std::make_shared<LatencyHistogram>();
+    ipdv->Record(-4000, 3);
+    ipdv->Record(0, 10);
+    ipdv->Record(6000);
+    netstat->SetIpdvHistogram(ipdv);
+    auto arrival = std::make_shared<QuantileSketch>();
+    for (int i = 1; i <= 1000; i++)
+        arrival->Add(i * 1000);
+    netstat->SetArrivalSketch(arrival);
+    netstat->jitter_rfc3550_us = 8;
+    return netstat;
+}
+
+static void CheckNetStat(const NetStat &netstat, const NetStat &expected)
+{
+    CHECK(netstat.loss == expected.loss);
+    CHECK(netstat.recv_packets == expected.recv_packets);
+    CHECK(netstat.recv_bytes == expected.recv_bytes);
+    CHECK(netstat.send_batch == expected.send_batch);
+    CHECK(netstat.delay == expected.delay);
+    CHECK(netstat.jitter_rfc3550_us == expected.jitter_rfc3550_us);
+    // 50000 is in the bucket [49152, 50176).
+    CHECK(netstat.delay_p50_us == 49);
+    CHECK(netstat.delay_p99_us == expected.delay_p99_us);
+    CHECK(netstat.pdv_p99_us == expected.pdv_p99_us);
+    CHECK(netstat.ipdv_p1_us == -4);
+    CHECK(netstat.ipdv_p99_us == expected.ipdv_p99_us);
+    CHECK(netstat.arrival_p50_us == expected.arrival_p50_us);
+    CHECK(netstat.delay_histogram && netstat.delay_histogram->GetCount() == 100);
+    CHECK(netstat.delay_histogram && netstat.delay_histogram->GetMin() == 1000);
+    CHECK(netstat.delay_histogram && netstat.delay_histogram->GetMax() == 100000);
+    CHECK(netstat.delay_histogram && netstat.delay_histogram->GetPercentile(90) == expected.delay_histogram->GetPercentile(90));
+    CHECK(netstat.ipdv_histogram && netstat.ipdv_histogram->GetCount() == 14);
+    CHECK(netstat.ipdv_histogram && netstat.ipdv_histogram->GetPercentile(1) == -4000);
+    CHECK(netstat.arrival_sketch && netstat.arrival_sketch->GetCounts() == expected.arrival_sketch->GetCounts());
+    CHECK(!netstat.recv_speed_sketch || netstat.recv_speed_sketch->GetCount() == 0);
+}
+
+static void TestNetStatSerialize()
+{
+    auto expected = MakeNetStat();
+    std::string out;
+    expected->Serialize(out);
+    NetStat netstat = NetStat();
+    netstat.Deserialize(out.data(), out.length());
+    CheckNetStat(netstat, *expected);
+
+    // an older peer sends less fields, the missing ones are 0.
+    NetStat older = NetStat();
+    older.Deserialize(out.data(), 8 * 3);
+    CHECK(older.loss == expected->loss);
+    CHECK(older.recv_packets == 0);
+    CHECK(!older.delay_histogram);
+}
+
+/**
+ * @brief Connect two tcp sockets on the loopback.
+ *
+ */
+static int Connect(std::shared_ptr<Sock> &client, std::shared_ptr<Sock> &server)
+{
+    int result;
+    std::string ip;
+    int port;
+    auto listen = std::make_shared<Tcp>();
+    if ((result = listen->Initialize()) < 0 || (result = listen->Bind("127.0.0.1", 0)) < 0 ||
+        (result = listen->Listen(1)) < 0 || (result = Sock::GetLocalAddress(listen->GetFd(), ip, port)) < 0)
+        return result;
+    client = std::make_shared<Tcp>();
+    if ((result = client->Initialize()) < 0 || (result = client->Connect(ip, port)) < 0)
+        return result;
+    if ((result = listen->Accept()) < 0)
+        return result;
+    server = std::make_shared<Tcp>(result);
+    return 0;
+}
+
+static int Next(ControlChannel &channel, std::shared_ptr<Command> &command)
+{
+    int result;
+    while ((result = channel.Next(command)) == 0)
+    {
+        if (channel.Recv() <= 0)
+            return -1;
+    }
+    return result;
+}
+
+static void TestControlChannel()
+{
+    std::shared_ptr<Sock> client_sock, server_sock;
+    CHECK(Connect(client_sock, server_sock) == 0);
+    if (!client_sock || !server_sock)
+        return;
+    ControlChannel server(server_sock), client(client_sock);
+    server.SetBinary(true);
+
+    // the client switches to binary by the first frame.
+    std::shared_ptr<Command> command;
+    auto send = CommandFactory::New("send count 10 size 100");
+    CHECK(server.Send(*send) > 0);
+    CHECK(Next(client, command) == 1);
+    CHECK(client.IsBinary());
+    CHECK(command && command->name == "send" && !command->is_private);
+    CHECK(command && command->GetCmd() == send->GetCmd());
+
+    // the coalesced frames are taken one by one.
+    CHECK(client.Send(AckCommand()) > 0);
+    CHECK(client.Send(StopCommand()) > 0);
+    CHECK(Next(server, command) == 1);
+    CHECK(command && command->name == "ack" && command->is_private);
+    CHECK(Next(server, command) == 1);
+    CHECK(command && command->name == "stop");
+
+    ResultCommand result;
+    result.netstat = MakeNetStat();
+    CHECK(client.Send(result) > 0);
+    CHECK(Next(server, command) == 1);
+    auto result_command = std::dynamic_pointer_cast<ResultCommand>(command);
+    CHECK(result_command && result_command->netstat);
+    if (result_command && result_command->netstat)
+        CheckNetStat(*result_command->netstat, *result.netstat);
+
+    ReportCommand report;
+    report.index = 3;
+    report.netstat = std::make_shared<NetStat>();
+    report.netstat->recv_speed = 123456789;
+    report.netstat->loss = 0.5;
+    CHECK(client.Send(report) > 0);
+    CHECK(Next(server, command) == 1);
+    auto report_command = std::dynamic_pointer_cast<ReportCommand>(command);
+    CHECK(report_command && report_command->index == 3);
+    CHECK(report_command && report_command->netstat->recv_speed == 123456789);
+    CHECK(report_command && report_command->netstat->loss == 0.5);
+
+    // a frame split into single bytes is taken when the last byte comes.
+    std::string frame;
+    char buf[256];
+    CHECK(client.Send(StopCommand()) > 0);
+    while (frame.length() < CONTROL_HEAD_LENGTH)
+    {
+        auto length = server_sock->Recv(buf, CONTROL_HEAD_LENGTH - frame.length());
+        if (length <= 0)
+            break;
+        frame.append(buf, length);
+    }
+    CHECK(frame.length() == CONTROL_HEAD_LENGTH);
+    for (size_t i = 0; i < frame.length(); i++)
+    {
+        CHECK(client_sock->Send(&frame[i], 1) == 1);
+        CHECK(server.Recv() == 1);
+        CHECK(server.Next(command) == (i + 1 == frame.length() ? 1 : 0));
+    }
+    CHECK(command && command->name == "stop");
+
+    // a frame of an unknown type is skipped with its payload.
+    std::string unknown = frame;
+    unknown[2] = 100;
+    unknown[4] = 3;
+    unknown += "abc";
+    CHECK(client_sock->Send(unknown.data(), unknown.length()) == (ssize_t)unknown.length());
+    CHECK(client.Send(AckCommand()) > 0);
+    CHECK(Next(server, command) == 1);
+    CHECK(command && command->name == "ack");
+
+    // a frame of another major version is illegal.
+    std::string version = frame;
+    version[1] = CONTROL_VERSION + 1;
+    CHECK(client_sock->Send(version.data(), version.length()) == (ssize_t)version.length());
+    CHECK(Next(server, command) == ERR_ILLEGAL_DATA);
+
+    // a broken frame is illegal.
+    frame[0] = 0;
+    CHECK(client_sock->Send(frame.data(), frame.length()) == (ssize_t)frame.length());
+    CHECK(Next(server, command) == ERR_ILLEGAL_DATA);
+}
+
+/**
+ * @brief Run the deterministic tests of the building blocks.
+ *
+ * @return int the failed checks count.
+ */
+int RunUnitTests()
+{
+    failures = 0;
+    TestLatencyHistogramBuckets();
+    TestLatencyHistogramPercentile();
+    TestLatencyHistogramShiftMerge();
+    TestQuantileSketch();
+    TestQuantileSketchCollapse();
+    TestSequenceWindow();
+    TestMpscQueue();
+    TestNetStatSerialize();
+    TestControlChannel();
+    std::cout << (failures ? "unit tests failed: " : "unit tests passed: ") << failures << std::endl;
+    return failures;
+}
@@ -0,0 +1,610 @@
+#include <string.h>
+#include <errno.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "uring.h"
+
+#ifdef IORING_RECV_MULTISHOT
+
+#define URING_OP_RECV 1ULL
+#define URING_OP_SEND 2ULL
+#define URING_OP_CANCEL 3ULL
+#define URING_OP_PROBE 4ULL
+#define URING_BUFFER_GROUP 0
+
+// user data layout: op(8 bits) | gen(24 bits) | fd or slot(32 bits)
+#define USER_DATA(op, gen, index) (((op) << 56) | ((uint64_t)((gen)&0xffffff) << 32) | (uint32_t)(index))
+#define USER_DATA_OP(data) ((data) >> 56)
+#define USER_DATA_GEN(data) (((data) >> 32) & 0xffffff)
+#define USER_DATA_INDEX(data) ((uint32_t)(data))
+
+//static
+std::shared_ptr<IoUring> IoUring::Create(unsigned entries)
+{
+    std::shared_ptr<IoUring> uring(new IoUring());
+    if (uring->Setup(entries) < 0 || uring->SetupBufferRing() < 0 || uring->Probe() < 0)
+    {
+        LOGWP("io_uring is not supported, fallback to socket io.");
+        return NULL;
+    }
+    LOGDP("create io_uring(%d): entries=%u", uring->ring_fd_, entries);
+    return uring;
+}
+
+IoUring::IoUring()
+    : ring_fd_(-1), sq_ptr_(MAP_FAILED), sq_size_(0), cq_ptr_(MAP_FAILED), cq_size_(0),
+      sqes_((io_uring_sqe *)MAP_FAILED), sqes_size_(0), sq_local_tail_(0), sq_submitted_(0),
+      buf_ring_((io_uring_buf_ring *)MAP_FAILED), bufs_((char *)MAP_FAILED), buf_tail_(0), held_bufs_(0),
+      gen_(0), send_slots_(URING_SEND_SLOTS), queued_sends_(0), send_errors_(0), probe_result_(0)
+{
+    for (int i = URING_SEND_SLOTS - 1; i >= 0; i--)
+    {
+        free_slots_.push_back(i);
+    }
+}
+
+IoUring::~IoUring()
+{
+    if (send_errors_ > 0)
+        LOGWP("io_uring(%d) send errors: %ld", ring_fd_, send_errors_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+    if (bufs_ != MAP_FAILED)
+        munmap(bufs_, URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (buf_ring_ != MAP_FAILED)
+        munmap(buf_ring_, URING_BUFFER_COUNT * sizeof(io_uring_buf));
+    if (sqes_ != MAP_FAILED)
+        munmap(sqes_, sqes_size_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+        munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_ != MAP_FAILED)
+        munmap(sq_ptr_, sq_size_);
+}
+
+int IoUring::Setup(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // multishot recv may generate lots of completions, make the completion queue bigger.
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 8;
+    ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd_ < 0)
+    {
+        PSOCKETERROR("io_uring_setup error");
+        return -1;
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+    sq_ptr_ = mmap(NULL, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    ASSERT_RETURN(sq_ptr_ != MAP_FAILED, -1, "mmap io_uring sq ring error.");
+    cq_ptr_ = single_mmap ? sq_ptr_ : mmap(NULL, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    ASSERT_RETURN(cq_ptr_ != MAP_FAILED, -1, "mmap io_uring cq ring error.");
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe *)mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    ASSERT_RETURN(sqes_ != MAP_FAILED, -1, "mmap io_uring sqes error.");
+
+    auto sq = (char *)sq_ptr_;
+    sq_head_ = (unsigned *)(sq + params.sq_off.head);
+    sq_tail_ = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask_ = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = sq_submitted_ = *sq_tail_;
+    // use the identity mapping between the sq array and the sqes.
+    auto array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; i++)
+    {
+        array[i] = i;
+    }
+
+    auto cq = (char *)cq_ptr_;
+    cq_head_ = (unsigned *)(cq + params.cq_off.head);
+    cq_tail_ = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask_ = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+int IoUring::SetupBufferRing()
+{
+    buf_ring_ = (io_uring_buf_ring *)mmap(NULL, URING_BUFFER_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                                          MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    ASSERT_RETURN(buf_ring_ != MAP_FAILED, -1, "mmap io_uring buffer ring error.");
+    // the pages are only touched by the packets really received.
+    bufs_ = (char *)mmap(NULL, URING_BUFFER_COUNT * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    ASSERT_RETURN(bufs_ != MAP_FAILED, -1, "mmap io_uring buffers error.");
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)buf_ring_;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        PSOCKETERROR("io_uring register buffer ring error");
+        return -1;
+    }
+    for (int i = 0; i < URING_BUFFER_COUNT; i++)
+    {
+        RecycleBuffer(i);
+    }
+    return 0;
+}
+
+/**
+ * @brief Check multishot recv is supported, which is added in linux 6.0.
+ *
+ * @return int
+ */
+int IoUring::Probe()
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_RETURN(fd >= 0, -1);
+    auto sqe = GetSqe();
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = USER_DATA(URING_OP_PROBE, 0, fd);
+    sqe = GetSqe();
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = USER_DATA(URING_OP_PROBE, 0, fd);
+    sqe->user_data = USER_DATA(URING_OP_CANCEL, 0, fd);
+    probe_result_ = 1;
+    int result = Enter(sq_local_tail_ - sq_submitted_, 2);
+    sq_submitted_ = sq_local_tail_;
+    while (result >= 0 && probe_result_ == 1)
+    {
+        if (Reap() == 0)
+            result = Enter(0, 1);
+    }
+    close(fd);
+    if (result < 0 || (probe_result_ < 0 && probe_result_ != -ECANCELED))
+    {
+        LOGWP("io_uring multishot recv is not supported: %s", strerror(-probe_result_));
+        return -1;
+    }
+    return 0;
+}
+
+io_uring_sqe *IoUring::GetSqe()
+{
+    auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head >= sq_entries_)
+    {
+        Submit();
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        ASSERT_RETURN(sq_local_tail_ - head < sq_entries_, NULL, "io_uring sq is full.");
+    }
+    auto sqe = &sqes_[sq_local_tail_ & *sq_mask_];
+    sq_local_tail_++;
+    return sqe;
+}
+
+int IoUring::Enter(unsigned to_submit, unsigned min_complete)
+{
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    int result = syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                         min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+        PSOCKETERROR("io_uring_enter error");
+        return -1;
+    }
+    return std::max(result, 0);
+}
+
+int IoUring::Submit()
+{
+    for (auto it = rearm_fds_.begin(); it != rearm_fds_.end();)
+    {
+        auto socket = sockets_.find(*it);
+        if (socket == sockets_.end() || socket->second.armed)
+        {
+            it = rearm_fds_.erase(it);
+            continue;
+        }
+        // wait until some buffers are recycled.
+        if (held_bufs_ >= URING_BUFFER_COUNT)
+            break;
+        ArmRecv(*it, socket->second);
+        it = rearm_fds_.erase(it);
+    }
+    if (sq_local_tail_ == sq_submitted_)
+        return 0;
+    int result = Enter(sq_local_tail_ - sq_submitted_, 0);
+    if (result < 0)
+        return result;
+    sq_submitted_ = sq_local_tail_;
+    queued_sends_ = 0;
+    return result;
+}
+
+int IoUring::Reap()
+{
+    int count = 0;
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        OnCompletion(&cqes_[head & *cq_mask_]);
+        head++;
+        count++;
+        if (head == tail)
+        {
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+void IoUring::OnCompletion(io_uring_cqe *cqe)
+{
+    auto op = USER_DATA_OP(cqe->user_data);
+    auto index = USER_DATA_INDEX(cqe->user_data);
+    bool has_buffer = cqe->flags & IORING_CQE_F_BUFFER;
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (op == URING_OP_SEND)
+    {
+        free_slots_.push_back(index);
+        if (cqe->res < 0)
+        {
+            send_errors_++;
+            LOGDP("io_uring send error: %s", strerror(-cqe->res));
+        }
+        return;
+    }
+    if (op == URING_OP_PROBE)
+    {
+        if (has_buffer)
+            RecycleBuffer(bid);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            probe_result_ = cqe->res;
+        return;
+    }
+    if (op != URING_OP_RECV)
+        return;
+
+    auto it = sockets_.find(index);
+    if (it == sockets_.end() || it->second.gen != USER_DATA_GEN(cqe->user_data))
+    {
+        // the socket has been detached.
+        if (has_buffer)
+            RecycleBuffer(bid);
+        return;
+    }
+    auto &socket = it->second;
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        socket.armed = false;
+        rearm_fds_.push_back(index);
+    }
+    if (cqe->res < 0)
+    {
+        if (cqe->res == -ENOBUFS)
+            LOGDP("io_uring recv buffers exhausted(%d).", index);
+        else
+            LOGWP("io_uring recv error(%d): %s", index, strerror(-cqe->res));
+        return;
+    }
+    if (!has_buffer)
+        return;
+    socket.packets.push_back(std::make_pair(bid, (uint32_t)cqe->res));
+    held_bufs_++;
+    if (!socket.is_ready)
+    {
+        socket.is_ready = true;
+        ready_fds_.push_back(index);
+    }
+}
+
+void IoUring::RecycleBuffer(uint16_t bid)
+{
+    auto buf = &buf_ring_->bufs[buf_tail_ & (URING_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t)(bufs_ + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    buf_tail_++;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+int IoUring::ArmRecv(int fd, Socket &socket)
+{
+    auto sqe = GetSqe();
+    ASSERT_RETURN(sqe, -1);
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = USER_DATA(URING_OP_RECV, socket.gen, fd);
+    socket.armed = true;
+    return 0;
+}
+
+int IoUring::Attach(int fd)
+{
+    ASSERT_RETURN(!IsAttached(fd), -1, "io_uring socket(%d) has already attached.", fd);
+    auto &socket = sockets_[fd];
+    socket.gen = ++gen_;
+    socket.armed = false;
+    socket.want_read = false;
+    socket.is_ready = false;
+    // keep recv armed even no one wants to read, so the packets never wait in the socket.
+    rearm_fds_.push_back(fd);
+    LOGDP("io_uring attach socket(%d).", fd);
+    return 0;
+}
+
+int IoUring::Detach(int fd)
+{
+    auto it = sockets_.find(fd);
+    if (it == sockets_.end())
+        return 0;
+    auto &socket = it->second;
+    if (socket.armed)
+    {
+        auto sqe = GetSqe();
+        ASSERT_RETURN(sqe, -1);
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = USER_DATA(URING_OP_RECV, socket.gen, fd);
+        sqe->user_data = USER_DATA(URING_OP_CANCEL, socket.gen, fd);
+    }
+    for (auto &packet : socket.packets)
+    {
+        RecycleBuffer(packet.first);
+        held_bufs_--;
+    }
+    sockets_.erase(it);
+    // the socket will be closed soon, cancel the recv now.
+    Submit();
+    LOGDP("io_uring detach socket(%d).", fd);
+    return 0;
+}
+
+bool IoUring::IsAttached(int fd) const
+{
+    return sockets_.find(fd) != sockets_.end();
+}
+
+void IoUring::SetReadInterest(int fd, bool interest)
+{
+    auto it = sockets_.find(fd);
+    if (it == sockets_.end())
+        return;
+    it->second.want_read = interest;
+}
+
+ssize_t IoUring::Send(int fd, const char *buf, size_t size)
+{
+    while (free_slots_.empty())
+    {
+        // all slots are in flight, wait for some sends to complete.
+        if (Submit() < 0 || (Reap() == 0 && Enter(0, 1) < 0))
+            return -1;
+        Reap();
+    }
+    auto slot = free_slots_.back();
+    auto &data = send_slots_[slot];
+    if (data.size() < size)
+        data.resize(size);
+    memcpy(&data[0], buf, size);
+
+    auto sqe = GetSqe();
+    ASSERT_RETURN(sqe, -1);
+    free_slots_.pop_back();
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)data.data();
+    sqe->len = size;
+    sqe->user_data = USER_DATA(URING_OP_SEND, 0, slot);
+    if (++queued_sends_ >= URING_SEND_BATCH)
+        Submit();
+    return size;
+}
+
+ssize_t IoUring::Recv(int fd, char *buf, size_t size)
+{
+    auto it = sockets_.find(fd);
+    ASSERT_RETURN(it != sockets_.end(), -1);
+    auto &packets = it->second.packets;
+    if (packets.empty())
+        return ERR_TIMEOUT;
+    auto packet = packets.front();
+    packets.pop_front();
+    auto length = std::min((size_t)packet.second, size);
+    memcpy(buf, bufs_ + (size_t)packet.first * URING_BUFFER_SIZE, length);
+    RecycleBuffer(packet.first);
+    held_bufs_--;
+    return length;
+}
+
+int IoUring::GetReadableFds(std::vector<int> &fds)
+{
+    int count = 0;
+    for (auto it = ready_fds_.begin(); it != ready_fds_.end();)
+    {
+        auto socket = sockets_.find(*it);
+        if (socket == sockets_.end() || socket->second.packets.empty())
+        {
+            if (socket != sockets_.end())
+                socket->second.is_ready = false;
+            it = ready_fds_.erase(it);
+            continue;
+        }
+        if (socket->second.want_read)
+        {
+            fds.push_back(*it);
+            count++;
+        }
+        it++;
+    }
+    return count;
+}
+
+#else // !IORING_RECV_MULTISHOT
+
+//static
+std::shared_ptr<IoUring> IoUring::Create(unsigned entries)
+{
+    LOGWP("io_uring is not supported, fallback to socket io.");
+    return NULL;
+}
+
+IoUring::~IoUring() {}
+int IoUring::Attach(int fd) { return -1; }
+int IoUring::Detach(int fd) { return -1; }
+bool IoUring::IsAttached(int fd) const { return false; }
+void IoUring::SetReadInterest(int fd, bool interest) {}
+ssize_t IoUring::Send(int fd, const char *buf, size_t size) { return -1; }
+ssize_t IoUring::Recv(int fd, char *buf, size_t size) { return -1; }
+int IoUring::Submit() { return 0; }
+int IoUring::Reap() { return 0; }
+int IoUring::GetReadableFds(std::vector<int> &fds) { return 0; }
+
+#endif // IORING_RECV_MULTISHOT
+
+UringUdp::UringUdp(std::shared_ptr<IoUring> uring) : uring_(uring) {}
+
+UringUdp::~UringUdp()
+{
+    if (fd_ > 0)
+        uring_->Detach(fd_);
+}
+
+//static
+std::shared_ptr<Udp> UringUdp::New(std::shared_ptr<IoUring> uring)
+{
+    if (uring)
+        return std::make_shared<UringUdp>(uring);
+    return std::make_shared<Udp>();
+}
+
+int UringUdp::InitializeEx(int fd) const
+{
+    if (uring_->Attach(fd) < 0)
+    {
+        closesocket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+ssize_t UringUdp::Send(const char *buf, size_t size) const
+{
+    ASSERT(fd_ > 0);
+    ssize_t result = uring_->Send(fd_, buf, size);
+    if (result < 0)
+    {
+        LOGEP("io_uring send error(%d,result=%ld)", fd_, result);
+        return -1;
+    }
+    LOGVP("io_uring send(%d): length=%ld", fd_, result);
+    return result;
+}
+
+int UringUdp::SendBatch(const std::vector<std::string> &bufs, int count) const
+{
+    ASSERT(fd_ > 0);
+    // the sends are queued and submitted together by the engine.
+    int sent = 0;
+    for (; sent < count; sent++)
+    {
+        if (uring_->Send(fd_, bufs[sent].data(), bufs[sent].length()) < 0)
+            break;
+    }
+    if (sent == 0 && count > 0)
+    {
+        LOGEP("io_uring send batch error(%d)", fd_);
+        return -1;
+    }
+    LOGVP("io_uring send batch(%d): count=%d, sent=%d", fd_, count, sent);
+    return sent;
+}
+
+int UringUdp::SendSegments(const std::string &buf, int segment_size) const
+{
+    // the segments are sent by the socket directly, submit the queued sends first to keep the order.
+    uring_->Submit();
+    return Udp::SendSegments(buf, segment_size);
+}
+
+int UringUdp::SetGro(bool enable)
+{
+    // the multishot recv does not report the segment size of the coalesced packets.
+    if (enable)
+    {
+        LOGWP("udp gro is not supported by uring(%d).", fd_);
+        return -1;
+    }
+    return Udp::SetGro(enable);
+}
+
+int UringUdp::SetZeroCopy(bool enable)
+{
+    // the sends are queued to uring, which can not keep the buffers until the completions.
+    if (enable)
+    {
+        LOGWP("zerocopy is not supported by uring(%d).", fd_);
+        return -1;
+    }
+    return Udp::SetZeroCopy(enable);
+}
+
+int UringUdp::RecvBatch(std::vector<Packet> &packets, int count) const
+{
+    ASSERT(fd_ > 0);
+    int received = 0;
+    for (; received < count; received++)
+    {
+        auto &packet = packets[received];
+        ssize_t result = uring_->Recv(fd_, &packet.buf[0], packet.buf.length());
+        if (result == ERR_TIMEOUT)
+            break;
+        if (result < 0)
+            return received > 0 ? received : -1;
+        packet.length = result;
+        packet.segment_size = 0;
+        packet.timestamp = 0;
+    }
+    LOGVP("io_uring recv batch(%d): count=%d, recv=%d", fd_, count, received);
+    return received > 0 ? received : ERR_TIMEOUT;
+}
+
+ssize_t UringUdp::RecvWithTimestamp(char *buf, size_t size, int64_t &timestamp) const
+{
+    // the multishot recv does not report the kernel timestamp.
+    timestamp = 0;
+    return Recv(buf, size);
+}
+
+ssize_t UringUdp::Recv(char *buf, size_t size) const
+{
+    ASSERT(fd_ > 0);
+    ssize_t result = uring_->Recv(fd_, buf, size);
+    LOGVP("io_uring recv(%d): length=%ld", fd_, result);
+    return result;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "udp.h"
+
+#define URING_DEFAULT_ENTRIES 256
+// must be power of 2
+#define URING_BUFFER_COUNT 128
+#define URING_BUFFER_SIZE MAX_UDP_LENGTH
+#define URING_SEND_SLOTS 256
+#define URING_SEND_BATCH 32
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/**
+ * @brief A completion based io engine for the data sockets, built on io_uring.
+ * Every attached socket keeps a multishot recv armed, which picks buffers from
+ * a provided buffer ring, and sends are queued and submitted in batches.
+ *
+ * An engine is not thread safe, it should be used by one event loop only.
+ */
+class IoUring
+{
+public:
+    /**
+     * @brief Create an engine.
+     *
+     * @param entries the submission queue size
+     * @return std::shared_ptr<IoUring> NULL if the kernel lacks support.
+     */
+    static std::shared_ptr<IoUring> Create(unsigned entries = URING_DEFAULT_ENTRIES);
+    ~IoUring();
+
+    int GetFd() const { return ring_fd_; }
+
+    /**
+     * @brief Let the engine do the io of a socket.
+     *
+     * @param fd
+     * @return int
+     */
+    int Attach(int fd);
+    /**
+     * @brief Cancel the io of a socket, should be called before closing the socket.
+     *
+     * @param fd
+     * @return int
+     */
+    int Detach(int fd);
+    bool IsAttached(int fd) const;
+    void SetReadInterest(int fd, bool interest);
+
+    /**
+     * @brief Queue a send, the data is copied so buf can be reused at once.
+     *
+     * @return ssize_t size if success, else -1.
+     */
+    ssize_t Send(int fd, const char *buf, size_t size);
+    /**
+     * @brief Take a received packet of fd.
+     *
+     * @return ssize_t the packet length, ERR_TIMEOUT if there is no packet.
+     */
+    ssize_t Recv(int fd, char *buf, size_t size);
+
+    /**
+     * @brief Submit the queued requests.
+     *
+     * @return int
+     */
+    int Submit();
+    /**
+     * @brief Process the ready completions, never block.
+     *
+     * @return int the completions count.
+     */
+    int Reap();
+    /**
+     * @brief Get the fds which have packets and want to read.
+     *
+     * @param fds
+     * @return int the fds count.
+     */
+    int GetReadableFds(std::vector<int> &fds);
+
+private:
+    struct Socket
+    {
+        uint32_t gen;
+        bool armed;
+        bool want_read;
+        bool is_ready;
+        // buffer id and packet length
+        std::deque<std::pair<uint16_t, uint32_t>> packets;
+    };
+
+    IoUring();
+    int Setup(unsigned entries);
+    int SetupBufferRing();
+    int Probe();
+    io_uring_sqe *GetSqe();
+    int Enter(unsigned to_submit, unsigned min_complete);
+    int ArmRecv(int fd, Socket &socket);
+    void RecycleBuffer(uint16_t bid);
+    void OnCompletion(io_uring_cqe *cqe);
+
+    int ring_fd_;
+    void *sq_ptr_;
+    size_t sq_size_;
+    void *cq_ptr_;
+    size_t cq_size_;
+    io_uring_sqe *sqes_;
+    size_t sqes_size_;
+    unsigned *sq_head_;
+    unsigned *sq_tail_;
+    unsigned *sq_mask_;
+    unsigned sq_entries_;
+    unsigned sq_local_tail_;
+    unsigned sq_submitted_;
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned *cq_mask_;
+    io_uring_cqe *cqes_;
+
+    io_uring_buf_ring *buf_ring_;
+    char *bufs_;
+    uint16_t buf_tail_;
+    // the buffers held by the packets which are not read yet.
+    int held_bufs_;
+
+    uint32_t gen_;
+    std::unordered_map<int, Socket> sockets_;
+    std::vector<int> ready_fds_;
+    std::vector<int> rearm_fds_;
+
+    std::vector<std::string> send_slots_;
+    std::vector<int> free_slots_;
+    int queued_sends_;
+    int64_t send_errors_;
+    int probe_result_;
+
+    DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+/**
+ * @brief A udp socket whose io is done by IoUring.
+ *
+ */
+class UringUdp : public Udp
+{
+public:
+    UringUdp(std::shared_ptr<IoUring> uring);
+    ~UringUdp() override;
+
+    /**
+     * @brief Create a UringUdp if uring is valid, else create a Udp.
+     *
+     * @param uring
+     * @return std::shared_ptr<Udp>
+     */
+    static std::shared_ptr<Udp> New(std::shared_ptr<IoUring> uring);
+
+    ssize_t Send(const char *buf, size_t size) const override;
+    ssize_t Recv(char *buf, size_t size) const override;
+    ssize_t RecvWithTimestamp(char *buf, size_t size, int64_t &timestamp) const override;
+    int SendBatch(const std::vector<std::string> &bufs, int count) const override;
+    int RecvBatch(std::vector<Packet> &packets, int count) const override;
+    int SendSegments(const std::string &buf, int segment_size) const override;
+    int SetGro(bool enable) override;
+    int SetZeroCopy(bool enable) override;
+
+private:
+    int InitializeEx(int fd) const override;
+
+    std::shared_ptr<IoUring> uring_;
+
+    DISALLOW_COPY_AND_ASSIGN(UringUdp);
+};